@@ -2,13 +2,16 @@
 #include <iostream>
 #include <string>
 #include <chrono>
+#include <memory>
+#include <vector>
 #include "../Image/Image.h"
+#include "../Common/CommandLine.h"
 #include "Denoising.h"
 
 int main(int argc, char** argv) {
-    if (argc != 7) {
+    if (argc < 7 || (argc - 7) % 2 != 0) {
         std::cerr << "Usage: " << argv[0]
-            << " <input_image_path> <output_image_path> <strength> <step_size> <tol> <suppress_log>"
+            << " <input_image_path> <output_image_path> <strength> <step_size> <tol> <suppress_log> [--solver gd|bb|ld] [--preconditioner jacobi|multigrid] [--sweep s1,s2,...] [--check-every k] [--precision fp32|fp16|bf16] [--compact-image true|false] [--tile-iterations k|auto] [--numa true|false] [--active-set threshold] [--mask path] [--tv isotropic|anisotropic|huber] [--boundary truncated|neumann|periodic] [--scalar float|double] [--huber-delta d] [--checkpoint path] [--checkpoint-every n] [--resume true|false] [--perf-counters true|false] [--frames n] [--deadline-ms ms] [--max-iterations n]"
             << std::endl;
         return -1;
     }
@@ -18,22 +21,256 @@ int main(int argc, char** argv) {
         suppress_log = false;
     }
 
+    // Optional arguments are given as "--name value" pairs after the positional ones
+    std::string solver = "gd";
+    std::string preconditioner = "jacobi";
+    std::string sweep;
+    std::string check_every_str = "1";
+    std::string precision;
+    bool compact_image = false;
+    std::string tile_iterations;
+    bool numa_aware = false;
+    std::string active_set;
+    std::string mask_path;
+    CheckpointOptions checkpoint;
+    std::string tv_variant;
+    std::string boundary;
+    std::string scalar;
+    std::string huber_delta;
+    bool perf_counters = false;
+    std::string frames_str;
+    std::string deadline_ms;
+    std::string max_iterations;
+    // The solver chosen below rejects the options given that it does not take (see require_supported_options)
+    std::vector<std::string> given_options;
+    for (int i = 7; i < argc; i += 2) {
+        std::string option = argv[i];
+        given_options.push_back(option);
+        if (option == "--solver") {
+            solver = argv[i + 1];
+        }
+        else if (option == "--preconditioner") {
+            preconditioner = argv[i + 1];
+        }
+        else if (option == "--sweep") {
+            sweep = argv[i + 1];
+        }
+        else if (option == "--check-every") {
+            check_every_str = argv[i + 1];
+        }
+        else if (option == "--precision") {
+            precision = argv[i + 1];
+        }
+        else if (option == "--compact-image") {
+            std::string value = argv[i + 1];
+            compact_image = value == "true" || value == "1";
+        }
+        else if (option == "--tile-iterations") {
+            tile_iterations = argv[i + 1];
+        }
+        else if (option == "--numa") {
+            std::string value = argv[i + 1];
+            numa_aware = value == "true" || value == "1";
+        }
+        else if (option == "--active-set") {
+            active_set = argv[i + 1];
+        }
+        else if (option == "--mask") {
+            mask_path = argv[i + 1];
+        }
+        else if (option == "--tv") {
+            tv_variant = argv[i + 1];
+        }
+        else if (option == "--boundary") {
+            boundary = argv[i + 1];
+        }
+        else if (option == "--scalar") {
+            scalar = argv[i + 1];
+        }
+        else if (option == "--huber-delta") {
+            huber_delta = argv[i + 1];
+        }
+        else if (option == "--checkpoint") {
+            checkpoint.path = argv[i + 1];
+        }
+        else if (option == "--checkpoint-every") {
+            checkpoint.interval_iterations = std::stoi(argv[i + 1]);
+        }
+        else if (option == "--resume") {
+            std::string value = argv[i + 1];
+            checkpoint.resume = value == "true" || value == "1";
+        }
+        else if (option == "--perf-counters") {
+            std::string value = argv[i + 1];
+            perf_counters = value == "true" || value == "1";
+        }
+        else if (option == "--frames") {
+            frames_str = argv[i + 1];
+        }
+        else if (option == "--deadline-ms") {
+            deadline_ms = argv[i + 1];
+        }
+        else if (option == "--max-iterations") {
+            max_iterations = argv[i + 1];
+        }
+        else {
+            std::cerr << "Unknown option: " << option << std::endl;
+            return -1;
+        }
+    }
+    if (solver != "gd" && solver != "bb" && solver != "ld") {
+        std::cerr << "Unknown solver: " << solver << " (expected gd, bb or ld)" << std::endl;
+        return -1;
+    }
+    if (solver == "ld" && !sweep.empty()) {
+        std::cerr << "A sweep only supports the gd and bb solvers" << std::endl;
+        return -1;
+    }
+    // Any of the real-time options denoises a stream of frames, the image paths are then frame patterns (see frame_path)
+    const bool real_time = !frames_str.empty() || !deadline_ms.empty() || !max_iterations.empty();
+    if (real_time && solver != "gd") {
+        std::cerr << "The real-time mode only supports the gd solver" << std::endl;
+        return -1;
+    }
+
     try {
-        Image image(argv[1]);
+        Image image(real_time ? frame_path(argv[1], 0) : std::string(argv[1]));
 
         float strength = std::stof(argv[3]);
         float step_size = std::stof(argv[4]);
         float tol = std::stof(argv[5]);
+        int check_every = std::stoi(check_every_str);
+
+        // Any of the model options selects the templated solver, the others keep their defaults
+        const bool model_given = !tv_variant.empty() || !boundary.empty() || !scalar.empty() || !huber_delta.empty();
+        TvModel model;
+        if (!tv_variant.empty()) {
+            model.variant = parse_tv_variant(tv_variant);
+        }
+        if (!boundary.empty()) {
+            model.boundary = parse_boundary_condition(boundary);
+        }
+        if (!scalar.empty()) {
+            model.scalar = parse_scalar_type(scalar);
+        }
+        if (!huber_delta.empty()) {
+            model.huber_delta = std::stof(huber_delta);
+        }
 
         auto start = std::chrono::high_resolution_clock::now();
 
-        Image denoisedImage = tv_denoise_gradient_descent(image, strength, step_size, tol, suppress_log);
+        // A sweep solves every listed strength (instead of the positional one) in one run
+        if (!sweep.empty()) {
+            require_supported_options(given_options, "a sweep", { "--sweep" });
+            std::vector<RegularizationPathResult> results = tv_denoise_regularization_path(
+                image, parse_float_list(sweep), step_size, tol, suppress_log, solver == "bb"
+            );
+
+            std::chrono::duration<float> elapsed = std::chrono::high_resolution_clock::now() - start;
+            std::cout << "CPU_Denoising sweep took: " << elapsed.count() << " seconds" << std::endl;
+
+            for (const RegularizationPathResult& result : results) {
+                std::cout << "Strength: " << result.strength << ", Loss: " << result.loss
+                    << ", TV: " << result.tv_norm << ", L2: " << result.l2_norm << std::endl;
+            }
+            write_regularization_path(argv[2], results);
+            return 0;
+        }
+
+        // Every frame is solved within the deadline and the iteration budget, warm-started from the previous one.
+        // Only the denoising counts towards the latency of a frame, not reading and writing the files.
+        if (real_time) {
+            require_supported_options(given_options, "the real-time mode", { "--frames", "--deadline-ms", "--max-iterations", "--check-every" });
+            RealTimeOptions options;
+            if (!deadline_ms.empty()) {
+                options.deadline_ms = std::stod(deadline_ms);
+            }
+            if (!max_iterations.empty()) {
+                options.max_iterations = std::stoi(max_iterations);
+            }
+            RealTimeDenoiser denoiser(
+                [&](const Image& frame, const Image& initial, float level_strength, SolveBudget& budget) {
+                    return tv_denoise_gradient_descent(frame, level_strength, step_size, tol, true, initial, budget, check_every);
+                },
+                strength, options
+            );
+
+            const int frames = frames_str.empty() ? 1 : std::stoi(frames_str);
+            for (int k = 0; k < frames; ++k) {
+                Image denoised = denoiser.denoise(k == 0 ? image : Image(frame_path(argv[1], k)));
+                cv::imwrite(frame_path(argv[2], k), denoised.toMat());
+
+                if (!suppress_log) {
+                    const FrameStats& stats = denoiser.frame_stats().back();
+                    std::cout << "Frame " << k << ": " << stats.latency_ms << " ms, level " << stats.level << ", "
+                        << stats.iterations << " iterations, loss " << stats.loss << (stats.missed ? ", missed the deadline" : "") << std::endl;
+                }
+            }
+            std::cout << denoiser.report();
+            return 0;
+        }
+
+        // The Barzilai-Borwein and the lagged diffusivity solver do not take a step size, step_size is ignored.
+        // The other options select a variant of gradient descent, the first one given wins and every variant
+        // rejects the options it does not take.
+        Image denoisedImage;
+        std::unique_ptr<SolverProfiler> profiler;
+        if (solver == "bb") {
+            require_supported_options(given_options, "the bb solver", {});
+            denoisedImage = tv_denoise_barzilai_borwein(image, strength, tol, suppress_log);
+        }
+        else if (solver == "ld") {
+            require_supported_options(given_options, "the ld solver", { "--preconditioner" });
+            denoisedImage = tv_denoise_lagged_diffusivity(image, strength, tol, suppress_log, parse_preconditioner(preconditioner));
+        }
+        else if (!precision.empty()) {
+            require_supported_options(given_options, "the mixed precision solver", { "--precision", "--compact-image" });
+            denoisedImage = tv_denoise_gradient_descent_mixed(
+                image, strength, step_size, tol, suppress_log, parse_storage_precision(precision), compact_image
+            );
+        }
+        else if (!tile_iterations.empty()) {
+            require_supported_options(given_options, "the tiled solver", { "--tile-iterations", "--numa" });
+            // "auto" (0) chooses the iterations per sweep and the tile size from the cache size
+            const int iterations_per_sweep = tile_iterations == "auto" ? 0 : std::stoi(tile_iterations);
+            denoisedImage = tv_denoise_gradient_descent_tiled(image, strength, step_size, tol, suppress_log, iterations_per_sweep, 0, 0, numa_aware);
+        }
+        else if (model_given) {
+            require_supported_options(given_options, "the model solver", { "--tv", "--boundary", "--scalar", "--huber-delta", "--check-every" });
+            denoisedImage = tv_denoise_gradient_descent_model(image, strength, step_size, tol, suppress_log, model, check_every);
+        }
+        else if (!mask_path.empty()) {
+            require_supported_options(given_options, "the masked solver", { "--mask" });
+            denoisedImage = tv_denoise_gradient_descent_masked(image, Image(mask_path), strength, step_size, tol, suppress_log);
+        }
+        else if (!active_set.empty()) {
+            require_supported_options(given_options, "the active set solver", { "--active-set" });
+            denoisedImage = tv_denoise_gradient_descent_active_set(image, strength, step_size, tol, suppress_log, active_set_tile_size, std::stof(active_set));
+        }
+        else if (!checkpoint.path.empty()) {
+            require_supported_options(given_options, "checkpointing", { "--checkpoint", "--checkpoint-every", "--resume", "--check-every" });
+            denoisedImage = tv_denoise_gradient_descent(image, strength, step_size, tol, suppress_log, checkpoint, check_every);
+        }
+        else if (perf_counters) {
+            require_supported_options(given_options, "the profiled solver", { "--perf-counters", "--check-every" });
+            profiler.reset(new SolverProfiler());
+            denoisedImage = tv_denoise_gradient_descent(image, strength, step_size, tol, suppress_log, *profiler, check_every);
+        }
+        else {
+            require_supported_options(given_options, "gradient descent", { "--check-every", "--perf-counters" });
+            denoisedImage = tv_denoise_gradient_descent(image, strength, step_size, tol, suppress_log, check_every);
+        }
 
         auto end = std::chrono::high_resolution_clock::now();
 
         std::chrono::duration<float> elapsed = end - start;
         std::cout << "CPU_Denoising took: " << elapsed.count() << " seconds" << std::endl;
 
+        // The bandwidth ceiling of the roofline is measured after the timed solve
+        if (profiler) {
+            std::cout << profiler->report();
+        }
+
         cv::Mat displayImage = denoisedImage.toMat();
         
         if (!suppress_log) {
@@ -1,38 +1,164 @@
 #include <iostream>
 #include <cmath>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
 #include "Denoising.h"
 #include "../Image/Image.h"
+#include "../Common/HalfPrecision.h"
+#include "../Common/NumaTopology.h"
+#include "../Common/Reduction.h"
+#include "../Common/Convergence.h"
 
-float tv_norm_and_grad(const Image& img, Image& grad, float eps) {
-    const int rows = img.getRows();
-    const int cols = img.getCols();
-    float tv_norm = 0.0f;
+// Policies of the templated TV term (see tv_denoise_gradient_descent_model). A TV variant maps the forward
+// differences of a pixel to its TV value and the derivatives by both differences, a boundary condition gives
+// the neighbours of the last column and row. Every combination is compiled into its own loops.
+
+struct IsotropicTv {
+    template <typename T>
+    static T eval(T x_diff, T y_diff, T eps, T delta, T& dx, T& dy) {
+        const T grad_mag = std::sqrt(x_diff * x_diff + y_diff * y_diff + eps);
+        dx = x_diff / grad_mag;
+        dy = y_diff / grad_mag;
+        return grad_mag;
+    }
+};
+
+struct AnisotropicTv {
+    template <typename T>
+    static T eval(T x_diff, T y_diff, T eps, T delta, T& dx, T& dy) {
+        const T x_mag = std::sqrt(x_diff * x_diff + eps);
+        const T y_mag = std::sqrt(y_diff * y_diff + eps);
+        dx = x_diff / x_mag;
+        dy = y_diff / y_mag;
+        return x_mag + y_mag;
+    }
+};
+
+struct HuberTv {
+    template <typename T>
+    static T eval(T x_diff, T y_diff, T eps, T delta, T& dx, T& dy) {
+        const T grad_mag = std::sqrt(x_diff * x_diff + y_diff * y_diff);
+        // Both pieces are computed, so the choice compiles to a select instead of a branch
+        const T scale = T(1) / std::max(grad_mag, delta);
+        dx = x_diff * scale;
+        dy = y_diff * scale;
+        return grad_mag > delta ? grad_mag - T(0.5) * delta : T(0.5) * grad_mag * grad_mag / delta;
+    }
+};
+
+struct TruncatedBoundary {
+    static const bool covers_border = false;
+    static int last_column_right(int idx, int cols) { return idx; }
+    static int last_row_down(int idx, int col) { return idx; }
+};
+
+struct NeumannBoundary {
+    // The difference across the border is zero, the pixel is its own neighbour
+    static const bool covers_border = true;
+    static int last_column_right(int idx, int cols) { return idx; }
+    static int last_row_down(int idx, int col) { return idx; }
+};
+
+struct PeriodicBoundary {
+    static const bool covers_border = true;
+    static int last_column_right(int idx, int cols) { return idx - cols + 1; }
+    static int last_row_down(int idx, int col) { return col; }
+};
+
+/**
+ * @brief Adds strength times the gradient of the TV term to grad and returns the TV term (without strength).
+ *
+ * The interior loop is the same for every boundary condition, the stencils of the last column and row
+ * are only compiled in for the conditions that cover the border. Without with_norm the TV term is not
+ * summed and 0 is returned.
+ */
+template <typename T, typename Tv, typename Boundary, bool with_norm = true>
+static T tv_term_and_grad(const T* img, T* grad, int rows, int cols, T strength, T eps, T delta) {
+    ReproducibleSum tv_norm;
+    auto stencil = [&](int idx, int right, int down) {
+        T dx, dy;
+        const T norm = Tv::eval(img[idx] - img[right], img[idx] - img[down], eps, delta, dx, dy);
+        if (with_norm) {
+            tv_norm += norm;
+        }
+        grad[idx] += strength * (dx + dy);
+        grad[right] -= strength * dx;
+        grad[down] -= strength * dy;
+    };
 
-    // Compute the total variation norm and gradient
     for (int i = 0; i < rows - 1; ++i) {
+        const int row = i * cols;
+        for (int j = 0; j < cols - 1; ++j) {
+            stencil(row + j, row + j + 1, row + j + cols);
+        }
+        if (Boundary::covers_border) {
+            const int idx = row + cols - 1;
+            stencil(idx, Boundary::last_column_right(idx, cols), idx + cols);
+        }
+    }
+    if (Boundary::covers_border) {
+        const int row = (rows - 1) * cols;
         for (int j = 0; j < cols - 1; ++j) {
-            const float x_diff = img(i, j) - img(i, j + 1);
-            const float y_diff = img(i, j) - img(i + 1, j);
-            const float grad_mag = std::sqrt(x_diff * x_diff + y_diff * y_diff + eps);
-            tv_norm += grad_mag;
+            stencil(row + j, row + j + 1, Boundary::last_row_down(row + j, j));
+        }
+        const int idx = row + cols - 1;
+        stencil(idx, Boundary::last_column_right(idx, cols), Boundary::last_row_down(idx, cols - 1));
+    }
+    return static_cast<T>(tv_norm.value());
+}
 
-            const float dx = x_diff / grad_mag;
-            const float dy = y_diff / grad_mag;
+/**
+ * @brief Loss of the TV model and its gradient in grad (overwritten).
+ *
+ * The TV gradient is accumulated unscaled in grad and scaled by strength once, so the gradient is the same
+ * whether the loss is evaluated as well or not (see check_every). Without with_loss the loss is not summed
+ * and 0 is returned.
+ */
+template <typename T, typename Tv, typename Boundary, bool with_loss>
+static float model_loss_and_grad(const T* img, const T* orig, T* grad, int rows, int cols, T strength, T eps, T delta) {
+    const size_t img_size = static_cast<size_t>(rows) * cols;
+    std::fill(grad, grad + img_size, T(0));
+    const T tv_norm = tv_term_and_grad<T, Tv, Boundary, with_loss>(img, grad, rows, cols, T(1), eps, delta);
 
-            grad(i, j) += dx + dy;
-            grad(i, j + 1) -= dx;
-            grad(i + 1, j) -= dy;
+    ReproducibleSum l2_norm;
+    for (size_t k = 0; k < img_size; ++k) {
+        const T diff = img[k] - orig[k];
+        grad[k] = strength * grad[k];
+        grad[k] += diff;
+        if (with_loss) {
+            l2_norm += diff * diff;
         }
     }
+    return with_loss ? static_cast<float>(strength * tv_norm + T(0.5) * static_cast<T>(l2_norm.value())) : 0.0f;
+}
 
-    return tv_norm;
+float tv_norm_and_grad(const Image& img, Image& grad, float eps) {
+    // The default model, strength 1 leaves the gradient unscaled
+    return tv_term_and_grad<float, IsotropicTv, TruncatedBoundary>(img.data(), grad.data(), img.getRows(), img.getCols(), 1.0f, eps, 0.0f);
 }
 
 float l2_norm_and_grad(const Image& img, const Image& orig, Image& grad) {
     const int rows = img.getRows();
     const int cols = img.getCols();
-    float l2_norm = 0.0f;
+    ReproducibleSum l2_norm;
 
     // Compute the L2 norm and gradient of the image and the original image
     for (int i = 0; i < rows; ++i) {
@@ -42,37 +168,322 @@ float l2_norm_and_grad(const Image& img, const Image& orig, Image& grad) {
             l2_norm += diff * diff;
         }
     }
-    return 0.5f * l2_norm;
+    return 0.5f * static_cast<float>(l2_norm.value());
+}
+
+/**
+ * @brief Loss of the sums of the TV and the L2 term, rounded like the loss of eval_loss_and_grad.
+ */
+static float combine_loss(float strength, const ReproducibleSum& tv_norm, const ReproducibleSum& l2_norm) {
+    return strength * static_cast<float>(tv_norm.value()) + 0.5f * static_cast<float>(l2_norm.value());
 }
 
 float eval_loss_and_grad(const Image& img, const Image& orig, float strength, Image& grad) {
-    const int rows = img.getRows();
-    const int cols = img.getCols();
-    Image tv_grad(rows, cols);
-    const float tv_norm = tv_norm_and_grad(img, tv_grad);
+    // The default model, the same evaluation as in the iterations of tv_denoise_gradient_descent
+    return model_loss_and_grad<float, IsotropicTv, TruncatedBoundary, true>(
+        img.data(), orig.data(), grad.data(), img.getRows(), img.getCols(), strength, 1e-8f, 0.0f
+    );
+}
 
-    for (int i = 0; i < rows; ++i)
-        for (int j = 0; j < cols; ++j)
-            grad(i, j) = strength * tv_grad(i, j);
+void eval_grad(const Image& img, const Image& orig, float strength, Image& grad, float eps) {
+    // Same evaluation as eval_loss_and_grad without summing the loss, so both round the gradient the same way
+    model_loss_and_grad<float, IsotropicTv, TruncatedBoundary, false>(
+        img.data(), orig.data(), grad.data(), img.getRows(), img.getCols(), strength, eps, 0.0f
+    );
+}
 
-    Image l2_grad(rows, cols);
-    const float l2_norm = l2_norm_and_grad(img, orig, l2_grad);
-    // Compute the combined weighted gradient
-    for (int i = 0; i < rows; ++i)
-        for (int j = 0; j < cols; ++j)
-            grad(i, j) += l2_grad(i, j);
+/**
+ * @brief Copies an iterate of the solver to a float image.
+ */
+template <typename T>
+static Image to_image(const std::vector<T>& values, int rows, int cols) {
+    Image image(rows, cols);
+    std::transform(values.begin(), values.end(), image.data(), [](T value) { return static_cast<float>(value); });
+    return image;
+}
+
+/**
+ * @brief Gradient descent of every tv_denoise_gradient_descent and tv_denoise_gradient_descent_model overload.
+ *
+ * The iterate, the momentum and the gradient are of type T, the TV term is the one of the model. The default
+ * tv_denoise_gradient_descent is the <float, IsotropicTv, TruncatedBoundary> instantiation. initial, progress,
+ * checkpoint, profiler and budget may be nullptr. Checkpoints are stored as float, a double solve resumes from
+ * its rounded state.
+ */
+template <typename T, typename Tv, typename Boundary>
+static Image gradient_descent(
+    const Image& input, float strength, float step_size, float tol, bool suppress_log, const Image* initial, int check_every,
+    const ProgressOptions* progress, const CheckpointOptions* checkpoint, SolverProfiler* profiler, SolveBudget* budget,
+    const TvModel& model
+) {
+    const int rows = input.getRows();
+    const int cols = input.getCols();
+    const size_t img_size = static_cast<size_t>(rows) * cols;
+
+    if (initial && (initial->getRows() != rows || initial->getCols() != cols)) {
+        throw std::invalid_argument("Initial image must have the same size as the input image.");
+    }
+    if (check_every < 1) {
+        throw std::invalid_argument("Convergence check frequency must be at least 1.");
+    }
+
+    std::vector<T> momentum(img_size, T(0));
+    std::vector<T> img(initial ? initial->data() : input.data(), (initial ? initial->data() : input.data()) + img_size);
+    const std::vector<T> orig(input.data(), input.data() + img_size);
+
+    const T tv_strength = static_cast<T>(strength);
+    const T eps = static_cast<T>(model.eps);
+    const T delta = static_cast<T>(model.huber_delta);
+
+    const T momentum_beta = T(0.9);
+    const float loss_smoothing_beta = 0.9f;
+    float loss_smoothed = 0.0f;
+
+    // The loss is only evaluated every check_every iterations, so the smoothing factor per check
+    // is adjusted to keep averaging over the same number of iterations
+    const float check_smoothing_beta = static_cast<float>(std::pow(loss_smoothing_beta, check_every));
+    int checks = 0;
+
+    const T step = static_cast<T>(step_size) / (tv_strength + 1);
+
+    ProgressSchedule schedule(progress);
+
+    std::vector<T> grad(img_size);
+    int counter = 1;
+
+    // Compulsory traffic and flops per pixel of the phases (see SolverProfiler) for the default model. Both gradient
+    // evaluations read the image (twice) and the original image, and zero, update and rescale the gradient in place
+    // (8 values), they spend 18 flops on the TV stencil and 3 on the scaling and the L2 term, the loss adds 2 for
+    // the sum of squares. The momentum update reads the momentum, the gradient and the image and writes
+    // the momentum and the image (5 values, 6 flops).
+    const double pixels = static_cast<double>(rows) * cols;
+    const double value_bytes = static_cast<double>(sizeof(T));
+
+    // The iterate, the momentum, the smoothed loss and the counters are all the remaining iterations depend on
+    std::unique_ptr<SolverCheckpoint> resumed = checkpoint
+        ? load_resume_checkpoint(*checkpoint, rows, cols, strength, step_size, check_every) : nullptr;
+    if (resumed) {
+        img.assign(resumed->img.data(), resumed->img.data() + img_size);
+        momentum.assign(resumed->momentum.data(), resumed->momentum.data() + img_size);
+        loss_smoothed = resumed->loss_smoothed;
+        checks = resumed->checks;
+        counter = resumed->counter;
+        if (!suppress_log) {
+            std::cout << "Resumed at iteration " << counter << std::endl;
+        }
+    }
+    const int first_iteration = counter;
+
+    std::unique_ptr<CheckpointWriter> writer;
+    if (checkpoint && checkpoint->interval_iterations > 0) {
+        writer.reset(new CheckpointWriter(checkpoint->path));
+    }
+
+    // Within a budget the iterate with the lowest checked loss is kept, the momentum may have pushed the last one
+    // uphill. The solve stops at the last check after which the next one would end past the deadline, judged by the
+    // longest time between two checks so far.
+    std::vector<T> best_img;
+    float best_loss = std::numeric_limits<float>::max();
+    auto last_check = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::duration check_interval(0);
+    if (budget) {
+        best_img = img;
+        budget->converged = false;
+        budget->exhausted = false;
+    }
+
+    while (true) {
+        if (schedule.cancelled()) {
+            if (!suppress_log) {
+                std::cout << "Cancelled after " << counter - 1 << " iterations" << std::endl;
+            }
+            break;
+        }
+
+        // The state is copied and written in the background while the iterations continue
+        if (writer && counter > first_iteration && (counter - 1) % checkpoint->interval_iterations == 0) {
+            writer->write(std::make_shared<SolverCheckpoint>(SolverCheckpoint{
+                counter, checks, loss_smoothed, strength, step_size, check_every, to_image(img, rows, cols), to_image(momentum, rows, cols)
+            }));
+        }
+
+        // In between the convergence checks only the gradient is needed, the iterate after the last iteration of a budget is checked
+        const bool last_iteration = budget && budget->max_iterations > 0 && counter > budget->max_iterations;
+        if ((counter - 1) % check_every != 0 && !last_iteration) {
+            SolverProfiler::Phase phase(profiler, "eval_grad", 8.0 * value_bytes * pixels, 21.0 * pixels);
+            model_loss_and_grad<T, Tv, Boundary, false>(
+                img.data(), orig.data(), grad.data(), rows, cols, tv_strength, eps, delta
+            );
+        }
+        else {
+            float loss;
+            {
+                SolverProfiler::Phase phase(profiler, "eval_loss_and_grad", 8.0 * value_bytes * pixels, 23.0 * pixels);
+                loss = model_loss_and_grad<T, Tv, Boundary, true>(
+                    img.data(), orig.data(), grad.data(), rows, cols, tv_strength, eps, delta
+                );
+            }
+            ++checks;
+
+            if (!suppress_log) {
+                std::cout << "Iteration: " << counter << ", Loss: " << loss << std::endl;
+            }
+
+            // The progress is only reported when the loss is known, the callback sees the iterate the loss belongs to
+            if (schedule.due(counter)) {
+                schedule.report(counter, loss, to_image(img, rows, cols));
+            }
+
+            // Smooth the loss using exponential moving average
+            // Smoothed loss is needed for more stable convergence
+            // Only a loss that stopped decreasing counts as converged, a loss above its average is still moving
+            loss_smoothed = loss_smoothed * check_smoothing_beta + loss * (1.0f - check_smoothing_beta);
+
+            // Debias the smoothed loss to correct the bias introduced by the zero initialization
+            float loss_smoothed_debiased = loss_smoothed / (1.0f - static_cast<float>(std::pow(check_smoothing_beta, checks)));
+            if (loss_converged(loss, loss_smoothed_debiased, tol, counter, initial != nullptr)) {
+                if (!suppress_log) {
+                    std::cout << "Converged after " << counter << " iterations with loss: " << loss_smoothed_debiased << std::endl;
+                }
+                if (budget) {
+                    budget->converged = true;
+                    budget->loss = loss;
+                }
+                break;
+            }
+
+            if (budget) {
+                if (loss < best_loss) {
+                    best_loss = loss;
+                    std::copy(img.begin(), img.end(), best_img.begin());
+                }
+                const auto now = std::chrono::steady_clock::now();
+                check_interval = std::max(check_interval, now - last_check);
+                last_check = now;
+                if (last_iteration || now >= budget->deadline || budget->deadline - now < check_interval) {
+                    if (!suppress_log) {
+                        std::cout << "Budget exhausted after " << counter - 1 << " iterations with loss: " << best_loss << std::endl;
+                    }
+                    budget->exhausted = true;
+                    break;
+                }
+            }
+        }
+
+        // Momentum keeps track of the previous gradients to stabilize and speed up convergence
+        {
+            SolverProfiler::Phase phase(profiler, "momentum_update", 5.0 * value_bytes * pixels, 6.0 * pixels);
+            const T update_scale = step / (1 - static_cast<T>(std::pow(momentum_beta, counter)));
+            for (size_t k = 0; k < img_size; ++k) {
+                momentum[k] *= momentum_beta;
+                momentum[k] += grad[k] * (1 - momentum_beta);
+                img[k] -= update_scale * momentum[k];
+            }
+        }
+
+        ++counter;
+    }
+
+    if (writer) {
+        writer->wait();
+    }
+
+    if (budget) {
+        budget->iterations = counter - 1;
+        if (!budget->converged) {
+            budget->loss = best_loss;
+            return to_image(best_img, rows, cols);
+        }
+    }
+    return to_image(img, rows, cols);
+}
+
+Image tv_denoise_gradient_descent(const Image& input, float strength, float step_size, float tol, bool suppress_log, int check_every) {
+    return gradient_descent<float, IsotropicTv, TruncatedBoundary>(
+        input, strength, step_size, tol, suppress_log, nullptr, check_every, nullptr, nullptr, nullptr, nullptr, TvModel()
+    );
+}
+
+Image tv_denoise_gradient_descent(const Image& input, float strength, float step_size, float tol, bool suppress_log, const Image& initial, int check_every) {
+    return gradient_descent<float, IsotropicTv, TruncatedBoundary>(
+        input, strength, step_size, tol, suppress_log, &initial, check_every, nullptr, nullptr, nullptr, nullptr, TvModel()
+    );
+}
+
+Image tv_denoise_gradient_descent(
+    const Image& input, float strength, float step_size, float tol, bool suppress_log, const ProgressOptions& progress, int check_every
+) {
+    return gradient_descent<float, IsotropicTv, TruncatedBoundary>(
+        input, strength, step_size, tol, suppress_log, nullptr, check_every, &progress, nullptr, nullptr, nullptr, TvModel()
+    );
+}
+
+Image tv_denoise_gradient_descent(
+    const Image& input, float strength, float step_size, float tol, bool suppress_log, const CheckpointOptions& checkpoint, int check_every
+) {
+    return gradient_descent<float, IsotropicTv, TruncatedBoundary>(
+        input, strength, step_size, tol, suppress_log, nullptr, check_every, nullptr, &checkpoint, nullptr, nullptr, TvModel()
+    );
+}
+
+Image tv_denoise_gradient_descent(
+    const Image& input, float strength, float step_size, float tol, bool suppress_log, SolverProfiler& profiler, int check_every
+) {
+    return gradient_descent<float, IsotropicTv, TruncatedBoundary>(
+        input, strength, step_size, tol, suppress_log, nullptr, check_every, nullptr, nullptr, &profiler, nullptr, TvModel()
+    );
+}
 
-    // Compute the combined weighted loss
-    return strength * tv_norm + l2_norm;
+Image tv_denoise_gradient_descent(
+    const Image& input, float strength, float step_size, float tol, bool suppress_log, const Image& initial, SolveBudget& budget, int check_every
+) {
+    return gradient_descent<float, IsotropicTv, TruncatedBoundary>(
+        input, strength, step_size, tol, suppress_log, &initial, check_every, nullptr, nullptr, nullptr, &budget, TvModel()
+    );
 }
 
-Image tv_denoise_gradient_descent(const Image& input, float strength, float step_size, float tol, bool suppress_log) {
+// Storage formats of the mixed precision solver, converting whole rows from and to float
+
+struct Float32Storage {
+    typedef float value_type;
+    static void load(const float* src, float* dst, int size) { std::copy(src, src + size, dst); }
+    static void store(const float* src, float* dst, int size) { std::copy(src, src + size, dst); }
+};
+
+struct Float16Storage {
+    typedef uint16_t value_type;
+    static void load(const uint16_t* src, float* dst, int size) { half_to_float(src, dst, size); }
+    static void store(const float* src, uint16_t* dst, int size) { float_to_half(src, dst, size); }
+};
+
+struct BFloat16Storage {
+    typedef uint16_t value_type;
+    static void load(const uint16_t* src, float* dst, int size) { bfloat16_to_float(src, dst, size); }
+    static void store(const float* src, uint16_t* dst, int size) { float_to_bfloat16(src, dst, size); }
+};
+
+template <typename Storage, typename ImageStorage>
+static Image mixed_precision_gradient_descent(const Image& input, float strength, float step_size, float tol, bool suppress_log) {
+    typedef typename Storage::value_type value_type;
+    typedef typename ImageStorage::value_type image_value_type;
+
     const int rows = input.getRows();
     const int cols = input.getCols();
+    const size_t img_size = static_cast<size_t>(rows) * cols;
+    const float eps = 1e-8f;
 
-    Image momentum(rows, cols);
-    Image img = input;
-    const Image orig_img = input;
+    std::vector<value_type> orig(img_size);
+    std::vector<value_type> momentum(img_size);
+    Storage::store(input.data(), orig.data(), static_cast<int>(img_size));
+    Storage::store(std::vector<float>(img_size, 0.0f).data(), momentum.data(), static_cast<int>(img_size));
+
+    // The iterate is double buffered, so the image the loss was evaluated on is still available on convergence
+    std::vector<image_value_type> img(img_size);
+    std::vector<image_value_type> next_img(img_size);
+    ImageStorage::store(input.data(), img.data(), static_cast<int>(img_size));
+
+    // Every row is converted to float once per iteration, the TV stencil only needs the current and the next row
+    std::vector<float> row(cols), next_row(cols), orig_row(cols), momentum_row(cols), grad_row(cols), next_grad_row(cols);
 
     const float momentum_beta = 0.9f;
     const float loss_smoothing_beta = 0.9f;
@@ -82,37 +493,1338 @@ Image tv_denoise_gradient_descent(const Image& input, float strength, float step
 
     int counter = 1;
     while (true) {
-        Image grad(rows, cols);
-        float loss = eval_loss_and_grad(img, orig_img, strength, grad);
-        
+        const float update_scale = step / (1.0f - static_cast<float>(std::pow(momentum_beta, counter)));
+        ReproducibleSum tv_norm;
+        ReproducibleSum l2_norm;
+
+        ImageStorage::load(img.data(), row.data(), cols);
+        std::fill(grad_row.begin(), grad_row.end(), 0.0f);
+
+        for (int i = 0; i < rows; ++i) {
+            const size_t offset = static_cast<size_t>(i) * cols;
+            const bool has_next = i < rows - 1;
+            if (has_next) {
+                ImageStorage::load(img.data() + offset + cols, next_row.data(), cols);
+                std::fill(next_grad_row.begin(), next_grad_row.end(), 0.0f);
+            }
+
+            Storage::load(orig.data() + offset, orig_row.data(), cols);
+            for (int j = 0; j < cols; ++j) {
+                const float diff = row[j] - orig_row[j];
+                grad_row[j] += diff;
+                l2_norm += diff * diff;
+            }
+
+            // The contributions to the next row are completed when that row is processed
+            if (has_next) {
+                for (int j = 0; j < cols - 1; ++j) {
+                    const float x_diff = row[j] - row[j + 1];
+                    const float y_diff = row[j] - next_row[j];
+                    const float grad_mag = std::sqrt(x_diff * x_diff + y_diff * y_diff + eps);
+                    tv_norm += grad_mag;
+
+                    const float dx = strength * x_diff / grad_mag;
+                    const float dy = strength * y_diff / grad_mag;
+
+                    grad_row[j] += dx + dy;
+                    grad_row[j + 1] -= dx;
+                    next_grad_row[j] -= dy;
+                }
+            }
+
+            // The gradient of this row is final, the row is no longer read by the stencil
+            Storage::load(momentum.data() + offset, momentum_row.data(), cols);
+            for (int j = 0; j < cols; ++j) {
+                momentum_row[j] = momentum_row[j] * momentum_beta + grad_row[j] * (1.0f - momentum_beta);
+                row[j] -= update_scale * momentum_row[j];
+            }
+            Storage::store(momentum_row.data(), momentum.data() + offset, cols);
+            ImageStorage::store(row.data(), next_img.data() + offset, cols);
+
+            row.swap(next_row);
+            grad_row.swap(next_grad_row);
+        }
+
+        const float loss = combine_loss(strength, tv_norm, l2_norm);
+
         if (!suppress_log) {
             std::cout << "Iteration: " << counter << ", Loss: " << loss << std::endl;
         }
 
-        // Smooth the loss using exponential moving average
-        // Smoothed loss is needed for more stable convergence
         loss_smoothed = loss_smoothed * loss_smoothing_beta + loss * (1.0f - loss_smoothing_beta);
-
-        // Debias the smoothed loss to correct the bias introduced by the zero initialization
         float loss_smoothed_debiased = loss_smoothed / (1.0f - static_cast<float>(std::pow(loss_smoothing_beta, counter)));
-        if (counter > 1 && loss_smoothed_debiased / loss < 1.0f + tol) {
+        if (loss_converged(loss, loss_smoothed_debiased, tol, counter, false)) {
             if (!suppress_log) {
                 std::cout << "Converged after " << counter << " iterations with loss: " << loss_smoothed_debiased << std::endl;
             }
             break;
         }
 
-        // Momentum keeps track of the previous gradients to stabilize and speed up convergence
-        for (int i = 0; i < rows; ++i) {
-            for (int j = 0; j < cols; ++j) {
-                momentum(i, j) *= momentum_beta;
-                momentum(i, j) += grad(i, j) * (1.0f - momentum_beta);
-                img(i, j) -= step / (1.0f - static_cast<float>(std::pow(momentum_beta, counter))) * momentum(i, j);
+        img.swap(next_img);
+        ++counter;
+    }
+
+    Image result(rows, cols);
+    ImageStorage::load(img.data(), result.data(), static_cast<int>(img_size));
+    return result;
+}
+
+Image tv_denoise_gradient_descent_mixed(
+    const Image& input, float strength, float step_size, float tol, bool suppress_log, StoragePrecision precision, bool compact_image
+) {
+    switch (precision) {
+    case StoragePrecision::Float16:
+        return compact_image
+            ? mixed_precision_gradient_descent<Float16Storage, Float16Storage>(input, strength, step_size, tol, suppress_log)
+            : mixed_precision_gradient_descent<Float16Storage, Float32Storage>(input, strength, step_size, tol, suppress_log);
+    case StoragePrecision::BFloat16:
+        return compact_image
+            ? mixed_precision_gradient_descent<BFloat16Storage, BFloat16Storage>(input, strength, step_size, tol, suppress_log)
+            : mixed_precision_gradient_descent<BFloat16Storage, Float32Storage>(input, strength, step_size, tol, suppress_log);
+    default:
+        return mixed_precision_gradient_descent<Float32Storage, Float32Storage>(input, strength, step_size, tol, suppress_log);
+    }
+}
+
+template <typename T, typename Tv>
+static Image model_gradient_descent(
+    const Image& input, float strength, float step_size, float tol, bool suppress_log, const TvModel& model, int check_every
+) {
+    switch (model.boundary) {
+    case BoundaryCondition::Neumann:
+        return gradient_descent<T, Tv, NeumannBoundary>(
+            input, strength, step_size, tol, suppress_log, nullptr, check_every, nullptr, nullptr, nullptr, nullptr, model
+        );
+    case BoundaryCondition::Periodic:
+        return gradient_descent<T, Tv, PeriodicBoundary>(
+            input, strength, step_size, tol, suppress_log, nullptr, check_every, nullptr, nullptr, nullptr, nullptr, model
+        );
+    default:
+        return gradient_descent<T, Tv, TruncatedBoundary>(
+            input, strength, step_size, tol, suppress_log, nullptr, check_every, nullptr, nullptr, nullptr, nullptr, model
+        );
+    }
+}
+
+template <typename T>
+static Image model_gradient_descent(
+    const Image& input, float strength, float step_size, float tol, bool suppress_log, const TvModel& model, int check_every
+) {
+    switch (model.variant) {
+    case TvVariant::Anisotropic:
+        return model_gradient_descent<T, AnisotropicTv>(input, strength, step_size, tol, suppress_log, model, check_every);
+    case TvVariant::Huber:
+        return model_gradient_descent<T, HuberTv>(input, strength, step_size, tol, suppress_log, model, check_every);
+    default:
+        return model_gradient_descent<T, IsotropicTv>(input, strength, step_size, tol, suppress_log, model, check_every);
+    }
+}
+
+Image tv_denoise_gradient_descent_model(
+    const Image& input, float strength, float step_size, float tol, bool suppress_log, const TvModel& model, int check_every
+) {
+    if (model.variant == TvVariant::Huber && !(model.huber_delta > 0.0f)) {
+        throw std::invalid_argument("The Huber threshold must be positive.");
+    }
+    // The model is dispatched once, every iteration runs the loops of its instantiation
+    return model.scalar == ScalarType::Double
+        ? model_gradient_descent<double>(input, strength, step_size, tol, suppress_log, model, check_every)
+        : model_gradient_descent<float>(input, strength, step_size, tol, suppress_log, model, check_every);
+}
+
+/**
+ * @brief Returns the size of the (per core) L2 cache in bytes, or 256 KiB if it cannot be queried.
+ */
+static size_t l2_cache_size() {
+    size_t size = 0;
+#ifdef _WIN32
+    DWORD length = 0;
+    GetLogicalProcessorInformation(nullptr, &length);
+    std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> infos(length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+    if (!infos.empty() && GetLogicalProcessorInformation(infos.data(), &length)) {
+        for (const SYSTEM_LOGICAL_PROCESSOR_INFORMATION& info : infos) {
+            if (info.Relationship == RelationCache && info.Cache.Level == 2) {
+                size = info.Cache.Size;
+                break;
             }
         }
+    }
+#elif defined(_SC_LEVEL2_CACHE_SIZE)
+    const long queried = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (queried > 0) {
+        size = static_cast<size_t>(queried);
+    }
+#endif
+    return size > 0 ? size : 256 * 1024;
+}
 
-        ++counter;
+/**
+ * @brief Loss contributions of a tile at the beginning of a sweep.
+ */
+struct TileLoss {
+    ReproducibleSum tv_norm;
+    ReproducibleSum l2_norm;
+};
+
+/**
+ * @brief Worker threads of tv_denoise_gradient_descent_tiled, kept for the whole solve and synchronized with a barrier.
+ *
+ * With a placement every worker is a new thread pinned once to its processor, so the calling thread keeps its
+ * affinity. Otherwise the calling thread is thread 0 and only the others are new.
+ */
+class SweepWorkers {
+public:
+    SweepWorkers(int num_threads, const ThreadPlacement* placement)
+        : placement(placement), participants(placement ? num_threads + 1 : num_threads) {
+        for (int thread = placement ? 0 : 1; thread < num_threads; ++thread) {
+            threads.emplace_back(&SweepWorkers::work, this, thread);
+        }
+    }
+
+    ~SweepWorkers() {
+        stop = true;
+        arrive_and_wait();
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    }
+
+    /** @brief Runs task(thread) on every thread and returns when all of them are done. */
+    void run(const std::function<void(int)>& task) {
+        current = &task;
+        arrive_and_wait();
+        if (!placement) {
+            task(0);
+        }
+        arrive_and_wait();
+    }
+
+private:
+    void work(int thread) {
+        if (placement) {
+            placement->pin(thread);
+        }
+        while (true) {
+            arrive_and_wait();
+            if (stop) {
+                return;
+            }
+            (*current)(thread);
+            arrive_and_wait();
+        }
+    }
+
+    // Barrier of the workers and the calling thread, the mutex also publishes current and stop to the workers
+    void arrive_and_wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        const unsigned long long arrival = generation;
+        if (++arrived == participants) {
+            arrived = 0;
+            ++generation;
+            released.notify_all();
+        }
+        else {
+            released.wait(lock, [&]() { return generation != arrival; });
+        }
+    }
+
+    const ThreadPlacement* placement;
+    const int participants;
+    std::vector<std::thread> threads;
+    const std::function<void(int)>* current = nullptr;
+    bool stop = false;
+    std::mutex mutex;
+    std::condition_variable released;
+    int arrived = 0;
+    unsigned long long generation = 0;
+};
+
+/**
+ * @brief Advances one tile of tv_denoise_gradient_descent_tiled by iterations_per_sweep iterations.
+ *
+ * Reads img and momentum (the state at the beginning of the sweep) in the tile extended by the halo,
+ * and writes the tile of next_img and next_momentum. The local buffers have to hold the extended tile.
+ */
+static TileLoss advance_tile(
+    const Image& img, const Image& momentum, const Image& orig_img, Image& next_img, Image& next_momentum,
+    int tile_row, int tile_col, int tile_size, int iterations_per_sweep, int counter,
+    float strength, float step, float momentum_beta, float eps,
+    std::vector<float>& local_img, std::vector<float>& local_momentum, std::vector<float>& local_grad
+) {
+    const int rows = img.getRows();
+    const int cols = img.getCols();
+    const int halo = iterations_per_sweep;
+    TileLoss loss;
+
+    const int tile_row_end = std::min(tile_row + tile_size, rows);
+    const int tile_col_end = std::min(tile_col + tile_size, cols);
+
+    // Extended region, clipped at the image border where no halo is needed
+    const int row0 = std::max(tile_row - halo, 0);
+    const int col0 = std::max(tile_col - halo, 0);
+    const int row1 = std::min(tile_row_end + halo, rows);
+    const int col1 = std::min(tile_col_end + halo, cols);
+    const int extent = col1 - col0;
+
+    for (int i = row0; i < row1; ++i) {
+        std::copy(&img(i, col0), &img(i, col0) + extent, &local_img[(i - row0) * extent]);
+        std::copy(&momentum(i, col0), &momentum(i, col0) + extent, &local_momentum[(i - row0) * extent]);
+    }
+
+    // Trapezoidal schedule: after step t only the tile extended by halo - t is still exact
+    for (int t = 1; t <= iterations_per_sweep; ++t) {
+        const int shrink = halo - t;
+        const int r0 = std::max(tile_row - shrink, 0);
+        const int c0 = std::max(tile_col - shrink, 0);
+        const int r1 = std::min(tile_row_end + shrink, rows);
+        const int c1 = std::min(tile_col_end + shrink, cols);
+
+        // The TV gradient is accumulated unscaled and combined with the L2 term in the update, in the order of
+        // model_loss_and_grad, so the iterates are bit-identical to the ones of tv_denoise_gradient_descent
+        for (int i = r0; i < r1; ++i) {
+            std::fill(&local_grad[(i - row0) * extent + (c0 - col0)], &local_grad[(i - row0) * extent + (c1 - col0)], 0.0f);
+        }
+        // Stencils of the row above and the column left of the region contribute to its gradient too.
+        // Their writes outside of the region only touch pixels that are not updated in this step.
+        for (int i = std::max(r0 - 1, 0); i < std::min(r1, rows - 1); ++i) {
+            for (int j = std::max(c0 - 1, 0); j < std::min(c1, cols - 1); ++j) {
+                const int k = (i - row0) * extent + (j - col0);
+                const float x_diff = local_img[k] - local_img[k + 1];
+                const float y_diff = local_img[k] - local_img[k + extent];
+                const float grad_mag = std::sqrt(x_diff * x_diff + y_diff * y_diff + eps);
+                if (t == 1 && i >= tile_row && i < tile_row_end && j >= tile_col && j < tile_col_end) {
+                    loss.tv_norm += grad_mag;
+                }
+
+                const float dx = x_diff / grad_mag;
+                const float dy = y_diff / grad_mag;
+
+                local_grad[k] += dx + dy;
+                local_grad[k + 1] -= dx;
+                local_grad[k + extent] -= dy;
+            }
+        }
+
+        const float update_scale = step / (1.0f - static_cast<float>(std::pow(momentum_beta, counter + t - 1)));
+        for (int i = r0; i < r1; ++i) {
+            for (int j = c0; j < c1; ++j) {
+                const int k = (i - row0) * extent + (j - col0);
+                const float diff = local_img[k] - orig_img(i, j);
+                if (t == 1 && i >= tile_row && i < tile_row_end && j >= tile_col && j < tile_col_end) {
+                    loss.l2_norm += diff * diff;
+                }
+                float grad = strength * local_grad[k];
+                grad += diff;
+                local_momentum[k] = local_momentum[k] * momentum_beta + grad * (1.0f - momentum_beta);
+                local_img[k] -= update_scale * local_momentum[k];
+            }
+        }
+    }
+
+    for (int i = tile_row; i < tile_row_end; ++i) {
+        const int k = (i - row0) * extent + (tile_col - col0);
+        std::copy(&local_img[k], &local_img[k] + (tile_col_end - tile_col), &next_img(i, tile_col));
+        std::copy(&local_momentum[k], &local_momentum[k] + (tile_col_end - tile_col), &next_momentum(i, tile_col));
+    }
+
+    return loss;
+}
+
+Image tv_denoise_gradient_descent_tiled(
+    const Image& input, float strength, float step_size, float tol, bool suppress_log,
+    int iterations_per_sweep, int tile_size, int num_threads, bool numa_aware
+) {
+    const int rows = input.getRows();
+    const int cols = input.getCols();
+    const float eps = 1e-8f;
+
+    if (iterations_per_sweep < 0 || tile_size < 0 || num_threads < 0) {
+        throw std::invalid_argument("Iterations per sweep, tile size and number of threads must not be negative.");
+    }
+
+    // A tile with its halo holds the image, the momentum and the gradient (12 bytes per pixel) and streams
+    // the original image, it should fit in half of the L2 cache. The halo is recomputed by neighbouring tiles,
+    // so K is kept small compared to the tile: about 1/16 of the side of the tile.
+    if (iterations_per_sweep == 0 || tile_size == 0) {
+        const int side = static_cast<int>(std::sqrt(static_cast<double>(l2_cache_size()) / 2.0 / 16.0));
+        if (iterations_per_sweep == 0) {
+            iterations_per_sweep = std::min(std::max(side / 16, 2), 16);
+        }
+        if (tile_size == 0) {
+            tile_size = std::max(side - 2 * iterations_per_sweep, 16);
+        }
+    }
+    const int tile_rows = (rows + tile_size - 1) / tile_size;
+    const int tile_cols = (cols + tile_size - 1) / tile_size;
+    const int num_tiles = tile_rows * tile_cols;
+
+    // With a placement the threads are pinned and every thread processes a fixed band of consecutive tiles,
+    // otherwise the threads take the next tile that is left
+    std::unique_ptr<ThreadPlacement> placement;
+    if (numa_aware) {
+        NumaTopology topology = detect_numa_topology();
+        const int requested = num_threads > 0 ? num_threads : topology.processors();
+        placement.reset(new ThreadPlacement(std::max(std::min(requested, num_tiles), 1), std::move(topology)));
+        num_threads = placement->threads();
+    }
+    else {
+        if (num_threads == 0) {
+            num_threads = static_cast<int>(std::max(std::thread::hardware_concurrency(), 1u));
+        }
+        num_threads = std::max(std::min(num_threads, num_tiles), 1);
+    }
+
+    auto band_begin = [&](int thread) {
+        return static_cast<int>(static_cast<long long>(num_tiles) * thread / num_threads);
+    };
+
+    // The threads are started (and pinned) once, every sweep is a task run on all of them
+    SweepWorkers workers(num_threads, placement.get());
+
+    // The sweeps read the previous iterate and momentum and write the next ones, so the halos of the
+    // neighbouring tiles still see the values from the beginning of the sweep and the tiles are independent
+    const ImageAllocation allocation = placement ? ImageAllocation::FirstTouch : ImageAllocation::ZeroFilled;
+    Image img(rows, cols, allocation);
+    Image next_img(rows, cols, allocation);
+    Image momentum(rows, cols, allocation);
+    Image next_momentum(rows, cols, allocation);
+    Image orig_copy(placement ? rows : 0, placement ? cols : 0, allocation);
+    const Image& orig_img = placement ? orig_copy : input;
+
+    const size_t max_rows = static_cast<size_t>(std::min(tile_size + 2 * iterations_per_sweep, rows));
+    const size_t max_cols = static_cast<size_t>(std::min(tile_size + 2 * iterations_per_sweep, cols));
+    std::vector<std::vector<float>> local_imgs(num_threads);
+    std::vector<std::vector<float>> local_momentums(num_threads);
+    std::vector<std::vector<float>> local_grads(num_threads);
+
+    if (placement) {
+        // Parallel first-touch: every thread writes the pixels of its own tiles and allocates its local buffers,
+        // so they are placed on the node of the thread that processes them in every sweep
+        workers.run([&](int thread) {
+            local_imgs[thread].assign(max_rows * max_cols, 0.0f);
+            local_momentums[thread].assign(max_rows * max_cols, 0.0f);
+            local_grads[thread].assign(max_rows * max_cols, 0.0f);
+            for (int tile = band_begin(thread); tile < band_begin(thread + 1); ++tile) {
+                const int tile_row = (tile / tile_cols) * tile_size;
+                const int tile_col = (tile % tile_cols) * tile_size;
+                const int width = std::min(tile_size, cols - tile_col);
+                for (int i = tile_row; i < std::min(tile_row + tile_size, rows); ++i) {
+                    std::copy(&input(i, tile_col), &input(i, tile_col) + width, &img(i, tile_col));
+                    std::copy(&input(i, tile_col), &input(i, tile_col) + width, &orig_copy(i, tile_col));
+                    std::fill(&next_img(i, tile_col), &next_img(i, tile_col) + width, 0.0f);
+                    std::fill(&momentum(i, tile_col), &momentum(i, tile_col) + width, 0.0f);
+                    std::fill(&next_momentum(i, tile_col), &next_momentum(i, tile_col) + width, 0.0f);
+                }
+            }
+        });
+        if (!suppress_log) {
+            std::cout << placement->report();
+            for (int thread = 0; thread < num_threads; ++thread) {
+                std::cout << "  thread " << thread << ": node " << placement->node(thread) << ", processor " << placement->processor(thread)
+                    << ", tiles " << band_begin(thread) << "-" << band_begin(thread + 1) - 1 << " of " << num_tiles << std::endl;
+            }
+        }
+    }
+    else {
+        std::copy(input.data(), input.data() + rows * cols, img.data());
+        for (int thread = 0; thread < num_threads; ++thread) {
+            local_imgs[thread].assign(max_rows * max_cols, 0.0f);
+            local_momentums[thread].assign(max_rows * max_cols, 0.0f);
+            local_grads[thread].assign(max_rows * max_cols, 0.0f);
+        }
+    }
+
+    // The losses of the tiles are reproducible sums, so the result depends neither on the number of threads nor on the tile size
+    std::vector<TileLoss> tile_losses(num_tiles);
+
+    const float momentum_beta = 0.9f;
+    const float loss_smoothing_beta = 0.9f;
+    const float sweep_smoothing_beta = static_cast<float>(std::pow(loss_smoothing_beta, iterations_per_sweep));
+    float loss_smoothed = 0.0f;
+
+    const float step = step_size / (strength + 1);
+
+    int counter = 1;
+    int sweeps = 0;
+    while (true) {
+        std::atomic<int> next_tile(0);
+        auto advance = [&](int thread, int tile) {
+            tile_losses[tile] = advance_tile(
+                img, momentum, orig_img, next_img, next_momentum,
+                (tile / tile_cols) * tile_size, (tile % tile_cols) * tile_size, tile_size, iterations_per_sweep, counter,
+                strength, step, momentum_beta, eps,
+                local_imgs[thread], local_momentums[thread], local_grads[thread]
+            );
+        };
+        workers.run([&](int thread) {
+            if (placement) {
+                for (int tile = band_begin(thread); tile < band_begin(thread + 1); ++tile) {
+                    advance(thread, tile);
+                }
+            }
+            else {
+                for (int tile = next_tile++; tile < num_tiles; tile = next_tile++) {
+                    advance(thread, tile);
+                }
+            }
+        });
+
+        ReproducibleSum tv_norm;
+        ReproducibleSum l2_norm;
+        for (const TileLoss& tile_loss : tile_losses) {
+            tv_norm += tile_loss.tv_norm;
+            l2_norm += tile_loss.l2_norm;
+        }
+
+        // The loss is the one of the iterate at the beginning of the sweep, so on convergence that iterate is kept
+        const float loss = combine_loss(strength, tv_norm, l2_norm);
+        ++sweeps;
+
+        if (!suppress_log) {
+            std::cout << "Iteration: " << counter << ", Loss: " << loss << std::endl;
+        }
+
+        loss_smoothed = loss_smoothed * sweep_smoothing_beta + loss * (1.0f - sweep_smoothing_beta);
+        float loss_smoothed_debiased = loss_smoothed / (1.0f - static_cast<float>(std::pow(sweep_smoothing_beta, sweeps)));
+        if (loss_converged(loss, loss_smoothed_debiased, tol, counter, false)) {
+            if (!suppress_log) {
+                std::cout << "Converged after " << counter << " iterations with loss: " << loss_smoothed_debiased << std::endl;
+            }
+            break;
+        }
+
+        img.swap(next_img);
+        momentum.swap(next_momentum);
+        counter += iterations_per_sweep;
     }
 
     return img;
 }
+
+Image tv_denoise_gradient_descent_active_set(
+    const Image& input, float strength, float step_size, float tol, bool suppress_log, int tile_size, float freeze_threshold
+) {
+    const int rows = input.getRows();
+    const int cols = input.getCols();
+    const float eps = 1e-8f;
+
+    if (tile_size < 1) {
+        throw std::invalid_argument("Tile size must be at least 1.");
+    }
+
+    const int tile_rows = (rows + tile_size - 1) / tile_size;
+    const int tile_cols = (cols + tile_size - 1) / tile_size;
+    const int num_tiles = tile_rows * tile_cols;
+
+    Image img = input;
+    const Image& orig_img = input;
+    Image momentum(rows, cols);
+    Image grad(rows, cols);
+
+    // Per tile: whether it is updated and its loss contribution when it was last active
+    std::vector<char> active(num_tiles, 1);
+    std::vector<char> next_active(num_tiles);
+    std::vector<TileLoss> tile_loss(num_tiles);
+    std::vector<int> active_tiles;
+
+    // Stencil values of a tile and of the row above and the column left of it
+    std::vector<float> dx((tile_size + 1) * (tile_size + 1));
+    std::vector<float> dy((tile_size + 1) * (tile_size + 1));
+
+    const float momentum_beta = 0.9f;
+    const float loss_smoothing_beta = 0.9f;
+    float loss_smoothed = 0.0f;
+
+    // The tiles are tracked over windows of active_set_interval iterations, against the pixels at the end of the previous window
+    Image snapshot = input;
+
+    const float step = step_size / (strength + 1);
+
+    long long updated_pixels = 0;
+    int counter = 1;
+    while (true) {
+        active_tiles.clear();
+        for (int tile = 0; tile < num_tiles; ++tile) {
+            if (active[tile]) {
+                active_tiles.push_back(tile);
+            }
+        }
+
+        // Gradient (and loss) of the active tiles, every gradient has to be computed before any pixel changes
+        for (int tile : active_tiles) {
+            const int r0 = (tile / tile_cols) * tile_size;
+            const int c0 = (tile % tile_cols) * tile_size;
+            const int r1 = std::min(r0 + tile_size, rows);
+            const int c1 = std::min(c0 + tile_size, cols);
+            const int stride = tile_size + 1;
+            ReproducibleSum tv_norm;
+            ReproducibleSum l2_norm;
+
+            // Local index (i - r0 + 1, j - c0 + 1), the stencils outside the image are zero
+            for (int i = r0 - 1; i < r1; ++i) {
+                for (int j = c0 - 1; j < c1; ++j) {
+                    const int k = (i - r0 + 1) * stride + (j - c0 + 1);
+                    if (i < 0 || j < 0 || i >= rows - 1 || j >= cols - 1) {
+                        dx[k] = 0.0f;
+                        dy[k] = 0.0f;
+                        continue;
+                    }
+                    const float x_diff = img(i, j) - img(i, j + 1);
+                    const float y_diff = img(i, j) - img(i + 1, j);
+                    const float grad_mag = std::sqrt(x_diff * x_diff + y_diff * y_diff + eps);
+                    if (i >= r0 && j >= c0) {
+                        tv_norm += grad_mag;
+                    }
+                    dx[k] = x_diff / grad_mag;
+                    dy[k] = y_diff / grad_mag;
+                }
+            }
+
+            for (int i = r0; i < r1; ++i) {
+                for (int j = c0; j < c1; ++j) {
+                    const int k = (i - r0 + 1) * stride + (j - c0 + 1);
+                    const float diff = img(i, j) - orig_img(i, j);
+                    l2_norm += diff * diff;
+                    grad(i, j) = diff + strength * (dx[k] + dy[k] - dx[k - 1] - dy[k - stride]);
+                }
+            }
+
+            tile_loss[tile] = TileLoss{ tv_norm, l2_norm };
+        }
+
+        // Frozen tiles contribute the loss they had when they were last updated
+        ReproducibleSum tv_norm;
+        ReproducibleSum l2_norm;
+        for (const TileLoss& loss_of_tile : tile_loss) {
+            tv_norm += loss_of_tile.tv_norm;
+            l2_norm += loss_of_tile.l2_norm;
+        }
+        const float loss = combine_loss(strength, tv_norm, l2_norm);
+
+        if (!suppress_log) {
+            std::cout << "Iteration: " << counter << ", Loss: " << loss << ", Active tiles: " << active_tiles.size() << std::endl;
+        }
+
+        loss_smoothed = loss_smoothed * loss_smoothing_beta + loss * (1.0f - loss_smoothing_beta);
+        float loss_smoothed_debiased = loss_smoothed / (1.0f - static_cast<float>(std::pow(loss_smoothing_beta, counter)));
+        if (active_tiles.empty() || loss_converged(loss, loss_smoothed_debiased, tol, counter, false)) {
+            if (!suppress_log) {
+                std::cout << "Converged after " << counter << " iterations with loss: " << loss_smoothed_debiased
+                    << " (" << updated_pixels / static_cast<double>(rows) / cols << " full iterations of work)" << std::endl;
+            }
+            break;
+        }
+
+        const float update_scale = step / (1.0f - static_cast<float>(std::pow(momentum_beta, counter)));
+        for (int tile : active_tiles) {
+            const int r0 = (tile / tile_cols) * tile_size;
+            const int c0 = (tile % tile_cols) * tile_size;
+            const int r1 = std::min(r0 + tile_size, rows);
+            const int c1 = std::min(c0 + tile_size, cols);
+            for (int i = r0; i < r1; ++i) {
+                for (int j = c0; j < c1; ++j) {
+                    momentum(i, j) = momentum(i, j) * momentum_beta + grad(i, j) * (1.0f - momentum_beta);
+                    img(i, j) -= update_scale * momentum(i, j);
+                }
+            }
+            updated_pixels += static_cast<long long>(r1 - r0) * (c1 - c0);
+        }
+
+        // The nearly non-smooth TV term keeps flat regions oscillating with a small amplitude, so the tracker
+        // measures how far the pixels of a tile drifted over a window of iterations instead of single updates
+        if (counter % active_set_interval == 0) {
+            std::fill(next_active.begin(), next_active.end(), 0);
+            for (int tile : active_tiles) {
+                const int tile_row = tile / tile_cols;
+                const int tile_col = tile % tile_cols;
+                const int r0 = tile_row * tile_size;
+                const int c0 = tile_col * tile_size;
+                const int r1 = std::min(r0 + tile_size, rows);
+                const int c1 = std::min(c0 + tile_size, cols);
+
+                float drift = 0.0f;
+                float top = 0.0f, bottom = 0.0f, left = 0.0f, right = 0.0f;
+                const float top_right = std::abs(img(r0, c1 - 1) - snapshot(r0, c1 - 1));
+                const float bottom_left = std::abs(img(r1 - 1, c0) - snapshot(r1 - 1, c0));
+                for (int i = r0; i < r1; ++i) {
+                    for (int j = c0; j < c1; ++j) {
+                        const float change = std::abs(img(i, j) - snapshot(i, j));
+                        snapshot(i, j) = img(i, j);
+
+                        drift = std::max(drift, change);
+                        if (i == r0) top = std::max(top, change);
+                        if (i == r1 - 1) bottom = std::max(bottom, change);
+                        if (j == c0) left = std::max(left, change);
+                        if (j == c1 - 1) right = std::max(right, change);
+                    }
+                }
+                if (drift >= freeze_threshold) {
+                    next_active[tile] = 1;
+                }
+
+                // A gradient depends on the four neighbours and the upper right and lower left diagonal pixels,
+                // so a moving boundary reactivates the neighbouring tile on that side
+                if (top >= freeze_threshold && tile_row > 0) next_active[tile - tile_cols] = 1;
+                if (bottom >= freeze_threshold && tile_row < tile_rows - 1) next_active[tile + tile_cols] = 1;
+                if (left >= freeze_threshold && tile_col > 0) next_active[tile - 1] = 1;
+                if (right >= freeze_threshold && tile_col < tile_cols - 1) next_active[tile + 1] = 1;
+                if (top_right >= freeze_threshold && tile_row > 0 && tile_col < tile_cols - 1) next_active[tile - tile_cols + 1] = 1;
+                if (bottom_left >= freeze_threshold && tile_row < tile_rows - 1 && tile_col > 0) next_active[tile + tile_cols - 1] = 1;
+            }
+
+            // A reactivated tile starts without momentum, the momentum it was frozen with belongs to an outdated neighbourhood
+            for (int tile = 0; tile < num_tiles; ++tile) {
+                if (next_active[tile] && !active[tile]) {
+                    const int r0 = (tile / tile_cols) * tile_size;
+                    const int c0 = (tile % tile_cols) * tile_size;
+                    const int r1 = std::min(r0 + tile_size, rows);
+                    const int c1 = std::min(c0 + tile_size, cols);
+                    for (int i = r0; i < r1; ++i)
+                        for (int j = c0; j < c1; ++j)
+                            momentum(i, j) = 0.0f;
+                }
+            }
+            active.swap(next_active);
+        }
+
+        ++counter;
+    }
+
+    return img;
+}
+
+Image tv_denoise_gradient_descent_masked(
+    const Image& input, const Image& mask, float strength, float step_size, float tol, bool suppress_log, int tile_size
+) {
+    const int rows = input.getRows();
+    const int cols = input.getCols();
+    const float eps = 1e-8f;
+
+    if (mask.getRows() != rows || mask.getCols() != cols) {
+        throw std::invalid_argument("Mask must have the same size as the input image.");
+    }
+    if (tile_size < 1) {
+        throw std::invalid_argument("Tile size must be at least 1.");
+    }
+
+    const int tile_rows = (rows + tile_size - 1) / tile_size;
+    const int tile_cols = (cols + tile_size - 1) / tile_size;
+    const int num_tiles = tile_rows * tile_cols;
+    const size_t tile_pixels = static_cast<size_t>(tile_size) * tile_size;
+
+    // The domain is the list of tiles containing a masked pixel, tile_slot maps a tile to its position in the list
+    std::vector<int> domain;
+    std::vector<int> tile_slot(num_tiles, -1);
+    for (int tile = 0; tile < num_tiles; ++tile) {
+        const int r0 = (tile / tile_cols) * tile_size;
+        const int c0 = (tile % tile_cols) * tile_size;
+        bool masked = false;
+        for (int i = r0; i < std::min(r0 + tile_size, rows) && !masked; ++i) {
+            for (int j = c0; j < std::min(c0 + tile_size, cols) && !masked; ++j) {
+                masked = mask(i, j) > 0.0f;
+            }
+        }
+        if (masked) {
+            tile_slot[tile] = static_cast<int>(domain.size());
+            domain.push_back(tile);
+        }
+    }
+    if (domain.empty()) {
+        return input;
+    }
+    auto in_domain = [&](int i, int j) { return tile_slot[(i / tile_size) * tile_cols + j / tile_size] >= 0; };
+
+    // The pixels outside the mask keep their input values, so the iterate is a copy of the whole frame
+    // (its halo is read by the stencils), while the momentum and the gradient only exist for the domain
+    Image img = input;
+    const Image& orig_img = input;
+    std::vector<float> momentum(domain.size() * tile_pixels, 0.0f);
+    std::vector<float> grad(domain.size() * tile_pixels, 0.0f);
+
+    // Stencil values of a tile and of the row above and the column left of it
+    std::vector<float> dx((tile_size + 1) * (tile_size + 1));
+    std::vector<float> dy((tile_size + 1) * (tile_size + 1));
+
+    const float momentum_beta = 0.9f;
+    const float loss_smoothing_beta = 0.9f;
+    float loss_smoothed = 0.0f;
+
+    const float step = step_size / (strength + 1);
+
+    int counter = 1;
+    while (true) {
+        ReproducibleSum tv_norm;
+        ReproducibleSum l2_norm;
+        for (size_t slot = 0; slot < domain.size(); ++slot) {
+            const int r0 = (domain[slot] / tile_cols) * tile_size;
+            const int c0 = (domain[slot] % tile_cols) * tile_size;
+            const int r1 = std::min(r0 + tile_size, rows);
+            const int c1 = std::min(c0 + tile_size, cols);
+            const int stride = tile_size + 1;
+
+            // Local index (i - r0 + 1, j - c0 + 1), the stencils outside the image are zero
+            for (int i = r0 - 1; i < r1; ++i) {
+                for (int j = c0 - 1; j < c1; ++j) {
+                    const int k = (i - r0 + 1) * stride + (j - c0 + 1);
+                    if (i < 0 || j < 0 || i >= rows - 1 || j >= cols - 1) {
+                        dx[k] = 0.0f;
+                        dy[k] = 0.0f;
+                        continue;
+                    }
+                    const float x_diff = img(i, j) - img(i, j + 1);
+                    const float y_diff = img(i, j) - img(i + 1, j);
+                    const float grad_mag = std::sqrt(x_diff * x_diff + y_diff * y_diff + eps);
+                    // Every stencil is counted once: those of the tile, and a halo stencil outside the domain by the
+                    // tile below it, or else by the tile right of it
+                    if ((i >= r0 && j >= c0) || (j >= c0 && !in_domain(i, j)) || (i >= r0 && !in_domain(i, j) && !in_domain(i + 1, j))) {
+                        tv_norm += grad_mag;
+                    }
+                    dx[k] = x_diff / grad_mag;
+                    dy[k] = y_diff / grad_mag;
+                }
+            }
+
+            float* tile_grad = &grad[slot * tile_pixels];
+            for (int i = r0; i < r1; ++i) {
+                for (int j = c0; j < c1; ++j) {
+                    if (mask(i, j) <= 0.0f) {
+                        continue;
+                    }
+                    const int k = (i - r0 + 1) * stride + (j - c0 + 1);
+                    const float diff = img(i, j) - orig_img(i, j);
+                    l2_norm += diff * diff;
+                    tile_grad[(i - r0) * tile_size + (j - c0)] = diff + strength * (dx[k] + dy[k] - dx[k - 1] - dy[k - stride]);
+                }
+            }
+        }
+
+        const float loss = combine_loss(strength, tv_norm, l2_norm);
+
+        if (!suppress_log) {
+            std::cout << "Iteration: " << counter << ", Loss: " << loss << ", Domain tiles: " << domain.size() << " of " << num_tiles << std::endl;
+        }
+
+        loss_smoothed = loss_smoothed * loss_smoothing_beta + loss * (1.0f - loss_smoothing_beta);
+        float loss_smoothed_debiased = loss_smoothed / (1.0f - static_cast<float>(std::pow(loss_smoothing_beta, counter)));
+        if (loss_converged(loss, loss_smoothed_debiased, tol, counter, false)) {
+            if (!suppress_log) {
+                std::cout << "Converged after " << counter << " iterations with loss: " << loss_smoothed_debiased << std::endl;
+            }
+            break;
+        }
+
+        const float update_scale = step / (1.0f - static_cast<float>(std::pow(momentum_beta, counter)));
+        for (size_t slot = 0; slot < domain.size(); ++slot) {
+            const int r0 = (domain[slot] / tile_cols) * tile_size;
+            const int c0 = (domain[slot] % tile_cols) * tile_size;
+            const int r1 = std::min(r0 + tile_size, rows);
+            const int c1 = std::min(c0 + tile_size, cols);
+            float* tile_momentum = &momentum[slot * tile_pixels];
+            const float* tile_grad = &grad[slot * tile_pixels];
+            for (int i = r0; i < r1; ++i) {
+                for (int j = c0; j < c1; ++j) {
+                    if (mask(i, j) <= 0.0f) {
+                        continue;
+                    }
+                    const int p = (i - r0) * tile_size + (j - c0);
+                    tile_momentum[p] = tile_momentum[p] * momentum_beta + tile_grad[p] * (1.0f - momentum_beta);
+                    img(i, j) -= update_scale * tile_momentum[p];
+                }
+            }
+        }
+
+        ++counter;
+    }
+
+    // Weights below 1 blend the denoised pixels with the input, which feathers the edge of the region
+    for (int tile : domain) {
+        const int r0 = (tile / tile_cols) * tile_size;
+        const int c0 = (tile % tile_cols) * tile_size;
+        for (int i = r0; i < std::min(r0 + tile_size, rows); ++i) {
+            for (int j = c0; j < std::min(c0 + tile_size, cols); ++j) {
+                const float weight = mask(i, j);
+                if (weight > 0.0f && weight < 1.0f) {
+                    img(i, j) = orig_img(i, j) + weight * (img(i, j) - orig_img(i, j));
+                }
+            }
+        }
+    }
+
+    return img;
+}
+
+/**
+ * @brief Linear system of a lagged diffusivity step on one multigrid level.
+ *
+ * The matrix is diag(mass) plus a weighted graph Laplacian on the pixel grid,
+ * every edge (a, b) with weight w adding w * (e_a - e_b)(e_a - e_b)^T.
+ */
+struct DiffusionLevel {
+    int rows;
+    int cols;
+    std::vector<float> mass;
+    // Weights of the edges to the right and to the lower neighbour, 0 at the border
+    std::vector<float> wx;
+    std::vector<float> wy;
+    // Solution, right-hand side and residual of the V-cycle
+    std::vector<float> x;
+    std::vector<float> b;
+    std::vector<float> residual;
+};
+
+static DiffusionLevel make_diffusion_level(int rows, int cols) {
+    const size_t size = static_cast<size_t>(rows) * cols;
+    return DiffusionLevel{
+        rows, cols, std::vector<float>(size, 1.0f), std::vector<float>(size, 0.0f), std::vector<float>(size, 0.0f),
+        std::vector<float>(size), std::vector<float>(size), std::vector<float>(size)
+    };
+}
+
+static void apply_diffusion(const DiffusionLevel& level, const float* u, float* y) {
+    const int rows = level.rows;
+    const int cols = level.cols;
+    for (int i = 0; i < rows; ++i) {
+        for (int j = 0; j < cols; ++j) {
+            const int p = i * cols + j;
+            float value = level.mass[p] * u[p];
+            if (j + 1 < cols) value += level.wx[p] * (u[p] - u[p + 1]);
+            if (j > 0) value += level.wx[p - 1] * (u[p] - u[p - 1]);
+            if (i + 1 < rows) value += level.wy[p] * (u[p] - u[p + cols]);
+            if (i > 0) value += level.wy[p - cols] * (u[p] - u[p - cols]);
+            y[p] = value;
+        }
+    }
+}
+
+static void diffusion_diagonal(const DiffusionLevel& level, float* diagonal) {
+    const int rows = level.rows;
+    const int cols = level.cols;
+    for (int i = 0; i < rows; ++i) {
+        for (int j = 0; j < cols; ++j) {
+            const int p = i * cols + j;
+            float value = level.mass[p];
+            if (j + 1 < cols) value += level.wx[p];
+            if (j > 0) value += level.wx[p - 1];
+            if (i + 1 < rows) value += level.wy[p];
+            if (i > 0) value += level.wy[p - cols];
+            diagonal[p] = value;
+        }
+    }
+}
+
+/**
+ * @brief Gauss-Seidel update of the pixels of one color of the checkerboard (color 0 has i + j even).
+ */
+static void red_black_sweep(DiffusionLevel& level, int color) {
+    const int rows = level.rows;
+    const int cols = level.cols;
+    float* x = level.x.data();
+    for (int i = 0; i < rows; ++i) {
+        for (int j = (i + color) & 1; j < cols; j += 2) {
+            const int p = i * cols + j;
+            float diagonal = level.mass[p];
+            float sum = level.b[p];
+            if (j + 1 < cols) { diagonal += level.wx[p]; sum += level.wx[p] * x[p + 1]; }
+            if (j > 0) { diagonal += level.wx[p - 1]; sum += level.wx[p - 1] * x[p - 1]; }
+            if (i + 1 < rows) { diagonal += level.wy[p]; sum += level.wy[p] * x[p + cols]; }
+            if (i > 0) { diagonal += level.wy[p - cols]; sum += level.wy[p - cols] * x[p - cols]; }
+            x[p] = sum / diagonal;
+        }
+    }
+}
+
+/**
+ * @brief Galerkin coarse operator of aggregating 2x2 pixels: the masses are summed,
+ * the edges inside an aggregate drop out and the edges between two aggregates are summed.
+ */
+static void coarsen_diffusion(const DiffusionLevel& fine, DiffusionLevel& coarse) {
+    std::fill(coarse.mass.begin(), coarse.mass.end(), 0.0f);
+    std::fill(coarse.wx.begin(), coarse.wx.end(), 0.0f);
+    std::fill(coarse.wy.begin(), coarse.wy.end(), 0.0f);
+    for (int i = 0; i < fine.rows; ++i) {
+        for (int j = 0; j < fine.cols; ++j) {
+            const int p = i * fine.cols + j;
+            const int q = (i / 2) * coarse.cols + j / 2;
+            coarse.mass[q] += fine.mass[p];
+            if (j & 1) coarse.wx[q] += fine.wx[p];
+            if (i & 1) coarse.wy[q] += fine.wy[p];
+        }
+    }
+}
+
+/**
+ * @brief Symmetric V-cycle (one red-black sweep before, the reversed sweep after the coarse correction),
+ * approximately solving levels[level] for its right-hand side b starting from x = 0.
+ */
+static void v_cycle(std::vector<DiffusionLevel>& levels, size_t level) {
+    DiffusionLevel& fine = levels[level];
+    if (level + 1 == levels.size()) {
+        for (int k = 0; k < 16; ++k) {
+            red_black_sweep(fine, 0);
+            red_black_sweep(fine, 1);
+        }
+        for (int k = 0; k < 16; ++k) {
+            red_black_sweep(fine, 1);
+            red_black_sweep(fine, 0);
+        }
+        return;
+    }
+
+    red_black_sweep(fine, 0);
+    red_black_sweep(fine, 1);
+
+    apply_diffusion(fine, fine.x.data(), fine.residual.data());
+    for (size_t p = 0; p < fine.residual.size(); ++p) {
+        fine.residual[p] = fine.b[p] - fine.residual[p];
+    }
+
+    DiffusionLevel& coarse = levels[level + 1];
+    std::fill(coarse.b.begin(), coarse.b.end(), 0.0f);
+    std::fill(coarse.x.begin(), coarse.x.end(), 0.0f);
+    for (int i = 0; i < fine.rows; ++i) {
+        for (int j = 0; j < fine.cols; ++j) {
+            coarse.b[(i / 2) * coarse.cols + j / 2] += fine.residual[i * fine.cols + j];
+        }
+    }
+
+    v_cycle(levels, level + 1);
+
+    for (int i = 0; i < fine.rows; ++i) {
+        for (int j = 0; j < fine.cols; ++j) {
+            fine.x[i * fine.cols + j] += coarse.x[(i / 2) * coarse.cols + j / 2];
+        }
+    }
+
+    red_black_sweep(fine, 1);
+    red_black_sweep(fine, 0);
+}
+
+/**
+ * @brief Computes the loss of img and freezes the diffusivities strength / grad_mag of its TV term into the fine level.
+ * @return The total loss (TV + L2) of img.
+ */
+static float lagged_diffusivity_weights(const Image& img, const Image& orig, float strength, DiffusionLevel& level, float eps = 1e-8f) {
+    const int rows = img.getRows();
+    const int cols = img.getCols();
+    ReproducibleSum tv_norm;
+    ReproducibleSum l2_norm;
+
+    for (int i = 0; i < rows; ++i) {
+        for (int j = 0; j < cols; ++j) {
+            const float diff = img(i, j) - orig(i, j);
+            l2_norm += diff * diff;
+
+            // Same cells as tv_norm_and_grad, the cell (i, j) couples the pixel to its right and lower neighbour
+            float weight = 0.0f;
+            if (i < rows - 1 && j < cols - 1) {
+                const float x_diff = img(i, j) - img(i, j + 1);
+                const float y_diff = img(i, j) - img(i + 1, j);
+                const float grad_mag = std::sqrt(x_diff * x_diff + y_diff * y_diff + eps);
+                tv_norm += grad_mag;
+                weight = strength / grad_mag;
+            }
+            level.wx[i * cols + j] = weight;
+            level.wy[i * cols + j] = weight;
+        }
+    }
+
+    return combine_loss(strength, tv_norm, l2_norm);
+}
+
+Image tv_denoise_lagged_diffusivity(
+    const Image& input, float strength, float tol, bool suppress_log, Preconditioner preconditioner, int max_cg_iterations, float cg_tol
+) {
+    const int rows = input.getRows();
+    const int cols = input.getCols();
+    const size_t size = static_cast<size_t>(rows) * cols;
+
+    if (max_cg_iterations < 1) {
+        throw std::invalid_argument("The number of conjugate gradient iterations must be at least 1.");
+    }
+
+    // Aggregating 2x2 pixels per level down to at most 8x8 pixels, solved by a few sweeps
+    std::vector<DiffusionLevel> levels;
+    levels.push_back(make_diffusion_level(rows, cols));
+    if (preconditioner == Preconditioner::Multigrid) {
+        while (levels.back().rows > 8 || levels.back().cols > 8) {
+            levels.push_back(make_diffusion_level((levels.back().rows + 1) / 2, (levels.back().cols + 1) / 2));
+        }
+    }
+    DiffusionLevel& fine = levels[0];
+
+    Image img = input;
+    float* x = img.data();
+    const float* b = input.data();
+    std::vector<float> residual(size);
+    std::vector<float> z(size);
+    std::vector<float> direction(size);
+    std::vector<float> product(size);
+    std::vector<float> diagonal(size);
+
+    auto precondition = [&]() {
+        if (preconditioner == Preconditioner::Jacobi) {
+            for (size_t p = 0; p < size; ++p) {
+                z[p] = residual[p] / diagonal[p];
+            }
+        }
+        else {
+            std::copy(residual.begin(), residual.end(), fine.b.begin());
+            std::fill(fine.x.begin(), fine.x.end(), 0.0f);
+            v_cycle(levels, 0);
+            std::copy(fine.x.begin(), fine.x.end(), z.begin());
+        }
+    };
+
+    float previous_loss = std::numeric_limits<float>::infinity();
+    int total_cg_iterations = 0;
+    int counter = 1;
+    while (true) {
+        // Freezing the diffusivities turns the minimization into the linear system
+        // (I + strength * D^T diag(1 / grad_mag) D) x = input, whose solution never increases the loss
+        const float loss = lagged_diffusivity_weights(img, input, strength, fine);
+
+        if (!suppress_log) {
+            std::cout << "Iteration: " << counter << ", Loss: " << loss << std::endl;
+        }
+
+        if (loss >= previous_loss * (1.0f - tol)) {
+            if (!suppress_log) {
+                std::cout << "Converged after " << counter << " iterations (" << total_cg_iterations
+                    << " conjugate gradient iterations) with loss: " << loss << std::endl;
+            }
+            break;
+        }
+        previous_loss = loss;
+
+        if (preconditioner == Preconditioner::Jacobi) {
+            diffusion_diagonal(fine, diagonal.data());
+        }
+        for (size_t level = 1; level < levels.size(); ++level) {
+            coarsen_diffusion(levels[level - 1], levels[level]);
+        }
+
+        // Preconditioned conjugate gradient, warm-started from the current image.
+        // The inner solve only has to be as accurate as the next diffusivities are close to the current ones.
+        apply_diffusion(fine, x, product.data());
+        double residual_norm = 0.0;
+        for (size_t p = 0; p < size; ++p) {
+            residual[p] = b[p] - product[p];
+            residual_norm += static_cast<double>(residual[p]) * residual[p];
+        }
+        const double target_norm = static_cast<double>(cg_tol) * cg_tol * residual_norm;
+
+        precondition();
+        double rz = 0.0;
+        for (size_t p = 0; p < size; ++p) {
+            direction[p] = z[p];
+            rz += static_cast<double>(residual[p]) * z[p];
+        }
+
+        int cg_iteration = 0;
+        for (; cg_iteration < max_cg_iterations && residual_norm > target_norm; ++cg_iteration) {
+            apply_diffusion(fine, direction.data(), product.data());
+            double curvature = 0.0;
+            for (size_t p = 0; p < size; ++p) {
+                curvature += static_cast<double>(direction[p]) * product[p];
+            }
+
+            const float alpha = static_cast<float>(rz / curvature);
+            residual_norm = 0.0;
+            for (size_t p = 0; p < size; ++p) {
+                x[p] += alpha * direction[p];
+                residual[p] -= alpha * product[p];
+                residual_norm += static_cast<double>(residual[p]) * residual[p];
+            }
+
+            precondition();
+            double rz_next = 0.0;
+            for (size_t p = 0; p < size; ++p) {
+                rz_next += static_cast<double>(residual[p]) * z[p];
+            }
+            const float beta = static_cast<float>(rz_next / rz);
+            rz = rz_next;
+            for (size_t p = 0; p < size; ++p) {
+                direction[p] = z[p] + beta * direction[p];
+            }
+        }
+        total_cg_iterations += cg_iteration;
+
+        ++counter;
+    }
+
+    return img;
+}
+
+/**
+ * @brief Barzilai-Borwein solver of every tv_denoise_barzilai_borwein overload, initial (the input by default) and progress may be nullptr.
+ */
+static Image barzilai_borwein(
+    const Image& input, float strength, float tol, bool suppress_log, const Image* initial, const ProgressOptions* progress
+) {
+    const int rows = input.getRows();
+    const int cols = input.getCols();
+
+    if (initial && (initial->getRows() != rows || initial->getCols() != cols)) {
+        throw std::invalid_argument("Initial image must have the same size as the input image.");
+    }
+
+    Image img = initial ? *initial : input;
+    const Image& orig_img = input;
+    Image grad(rows, cols);
+    Image trial_img(rows, cols);
+    Image trial_grad(rows, cols);
+
+    const float loss_smoothing_beta = 0.9f;
+    float loss_smoothed = 0.0f;
+
+    // Non-monotone line search: a step is accepted if it sufficiently decreases
+    // the maximum of the last few losses instead of the current loss
+    const size_t loss_history_size = 10;
+    const float sufficient_decrease = 1e-4f;
+    const float backtracking_factor = 0.5f;
+    const float min_step = 1e-10f;
+    const float max_step = 1e10f;
+    const int bb_cycle_length = 8;
+    std::deque<float> loss_history;
+
+    ProgressSchedule schedule(progress);
+
+    float loss = eval_loss_and_grad(img, orig_img, strength, grad);
+    float best_loss = loss;
+    // The line search accepts losses above the best one, so the solve returns the best iterate instead of the last
+    Image best_img = img;
+
+    // The first step only has to have the right order of magnitude, the line search corrects it
+    float max_abs_grad = 0.0f;
+    for (int i = 0; i < rows; ++i)
+        for (int j = 0; j < cols; ++j)
+            max_abs_grad = std::max(max_abs_grad, std::abs(grad(i, j)));
+    float step = max_abs_grad > 0.0f ? std::min(1.0f / max_abs_grad, 1.0f) : 1.0f;
+
+    int counter = 1;
+    while (true) {
+        if (schedule.cancelled()) {
+            if (!suppress_log) {
+                std::cout << "Cancelled after " << counter - 1 << " iterations" << std::endl;
+            }
+            break;
+        }
+
+        if (!suppress_log) {
+            std::cout << "Iteration: " << counter << ", Loss: " << loss << ", Step: " << step << std::endl;
+        }
+
+        if (schedule.due(counter)) {
+            schedule.report(counter, loss, img);
+        }
+
+        // The loss is not monotone with spectral steps, so the convergence test is fed with the best loss so far
+        if (loss < best_loss) {
+            best_loss = loss;
+            std::copy(img.data(), img.data() + static_cast<size_t>(rows) * cols, best_img.data());
+        }
+        loss_smoothed = loss_smoothed * loss_smoothing_beta + best_loss * (1.0f - loss_smoothing_beta);
+        float loss_smoothed_debiased = loss_smoothed / (1.0f - static_cast<float>(std::pow(loss_smoothing_beta, counter)));
+        if (loss_converged(best_loss, loss_smoothed_debiased, tol, counter, initial != nullptr)) {
+            if (!suppress_log) {
+                std::cout << "Converged after " << counter << " iterations with loss: " << loss_smoothed_debiased << std::endl;
+            }
+            break;
+        }
+
+        loss_history.push_back(loss);
+        if (loss_history.size() > loss_history_size) {
+            loss_history.pop_front();
+        }
+        const float reference_loss = *std::max_element(loss_history.begin(), loss_history.end());
+
+        double grad_sq = 0.0;
+        for (int i = 0; i < rows; ++i)
+            for (int j = 0; j < cols; ++j)
+                grad_sq += static_cast<double>(grad(i, j)) * grad(i, j);
+
+        // Backtrack until the non-monotone Armijo condition holds
+        float trial_loss;
+        while (true) {
+            for (int i = 0; i < rows; ++i)
+                for (int j = 0; j < cols; ++j)
+                    trial_img(i, j) = img(i, j) - step * grad(i, j);
+
+            trial_loss = eval_loss_and_grad(trial_img, orig_img, strength, trial_grad);
+            if (trial_loss <= reference_loss - sufficient_decrease * step * static_cast<float>(grad_sq) || step <= min_step) {
+                break;
+            }
+            step *= backtracking_factor;
+        }
+
+        // Barzilai-Borwein step <s, s> / <s, y> with s = -step * grad and y = trial_grad - grad
+        double grad_dot_y = 0.0;
+        for (int i = 0; i < rows; ++i)
+            for (int j = 0; j < cols; ++j)
+                grad_dot_y += static_cast<double>(grad(i, j)) * (trial_grad(i, j) - grad(i, j));
+
+        // The spectral step is only refreshed every few iterations (cyclic BB), because the
+        // nearly non-smooth TV term makes the step of every single iteration overly short
+        if (counter % bb_cycle_length == 0) {
+            const double curvature = -grad_dot_y;
+            step = curvature > 0.0 ? static_cast<float>(step * grad_sq / curvature) : max_step;
+            step = std::min(std::max(step, min_step), max_step);
+        }
+
+        img.swap(trial_img);
+        grad.swap(trial_grad);
+        loss = trial_loss;
+
+        ++counter;
+    }
+
+    return best_img;
+}
+
+Image tv_denoise_barzilai_borwein(const Image& input, float strength, float tol, bool suppress_log) {
+    return barzilai_borwein(input, strength, tol, suppress_log, nullptr, nullptr);
+}
+
+Image tv_denoise_barzilai_borwein(const Image& input, float strength, float tol, bool suppress_log, const Image& initial) {
+    return barzilai_borwein(input, strength, tol, suppress_log, &initial, nullptr);
+}
+
+Image tv_denoise_barzilai_borwein(const Image& input, float strength, float tol, bool suppress_log, const ProgressOptions& progress) {
+    return barzilai_borwein(input, strength, tol, suppress_log, nullptr, &progress);
+}
+
+std::vector<RegularizationPathResult> tv_denoise_regularization_path(
+    const Image& input, std::vector<float> strengths, float step_size, float tol, bool suppress_log, bool barzilai_borwein
+) {
+    const int rows = input.getRows();
+    const int cols = input.getCols();
+
+    // From strong to weak: each solve only has to restore the details the previous one smoothed away
+    std::sort(strengths.begin(), strengths.end(), std::greater<float>());
+
+    std::vector<RegularizationPathResult> results;
+    results.reserve(strengths.size());
+
+    for (float strength : strengths) {
+        if (!suppress_log) {
+            std::cout << "Strength: " << strength << std::endl;
+        }
+
+        // The strongest strength is a plain solve from the noisy input (with the cold convergence test),
+        // the others are warm-started from the previous result
+        Image img = results.empty()
+            ? (barzilai_borwein
+                ? tv_denoise_barzilai_borwein(input, strength, tol, suppress_log)
+                : tv_denoise_gradient_descent(input, strength, step_size, tol, suppress_log))
+            : (barzilai_borwein
+                ? tv_denoise_barzilai_borwein(input, strength, tol, suppress_log, results.back().image)
+                : tv_denoise_gradient_descent(input, strength, step_size, tol, suppress_log, results.back().image));
+
+        Image grad(rows, cols);
+        const float tv_norm = tv_norm_and_grad(img, grad);
+        const float l2_norm = l2_norm_and_grad(img, input, grad);
+        results.push_back({ strength, img, strength * tv_norm + l2_norm, tv_norm, l2_norm });
+    }
+
+    return results;
+}
@@ -1,6 +1,12 @@
 #pragma once
 
+#include <vector>
 #include "../Image/Image.h"
+#include "../Common/DenoisingTypes.h"
+#include "../Common/Progress.h"
+#include "../Common/Checkpoint.h"
+#include "../Common/PerfCounters.h"
+#include "../Common/RealTime.h"
 
 /**
  * @brief Computes the total variation (TV) norm of an image and its gradient.
@@ -25,6 +31,9 @@ float l2_norm_and_grad(const Image& img, const Image& orig, Image& grad);
 /**
  * @brief Computes the total loss (TV + L2) and its gradient for an image.
  *
+ * The TV and the L2 term are summed with ReproducibleSum, every solver sums its terms the same way, so the loss
+ * of an iterate does not depend on how a solver splits the image into tiles or threads.
+ *
  * @param img Denoised image (input).
  * @param orig Original image (reference).
  * @param strength Weight for the TV loss term.
@@ -33,6 +42,20 @@ float l2_norm_and_grad(const Image& img, const Image& orig, Image& grad);
  */
 float eval_loss_and_grad(const Image& img, const Image& orig, float strength, Image& grad);
 
+/**
+ * @brief Computes only the gradient of the total loss (TV + L2) for an image.
+ *
+ * Cheaper than eval_loss_and_grad, which computes exactly the same gradient, so evaluating the loss only
+ * every few iterations does not change the iterates.
+ *
+ * @param img Denoised image (input).
+ * @param orig Original image (reference).
+ * @param strength Weight for the TV loss term.
+ * @param grad Output image to store the combined gradient (overwritten).
+ * @param eps Small value to avoid division by zero (default: 1e-8).
+ */
+void eval_grad(const Image& img, const Image& orig, float strength, Image& grad, float eps = 1e-8f);
+
 /**
  * @brief Performs total variation denoising using gradient descent.
  *
@@ -42,6 +65,339 @@ float eval_loss_and_grad(const Image& img, const Image& orig, float strength, Im
  * @param strength Weight for the TV loss term.
  * @param step_size Step size (learning rate) for gradient descent (default: 1e-2).
  * @param tol Tolerance for convergence (default: 3.2e-3).
+ * @param suppress_log If true, suppresses logging output (default: true).
+ * @param check_every The loss and the convergence test are only evaluated every check_every iterations,
+ *                    the iterations in between only compute the gradient (default: 1).
+ * @return The denoised image.
+ */
+Image tv_denoise_gradient_descent(const Image& input, float strength, float step_size = 1e-2f, float tol = 3.2e-3f, bool suppress_log = true, int check_every = 1);
+
+/**
+ * @brief Performs total variation denoising using gradient descent, starting from a given image.
+ *
+ * Same as tv_denoise_gradient_descent, but the iteration is warm-started from initial instead of the noisy input.
+ * The L2 loss is still measured against input.
+ *
+ * @param input Noisy input image.
+ * @param strength Weight for the TV loss term.
+ * @param step_size Step size (learning rate) for gradient descent.
+ * @param tol Tolerance for convergence.
+ * @param suppress_log If true, suppresses logging output.
+ * @param initial Starting point of the iteration, has to be the same size as input.
+ * @param check_every The loss and the convergence test are only evaluated every check_every iterations (default: 1).
+ * @return The denoised image.
+ */
+Image tv_denoise_gradient_descent(const Image& input, float strength, float step_size, float tol, bool suppress_log, const Image& initial, int check_every = 1);
+
+/**
+ * @brief Performs total variation denoising using gradient descent, reporting its progress and allowing it to be cancelled.
+ *
+ * Same as tv_denoise_gradient_descent. The progress callback receives the current iterate without a copy, it is
+ * only called in the iterations that evaluate the loss (see check_every). If the cancellation token of progress
+ * is set, the solve stops and returns its current iterate.
+ *
+ * @param input Noisy input image.
+ * @param strength Weight for the TV loss term.
+ * @param step_size Step size (learning rate) for gradient descent.
+ * @param tol Tolerance for convergence.
+ * @param suppress_log If true, suppresses logging output.
+ * @param progress Progress callback, its intervals and the cancellation token.
+ * @param check_every The loss and the convergence test are only evaluated every check_every iterations (default: 1).
+ * @return The denoised image, or the current iterate if the solve was cancelled.
+ */
+Image tv_denoise_gradient_descent(
+    const Image& input, float strength, float step_size, float tol, bool suppress_log, const ProgressOptions& progress, int check_every = 1
+);
+
+/**
+ * @brief Performs total variation denoising using gradient descent, saving its state to a checkpoint file.
+ *
+ * Same as tv_denoise_gradient_descent. Every checkpoint.interval_iterations iterations the complete state
+ * (iterate, momentum, smoothed loss and counters) is copied and written to checkpoint.path on a background thread.
+ * With checkpoint.resume the solve continues from an existing checkpoint and computes exactly the same iterates
+ * as the interrupted solve. The checkpoint format is shared with the GPU solver, a checkpoint of the other
+ * back end resumes as well, but only up to the rounding differences of the back ends.
+ *
+ * @param input Noisy input image.
+ * @param strength Weight for the TV loss term.
+ * @param step_size Step size (learning rate) for gradient descent.
+ * @param tol Tolerance for convergence.
+ * @param suppress_log If true, suppresses logging output.
+ * @param checkpoint Checkpoint file, interval and whether to resume from it.
+ * @param check_every The loss and the convergence test are only evaluated every check_every iterations (default: 1).
+ * @return The denoised image.
+ * @throws std::invalid_argument if the checkpoint to resume from was written for different parameters.
+ */
+Image tv_denoise_gradient_descent(
+    const Image& input, float strength, float step_size, float tol, bool suppress_log, const CheckpointOptions& checkpoint, int check_every = 1
+);
+
+/**
+ * @brief Performs total variation denoising using gradient descent, measuring every phase of the iteration.
+ *
+ * Same as tv_denoise_gradient_descent. The loss evaluation (tv_norm_and_grad and the L2 term), the gradient
+ * evaluations in between the checks and the momentum update are measured separately: wall-clock time, and
+ * cycles, instructions and LLC misses of the calling thread where Linux perf_event_open is available.
+ * SolverProfiler::report formats them per iteration together with a roofline summary.
+ *
+ * @param input Noisy input image.
+ * @param strength Weight for the TV loss term.
+ * @param step_size Step size (learning rate) for gradient descent.
+ * @param tol Tolerance for convergence.
+ * @param suppress_log If true, suppresses logging output.
+ * @param profiler Profiler the phases are accumulated in.
+ * @param check_every The loss and the convergence test are only evaluated every check_every iterations (default: 1).
+ * @return The denoised image.
+ */
+Image tv_denoise_gradient_descent(
+    const Image& input, float strength, float step_size, float tol, bool suppress_log, SolverProfiler& profiler, int check_every = 1
+);
+
+/**
+ * @brief Performs total variation denoising using gradient descent within an iteration and time budget.
+ *
+ * Same as tv_denoise_gradient_descent from an initial image, but the solve also stops after budget.max_iterations
+ * iterations or at the last convergence check before budget.deadline, and then returns the checked iterate with
+ * the lowest loss instead of the last one. Used by RealTimeDenoiser for every frame of a stream.
+ *
+ * @param input Noisy input image.
+ * @param strength Weight for the TV loss term.
+ * @param step_size Step size (learning rate) for gradient descent.
+ * @param tol Tolerance for convergence.
+ * @param suppress_log If true, suppresses logging output.
+ * @param initial Starting point of the iterations, e.g. the result of the previous frame.
+ * @param budget Limits of the solve, its iterations, loss and outcome are filled in.
+ * @param check_every The loss and the convergence test are only evaluated every check_every iterations (default: 1).
+ * @return The denoised image.
+ * @throws std::invalid_argument if the initial image does not have the size of the input image.
+ */
+Image tv_denoise_gradient_descent(
+    const Image& input, float strength, float step_size, float tol, bool suppress_log, const Image& initial, SolveBudget& budget, int check_every = 1
+);
+
+/**
+ * @brief Performs total variation denoising using gradient descent with reduced precision storage.
+ *
+ * Same iteration as tv_denoise_gradient_descent, but the original image and the momentum (and optionally the
+ * iterate) are stored as 16-bit values, and the gradient, momentum and image update are fused into a single
+ * pass over the image. Every value is converted to float before use and the loss is accumulated in float,
+ * so only the storage is rounded. This halves the memory traffic per iteration, which bounds the speed.
+ * For 8-bit inputs both formats are accurate enough for the original image and the momentum. The iterate
+ * should only be compacted as Float16 and if an error of about 1e-3 is acceptable, as smaller updates are
+ * rounded away (BFloat16 rounds away too much of them to converge to a comparable image).
+ *
+ * @param input Noisy input image.
+ * @param strength Weight for the TV loss term.
+ * @param step_size Step size (learning rate) for gradient descent (default: 1e-2).
+ * @param tol Tolerance for convergence (default: 3.2e-3).
+ * @param suppress_log If true, suppresses logging output (default: true).
+ * @param precision Storage format of the original image and the momentum (default: Float16).
+ * @param compact_image If true, the iterate is stored in the same format, otherwise as float (default: false).
+ * @return The denoised image.
+ */
+Image tv_denoise_gradient_descent_mixed(
+    const Image& input, float strength, float step_size = 1e-2f, float tol = 3.2e-3f, bool suppress_log = true,
+    StoragePrecision precision = StoragePrecision::Float16, bool compact_image = false
+);
+
+/**
+ * @brief Performs total variation denoising using gradient descent with a selectable TV model.
+ *
+ * Same solver as tv_denoise_gradient_descent, with the TV variant, the boundary condition and the scalar type
+ * chosen by the model. Every combination is a separate template instantiation of the solver, so the inner loops
+ * contain no branches on the model. The default model is tv_denoise_gradient_descent itself, the results are identical.
+ * With ScalarType::Double the image, the momentum and the gradient are double, but every loss term is still rounded
+ * to a multiple of 2^-32 by ReproducibleSum and the loss is a float, so the convergence test is no finer than with float.
+ *
+ * @param input Noisy input image.
+ * @param strength Weight for the TV loss term.
+ * @param step_size Step size (learning rate) for gradient descent (default: 1e-2).
+ * @param tol Tolerance for convergence (default: 3.2e-3).
+ * @param suppress_log If true, suppresses logging output (default: true).
+ * @param model TV variant, boundary condition and scalar type (default: isotropic, truncated, float).
+ * @param check_every The loss and the convergence test are only evaluated every check_every iterations (default: 1).
+ * @return The denoised image.
+ * @throws std::invalid_argument if the Huber threshold of a Huber model is not positive.
+ */
+Image tv_denoise_gradient_descent_model(
+    const Image& input, float strength, float step_size = 1e-2f, float tol = 3.2e-3f, bool suppress_log = true,
+    const TvModel& model = TvModel(), int check_every = 1
+);
+
+/**
+ * @brief Performs total variation denoising using gradient descent, advancing cache-sized tiles by several iterations at a time.
+ *
+ * Computes the same iterates as tv_denoise_gradient_descent with check_every = iterations_per_sweep (bit-identical,
+ * the gradient is rounded in the same order, see the Regression project), but instead
+ * of streaming the whole image through memory several times per iteration, every tile is copied into a local
+ * buffer with a halo of iterations_per_sweep pixels and advanced by iterations_per_sweep iterations while it is
+ * in the cache. The exact region shrinks by one pixel per iteration (trapezoidal tiling), the halos are
+ * recomputed by the neighbouring tiles. This cuts the memory traffic by about iterations_per_sweep on images
+ * larger than the cache, at the cost of the redundant halo computations. The tiles of a sweep are independent,
+ * so they are advanced in parallel, where the memory bandwidth would otherwise be the limit. The threads are
+ * started (and pinned) once per solve and wait on a barrier between the sweeps.
+ *
+ * @param input Noisy input image.
+ * @param strength Weight for the TV loss term.
+ * @param step_size Step size (learning rate) for gradient descent (default: 1e-2).
+ * @param tol Tolerance for convergence (default: 3.2e-3).
+ * @param suppress_log If true, suppresses logging output (default: true).
+ * @param iterations_per_sweep Iterations applied to a tile at once, the convergence is checked once per sweep
+ *                             over the tiles, 0 chooses it from the L2 cache size (default: 0).
+ * @param tile_size Side of the tiles without the halo, 0 chooses it from the L2 cache size (default: 0).
+ *                  The result does not depend on it, the losses of the tiles are summed with ReproducibleSum.
+ * @param num_threads Number of threads advancing tiles in parallel, 0 uses every hardware thread (default: 0).
+ *                    The result does not depend on it.
+ * @param numa_aware If true, the threads are pinned to cores spread over the NUMA nodes (see ThreadPlacement), every
+ *                   thread advances a fixed band of consecutive tiles, and the images are allocated with parallel
+ *                   first-touch so the band of a thread lies on its node. Otherwise the image is initialized by the
+ *                   calling thread and the threads take the tiles dynamically (default: false).
+ *                   With suppress_log false the chosen layout is printed.
+ * @return The denoised image.
+ */
+Image tv_denoise_gradient_descent_tiled(
+    const Image& input, float strength, float step_size = 1e-2f, float tol = 3.2e-3f, bool suppress_log = true,
+    int iterations_per_sweep = 0, int tile_size = 0, int num_threads = 0, bool numa_aware = false
+);
+
+/**
+ * @brief Performs total variation denoising using gradient descent, skipping the tiles that have already converged.
+ *
+ * The image is divided into tiles and only the active tiles are updated. Every active_set_interval (10) iterations,
+ * a tile whose pixels all moved less than freeze_threshold since the previous check is frozen, and a frozen tile is
+ * reactivated with zero momentum when a neighbouring tile moved the pixels along their common boundary by at least
+ * freeze_threshold (the gradient of a pixel depends on its neighbours). The change over several iterations is tracked instead of
+ * single updates, because the TV term keeps settled regions oscillating with an amplitude of a few 1e-4.
+ * Frozen tiles keep contributing the loss they had when they were last updated to the convergence test.
+ * The losses of the tiles are summed with ReproducibleSum, so with the same tiles frozen the loss does not depend
+ * on the tile size.
+ * Flat regions settle early, so on mostly flat images most of the work is skipped.
+ *
+ * @param input Noisy input image.
+ * @param strength Weight for the TV loss term.
+ * @param step_size Step size (learning rate) for gradient descent (default: 1e-2).
+ * @param tol Tolerance for convergence (default: 3.2e-3).
+ * @param suppress_log If true, suppresses logging output (default: true).
+ * @param tile_size Side of the tiles (default: active_set_tile_size, the same as on the GPU).
+ * @param freeze_threshold Largest change of a pixel over 10 iterations below which its tile is frozen (default: 1e-3).
+ * @return The denoised image.
+ */
+Image tv_denoise_gradient_descent_active_set(
+    const Image& input, float strength, float step_size = 1e-2f, float tol = 3.2e-3f, bool suppress_log = true,
+    int tile_size = active_set_tile_size, float freeze_threshold = 1e-3f
+);
+
+/**
+ * @brief Performs total variation denoising using gradient descent, restricted to the masked region of the image.
+ *
+ * Only the pixels with a positive mask weight are updated, the others keep their input values and act as a fixed
+ * border for the TV term, so the region blends into the surrounding image without seams. The data term and the
+ * loss cover the masked pixels and the stencils touching them. The iteration only visits the tiles containing a
+ * masked pixel and reads a one pixel halo around them, and the momentum and gradient are only stored for these tiles,
+ * so the cost scales with the masked area instead of the frame. Weights between 0 and 1 blend the denoised pixel
+ * with the input, which feathers the edge of a soft mask.
+ *
+ * @param input Noisy input image.
+ * @param mask Weight of every pixel, 0 outside the region and 1 inside it (same size as the input).
+ * @param strength Weight for the TV loss term.
+ * @param step_size Step size (learning rate) for gradient descent (default: 1e-2).
+ * @param tol Tolerance for convergence (default: 3.2e-3).
+ * @param suppress_log If true, suppresses logging output (default: true).
+ * @param tile_size Side of the tiles the domain is made of (default: 32).
+ * @return The image with the masked region denoised, the input if the mask is empty.
+ * @throws std::invalid_argument if the mask has a different size than the input.
+ */
+Image tv_denoise_gradient_descent_masked(
+    const Image& input, const Image& mask, float strength, float step_size = 1e-2f, float tol = 3.2e-3f, bool suppress_log = true,
+    int tile_size = 32
+);
+
+/**
+ * @brief Performs total variation denoising with the lagged diffusivity (fixed-point) iteration.
+ *
+ * Every outer iteration freezes the diffusivities 1 / grad_mag of the TV term at the current image, which turns
+ * the minimization into the sparse 5-point linear system (I + strength * D^T diag(1 / grad_mag) D) x = input.
+ * It is solved matrix-free by preconditioned conjugate gradient, warm-started from the current image. The loss
+ * decreases in every outer iteration, the iteration stops when it decreased by less than a fraction tol of the loss.
+ * The system does not suffer from the conditioning of the smoothed TV term that slows down gradient descent,
+ * it reaches the loss of tv_denoise_gradient_descent in about ten outer iterations of a few dozen CG iterations.
+ *
+ * @param input Noisy input image.
+ * @param strength Weight for the TV loss term.
+ * @param tol Relative decrease of the loss per outer iteration below which the iteration stops (default: 3.2e-3).
+ * @param suppress_log If true, suppresses logging output (default: true).
+ * @param preconditioner Preconditioner of the conjugate gradient solves (default: Jacobi).
+ * @param max_cg_iterations Maximum number of conjugate gradient iterations per outer iteration (default: 100).
+ * @param cg_tol Reduction of the residual norm at which a conjugate gradient solve stops (default: 1e-2).
+ * @return The denoised image.
+ */
+Image tv_denoise_lagged_diffusivity(
+    const Image& input, float strength, float tol = 3.2e-3f, bool suppress_log = true,
+    Preconditioner preconditioner = Preconditioner::Jacobi, int max_cg_iterations = 100, float cg_tol = 1e-2f
+);
+
+/**
+ * @brief Performs total variation denoising using gradient descent with Barzilai-Borwein step sizes.
+ *
+ * The step size is chosen adaptively from the change of the iterate and the gradient (spectral step),
+ * safeguarded by a non-monotone backtracking line search. No step size has to be tuned.
+ * Uses the same convergence test as tv_denoise_gradient_descent, on the lowest loss so far. The line search
+ * accepts steps that increase the loss, so the iterate with the lowest loss is returned rather than the last one.
+ *
+ * @param input Noisy input image.
+ * @param strength Weight for the TV loss term.
+ * @param tol Tolerance for convergence (default: 3.2e-3).
+ * @param suppress_log If true, suppresses logging output (default: true).
+ * @return The denoised image.
+ */
+Image tv_denoise_barzilai_borwein(const Image& input, float strength, float tol = 3.2e-3f, bool suppress_log = true);
+
+/**
+ * @brief Performs total variation denoising using Barzilai-Borwein step sizes, starting from a given image.
+ *
+ * Same as tv_denoise_barzilai_borwein, but the iteration is warm-started from initial instead of the noisy input.
+ *
+ * @param input Noisy input image.
+ * @param strength Weight for the TV loss term.
+ * @param tol Tolerance for convergence.
+ * @param suppress_log If true, suppresses logging output.
+ * @param initial Starting point of the iteration, has to be the same size as input.
  * @return The denoised image.
  */
-Image tv_denoise_gradient_descent(const Image& input, float strength, float step_size = 1e-2f, float tol = 3.2e-3f, bool suppress_log = true);
+Image tv_denoise_barzilai_borwein(const Image& input, float strength, float tol, bool suppress_log, const Image& initial);
+
+/**
+ * @brief Performs total variation denoising using Barzilai-Borwein step sizes, reporting its progress.
+ *
+ * Same as tv_denoise_barzilai_borwein, but progress.callback is called with the current iterate and its loss
+ * at the intervals of progress. If the cancellation token of progress is set, the solve stops and returns
+ * the iterate with the lowest loss so far.
+ *
+ * @param input Noisy input image.
+ * @param strength Weight for the TV loss term.
+ * @param tol Tolerance for convergence.
+ * @param suppress_log If true, suppresses logging output.
+ * @param progress Progress callback, its intervals and the cancellation token.
+ * @return The denoised image, or the best iterate so far if the solve was cancelled.
+ */
+Image tv_denoise_barzilai_borwein(const Image& input, float strength, float tol, bool suppress_log, const ProgressOptions& progress);
+
+/**
+ * @brief Denoises an image with several strengths in one run (regularization path).
+ *
+ * The strengths are solved from the strongest to the weakest. The strongest is a plain solve from the noisy input
+ * (so a single strength gives the same result as a plain run), every further one is warm-started from the previous
+ * solution, which is much cheaper than solving every strength from the noisy input.
+ *
+ * @param input Noisy input image, shared by every solve.
+ * @param strengths Weights for the TV loss term, in any order.
+ * @param step_size Step size (learning rate) for gradient descent, ignored by Barzilai-Borwein (default: 1e-2).
+ * @param tol Tolerance for convergence (default: 3.2e-3).
+ * @param suppress_log If true, suppresses logging output (default: true).
+ * @param barzilai_borwein If true, uses tv_denoise_barzilai_borwein instead of tv_denoise_gradient_descent (default: false).
+ * @return The results ordered from the strongest to the weakest strength.
+ */
+std::vector<RegularizationPathResult> tv_denoise_regularization_path(
+    const Image& input, std::vector<float> strengths, float step_size = 1e-2f, float tol = 3.2e-3f,
+    bool suppress_log = true, bool barzilai_borwein = false
+);
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include "../Image/Image.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
+
+/**
+ * @brief Complete state of a gradient descent solve, enough to continue it bit-exactly.
+ */
+struct SolverCheckpoint {
+	/** Iteration the solve continues with. */
+	int counter;
+	/** Number of convergence checks done so far. */
+	int checks;
+	/** Exponential moving average of the loss (not debiased). */
+	float loss_smoothed;
+	/** Parameters the iterates depend on, a resume with different values is rejected. */
+	float strength;
+	float step_size;
+	int check_every;
+	/** Current iterate. */
+	Image img;
+	/** Current momentum. */
+	Image momentum;
+};
+
+/**
+ * @brief Checkpointing of a solve (see tv_denoise_gradient_descent).
+ */
+struct CheckpointOptions {
+	/** Checkpoint file, replaced by every checkpoint. */
+	std::string path;
+	/** Iterations between two checkpoints, 0 to only resume. */
+	int interval_iterations = 0;
+	/** If true and the file exists, the solve continues from it instead of the input. */
+	bool resume = false;
+};
+
+// "TVCK" followed by the format version
+static const uint32_t checkpoint_magic = 0x4B435654u;
+static const uint32_t checkpoint_version = 1u;
+
+/**
+ * @brief Writes a checkpoint to a binary file (native byte order, floats stored bit-exactly).
+ *
+ * The checkpoint is written to a temporary file first, which then replaces the previous checkpoint,
+ * so an interrupted write never destroys the last complete checkpoint.
+ *
+ * @param path Checkpoint file.
+ * @param checkpoint State to write.
+ * @throws std::runtime_error if the file cannot be written.
+ */
+inline void write_checkpoint(const std::string& path, const SolverCheckpoint& checkpoint) {
+	const std::string temporary_path = path + ".tmp";
+	{
+		std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+		if (!file) {
+			throw std::runtime_error("Failed to open checkpoint file for writing: " + temporary_path);
+		}
+
+		const int32_t header[6] = {
+			checkpoint.img.getRows(), checkpoint.img.getCols(), checkpoint.counter, checkpoint.checks, checkpoint.check_every, 0
+		};
+		const float parameters[3] = { checkpoint.loss_smoothed, checkpoint.strength, checkpoint.step_size };
+		const std::streamsize pixels = static_cast<std::streamsize>(checkpoint.img.getRows()) * checkpoint.img.getCols();
+
+		file.write(reinterpret_cast<const char*>(&checkpoint_magic), sizeof(checkpoint_magic));
+		file.write(reinterpret_cast<const char*>(&checkpoint_version), sizeof(checkpoint_version));
+		file.write(reinterpret_cast<const char*>(header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(parameters), sizeof(parameters));
+		file.write(reinterpret_cast<const char*>(checkpoint.img.data()), pixels * sizeof(float));
+		file.write(reinterpret_cast<const char*>(checkpoint.momentum.data()), pixels * sizeof(float));
+		file.flush();
+		if (!file) {
+			throw std::runtime_error("Failed to write checkpoint file: " + temporary_path);
+		}
+	}
+
+#ifdef _WIN32
+	const bool replaced = MoveFileExA(temporary_path.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	const bool replaced = std::rename(temporary_path.c_str(), path.c_str()) == 0;
+#endif
+	if (!replaced) {
+		throw std::runtime_error("Failed to replace checkpoint file: " + path);
+	}
+}
+
+/**
+ * @brief Reads a checkpoint written by write_checkpoint.
+ * @param path Checkpoint file.
+ * @return The solver state.
+ * @throws std::runtime_error if the file cannot be read or is not a valid checkpoint.
+ */
+inline SolverCheckpoint read_checkpoint(const std::string& path) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		throw std::runtime_error("Failed to open checkpoint file: " + path);
+	}
+
+	uint32_t magic = 0;
+	uint32_t version = 0;
+	int32_t header[6] = {};
+	float parameters[3] = {};
+	file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+	file.read(reinterpret_cast<char*>(&version), sizeof(version));
+	file.read(reinterpret_cast<char*>(header), sizeof(header));
+	file.read(reinterpret_cast<char*>(parameters), sizeof(parameters));
+	if (!file || magic != checkpoint_magic || version != checkpoint_version || header[0] <= 0 || header[1] <= 0) {
+		throw std::runtime_error("Not a valid checkpoint file: " + path);
+	}
+
+	SolverCheckpoint checkpoint{
+		header[2], header[3], parameters[0], parameters[1], parameters[2], header[4],
+		Image(header[0], header[1]), Image(header[0], header[1])
+	};
+	const std::streamsize pixels = static_cast<std::streamsize>(header[0]) * header[1];
+	file.read(reinterpret_cast<char*>(checkpoint.img.data()), pixels * sizeof(float));
+	file.read(reinterpret_cast<char*>(checkpoint.momentum.data()), pixels * sizeof(float));
+	if (!file) {
+		throw std::runtime_error("Truncated checkpoint file: " + path);
+	}
+	return checkpoint;
+}
+
+/**
+ * @brief Reads the checkpoint to resume a solve from, if there is one.
+ *
+ * @param options Checkpoint options of the solve.
+ * @param rows Rows of the input image.
+ * @param cols Columns of the input image.
+ * @param strength Weight for the TV loss term of the solve.
+ * @param step_size Step size of the solve.
+ * @param check_every Convergence check frequency of the solve.
+ * @return The checkpoint, or nullptr if resuming is disabled or the file does not exist yet.
+ * @throws std::invalid_argument if the checkpoint belongs to a different image or different parameters.
+ */
+inline std::unique_ptr<SolverCheckpoint> load_resume_checkpoint(
+	const CheckpointOptions& options, int rows, int cols, float strength, float step_size, int check_every
+) {
+	if (!options.resume || !std::ifstream(options.path, std::ios::binary)) {
+		return nullptr;
+	}
+
+	std::unique_ptr<SolverCheckpoint> checkpoint(new SolverCheckpoint(read_checkpoint(options.path)));
+	if (checkpoint->img.getRows() != rows || checkpoint->img.getCols() != cols) {
+		throw std::invalid_argument("Checkpoint was written for an image of a different size.");
+	}
+	if (checkpoint->strength != strength || checkpoint->step_size != step_size || checkpoint->check_every != check_every) {
+		throw std::invalid_argument("Checkpoint was written with a different strength, step size or check frequency.");
+	}
+	return checkpoint;
+}
+
+/**
+ * @brief Writes checkpoints on a background thread, so the solve only pays for copying its state.
+ *
+ * At most one write is in flight, a new checkpoint waits for the previous write to finish.
+ * Errors of a write are thrown by the next call of write or wait.
+ */
+class CheckpointWriter {
+public:
+	explicit CheckpointWriter(std::string path) : path(std::move(path)) {
+	}
+
+	CheckpointWriter(const CheckpointWriter&) = delete;
+	CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+	/** Waits for the last write, its errors are dropped (call wait to get them). */
+	~CheckpointWriter() {
+		if (pending.valid()) {
+			pending.wait();
+		}
+	}
+
+	/**
+	 * @brief Starts writing a checkpoint in the background.
+	 * @param checkpoint State to write, owned by the writer until the write finished.
+	 */
+	void write(std::shared_ptr<const SolverCheckpoint> checkpoint) {
+		wait();
+		pending = std::async(std::launch::async, [checkpoint, file_path = path]() {
+			write_checkpoint(file_path, *checkpoint);
+		});
+	}
+
+	/** @brief Waits for the write in flight, if any, and throws its error. */
+	void wait() {
+		if (pending.valid()) {
+			pending.get();
+		}
+	}
+
+private:
+	std::string path;
+	std::future<void> pending;
+};
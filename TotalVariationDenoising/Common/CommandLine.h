@@ -0,0 +1,218 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "DenoisingTypes.h"
+
+/**
+ * @brief Parses a comma separated list of floats (e.g. "0.3,0.1,0.05").
+ * @param list The comma separated list.
+ * @return The parsed values in the given order.
+ * @throws std::invalid_argument if an element is not a number.
+ */
+inline std::vector<float> parse_float_list(const std::string& list) {
+	std::vector<float> values;
+	std::stringstream stream(list);
+	std::string item;
+	while (std::getline(stream, item, ',')) {
+		values.push_back(std::stof(item));
+	}
+	if (values.empty()) {
+		throw std::invalid_argument("Empty list: " + list);
+	}
+	return values;
+}
+
+/**
+ * @brief Splits a file path into the part before the extension and the extension (including the dot).
+ * @param path File path.
+ * @return The stem (with the directory) and the extension, which is empty if the file has none.
+ */
+inline std::pair<std::string, std::string> split_extension(const std::string& path) {
+	const size_t separator = path.find_last_of("/\\");
+	const size_t dot = path.find_last_of('.');
+	if (dot == std::string::npos || (separator != std::string::npos && dot < separator)) {
+		return std::make_pair(path, std::string());
+	}
+	return std::make_pair(path.substr(0, dot), path.substr(dot));
+}
+
+/**
+ * @brief Inserts a suffix into a file path before its extension (e.g. "out.png" -> "out_suffix.png").
+ * @param path Original file path.
+ * @param suffix Suffix to insert.
+ * @return The modified path.
+ */
+inline std::string path_with_suffix(const std::string& path, const std::string& suffix) {
+	const std::pair<std::string, std::string> parts = split_extension(path);
+	return parts.first + suffix + parts.second;
+}
+
+/**
+ * @brief Path of a frame of a sequence given as a printf-style pattern (e.g. "frame_%04d.png", frame 7 -> "frame_0007.png").
+ *
+ * Only a single %d conversion (with an optional width, zero padded with a leading 0) is accepted,
+ * a path without one is the same for every frame.
+ *
+ * @param pattern Path pattern.
+ * @param index Index of the frame.
+ * @return The path of the frame.
+ * @throws std::invalid_argument if the pattern contains another conversion.
+ */
+inline std::string frame_path(const std::string& pattern, int index) {
+	const size_t percent = pattern.find('%');
+	if (percent == std::string::npos) {
+		return pattern;
+	}
+	const size_t conversion = pattern.find_first_not_of("0123456789", percent + 1);
+	if (conversion == std::string::npos || pattern[conversion] != 'd' || pattern.find('%', conversion) != std::string::npos) {
+		throw std::invalid_argument("Frame path pattern must contain a single %d conversion: " + pattern);
+	}
+	std::vector<char> path(pattern.size() + 32);
+	std::snprintf(path.data(), path.size(), pattern.c_str(), index);
+	return path.data();
+}
+
+/**
+ * @brief Writes every image of a regularization path and a CSV summary of their loss terms.
+ *
+ * The image of strength s is written to output_path with the "_s<s>" suffix, the summary to output_path with the
+ * "_path" suffix and a .csv extension.
+ *
+ * @param output_path Output image path given on the command line.
+ * @param results Results of tv_denoise_regularization_path.
+ */
+inline void write_regularization_path(const std::string& output_path, const std::vector<RegularizationPathResult>& results) {
+	std::ofstream csv(split_extension(output_path).first + "_path.csv");
+	if (!csv) {
+		throw std::runtime_error("Failed to write the regularization path summary of: " + output_path);
+	}
+	csv << "strength,loss,tv_norm,l2_norm,image" << std::endl;
+
+	for (const RegularizationPathResult& result : results) {
+		std::ostringstream suffix;
+		suffix << "_s" << result.strength;
+		const std::string path = path_with_suffix(output_path, suffix.str());
+
+		cv::imwrite(path, result.image.toMat());
+		csv << result.strength << "," << result.loss << "," << result.tv_norm << "," << result.l2_norm << "," << path << std::endl;
+	}
+}
+
+/**
+ * @brief Parses the name of a storage precision ("fp32", "fp16" or "bf16").
+ * @param name Name of the precision.
+ * @return The parsed precision.
+ * @throws std::invalid_argument if the name is unknown.
+ */
+inline StoragePrecision parse_storage_precision(const std::string& name) {
+	if (name == "fp32") {
+		return StoragePrecision::Float32;
+	}
+	if (name == "fp16") {
+		return StoragePrecision::Float16;
+	}
+	if (name == "bf16") {
+		return StoragePrecision::BFloat16;
+	}
+	throw std::invalid_argument("Unknown precision: " + name + " (expected fp32, fp16 or bf16)");
+}
+
+/**
+ * @brief Parses the name of a preconditioner ("jacobi" or "multigrid").
+ * @param name Name of the preconditioner.
+ * @return The parsed preconditioner.
+ * @throws std::invalid_argument if the name is unknown.
+ */
+inline Preconditioner parse_preconditioner(const std::string& name) {
+	if (name == "jacobi") {
+		return Preconditioner::Jacobi;
+	}
+	if (name == "multigrid") {
+		return Preconditioner::Multigrid;
+	}
+	throw std::invalid_argument("Unknown preconditioner: " + name + " (expected jacobi or multigrid)");
+}
+
+/**
+ * @brief Parses the name of a TV variant ("isotropic", "anisotropic" or "huber").
+ * @param name Name of the variant.
+ * @return The parsed variant.
+ * @throws std::invalid_argument if the name is unknown.
+ */
+inline TvVariant parse_tv_variant(const std::string& name) {
+	if (name == "isotropic") {
+		return TvVariant::Isotropic;
+	}
+	if (name == "anisotropic") {
+		return TvVariant::Anisotropic;
+	}
+	if (name == "huber") {
+		return TvVariant::Huber;
+	}
+	throw std::invalid_argument("Unknown TV variant: " + name + " (expected isotropic, anisotropic or huber)");
+}
+
+/**
+ * @brief Parses the name of a boundary condition ("truncated", "neumann" or "periodic").
+ * @param name Name of the boundary condition.
+ * @return The parsed boundary condition.
+ * @throws std::invalid_argument if the name is unknown.
+ */
+inline BoundaryCondition parse_boundary_condition(const std::string& name) {
+	if (name == "truncated") {
+		return BoundaryCondition::Truncated;
+	}
+	if (name == "neumann") {
+		return BoundaryCondition::Neumann;
+	}
+	if (name == "periodic") {
+		return BoundaryCondition::Periodic;
+	}
+	throw std::invalid_argument("Unknown boundary condition: " + name + " (expected truncated, neumann or periodic)");
+}
+
+/**
+ * @brief Parses the name of a scalar type ("float" or "double").
+ * @param name Name of the scalar type.
+ * @return The parsed scalar type.
+ * @throws std::invalid_argument if the name is unknown.
+ */
+inline ScalarType parse_scalar_type(const std::string& name) {
+	if (name == "float") {
+		return ScalarType::Float;
+	}
+	if (name == "double") {
+		return ScalarType::Double;
+	}
+	throw std::invalid_argument("Unknown scalar type: " + name + " (expected float or double)");
+}
+
+/**
+ * @brief Rejects the options the chosen solver does not take.
+ *
+ * The mains choose the solver from the options given (the first variant that matches), so an option of
+ * another variant would otherwise be ignored silently, e.g. --resume would restart a long run from scratch.
+ * --solver is taken by every solver.
+ *
+ * @param given Names of the options given on the command line (e.g. "--check-every").
+ * @param solver Name of the chosen solver for the message (e.g. "the active set solver").
+ * @param supported Names of the options the chosen solver takes.
+ * @throws std::invalid_argument naming the first option given that the solver does not take.
+ */
+inline void require_supported_options(
+	const std::vector<std::string>& given, const std::string& solver, const std::vector<std::string>& supported
+) {
+	for (const std::string& option : given) {
+		if (option != "--solver" && std::find(supported.begin(), supported.end(), option) == supported.end()) {
+			throw std::invalid_argument(option + " is not supported by " + solver);
+		}
+	}
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+/**
+ * @brief Number of iterations the smoothed loss of the convergence test averages, 1 / (1 - beta) for beta = 0.9.
+ */
+const int smoothed_loss_window = 10;
+
+/**
+ * @brief Convergence test of the solvers on the debiased exponential moving average of the loss.
+ *
+ * A solve from the noisy image stops once the smoothed loss is within tol of the loss, from the second iteration on.
+ * A warm-started solve (e.g. the next strength of a regularization path) makes little progress at first and its loss
+ * may rise before it falls, which fires that test at once. It is only tested after smoothed_loss_window iterations,
+ * when the average is meaningful, and only a loss at or below its average counts as converged.
+ * The OpenCL kernels use the same test (loss_converged in Denoising.cl).
+ *
+ * @param loss Loss of the current iteration.
+ * @param loss_smoothed_debiased Debiased smoothed loss, including the current iteration.
+ * @param tol Relative tolerance.
+ * @param counter Number of the current iteration, starting at 1.
+ * @param warm_start True if the solve started from an initial image instead of the noisy one.
+ * @return True if the solve has converged.
+ */
+inline bool loss_converged(float loss, float loss_smoothed_debiased, float tol, int counter, bool warm_start) {
+	if (warm_start) {
+		return counter > smoothed_loss_window && loss_smoothed_debiased >= loss && loss_smoothed_debiased / loss < 1.0f + tol;
+	}
+	return counter > 1 && loss_smoothed_debiased / loss < 1.0f + tol;
+}
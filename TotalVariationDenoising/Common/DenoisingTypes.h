@@ -0,0 +1,101 @@
+#pragma once
+
+#include "../Image/Image.h"
+
+/**
+ * @brief Result of a single strength of a regularization path (see tv_denoise_regularization_path).
+ */
+struct RegularizationPathResult {
+	/** Weight of the TV loss term the image was denoised with. */
+	float strength;
+	/** Denoised image. */
+	Image image;
+	/** Total loss (strength * tv_norm + l2_norm) of the denoised image. */
+	float loss;
+	/** Total variation norm of the denoised image. */
+	float tv_norm;
+	/** L2 loss between the denoised and the noisy image. */
+	float l2_norm;
+};
+
+/**
+ * @brief Storage format of the per-pixel buffers of the mixed precision solvers (see tv_denoise_gradient_descent_mixed).
+ *
+ * Only the storage is reduced, every value is converted to float before it is used.
+ */
+enum class StoragePrecision {
+	/** 32-bit IEEE float. */
+	Float32,
+	/** 16-bit IEEE half precision (10-bit mantissa, max 65504). */
+	Float16,
+	/** 16-bit bfloat16 (8-bit mantissa, float range). */
+	BFloat16
+};
+
+/**
+ * @brief Preconditioner of the conjugate gradient solves of the lagged diffusivity solvers (see tv_denoise_lagged_diffusivity).
+ */
+enum class Preconditioner {
+	/** Inverse of the diagonal, one pass over the image. */
+	Jacobi,
+	/** One V-cycle of aggregation multigrid with red-black Gauss-Seidel smoothing. */
+	Multigrid
+};
+
+/**
+ * @brief Penalty on the forward differences of a pixel (see tv_denoise_gradient_descent_model).
+ */
+enum class TvVariant {
+	/** sqrt(dx^2 + dy^2 + eps), rotation invariant (the default model). */
+	Isotropic,
+	/** sqrt(dx^2 + eps) + sqrt(dy^2 + eps), favours horizontal and vertical edges. */
+	Anisotropic,
+	/** Quadratic below huber_delta and linear above, avoids the staircasing of TV in smooth gradients. */
+	Huber
+};
+
+/**
+ * @brief Handling of the forward differences at the last row and column (see tv_denoise_gradient_descent_model).
+ */
+enum class BoundaryCondition {
+	/** Only pixels with a right and a lower neighbour have a TV term, as in tv_norm_and_grad. */
+	Truncated,
+	/** The differences across the border are zero (reflecting border), every pixel has a TV term. */
+	Neumann,
+	/** The last row and column are neighbours of the first ones (wrapping border). */
+	Periodic
+};
+
+/**
+ * @brief Scalar type of the iterate, the momentum and the gradient (see tv_denoise_gradient_descent_model).
+ */
+enum class ScalarType {
+	Float,
+	/**
+	 * Needs cl_khr_fp64 on the GPU. Only the iteration is in double, the loss of the convergence test is summed
+	 * in fixed point in units of 2^-32 on the CPU (see ReproducibleSum) and in float on the GPU.
+	 */
+	Double
+};
+
+/**
+ * @brief Model solved by tv_denoise_gradient_descent_model, every combination is a separately compiled solver.
+ */
+struct TvModel {
+	TvVariant variant = TvVariant::Isotropic;
+	BoundaryCondition boundary = BoundaryCondition::Truncated;
+	ScalarType scalar = ScalarType::Float;
+	/** Smoothing of the isotropic and anisotropic norm, keeps the gradient finite in flat regions. */
+	float eps = 1e-8f;
+	/** Gradient magnitude at which the Huber penalty turns from quadratic to linear. */
+	float huber_delta = 1e-2f;
+};
+
+/** Iterations between two rebuilds of the active tile list of the active-set solvers (tv_denoise_gradient_descent_active_set). */
+const int active_set_interval = 10;
+
+/**
+ * Default tile side of the active-set solvers of both back ends. On the GPU a tile is a work-group, 16 x 16 = 256
+ * work items fit the maximum work-group size of every common device.
+ */
+const int active_set_tile_size = 16;
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+// GCC and Clang define __F16C__ when F16C is enabled (even -mavx2 may come with -mno-f16c). MSVC has no such
+// macro, but F16C is available on every CPU supporting AVX2, so /arch:AVX2 (__AVX2__) implies it there.
+#if defined(__F16C__) || (defined(_MSC_VER) && defined(__AVX2__))
+#include <immintrin.h>
+#define DENOISING_F16C
+#endif
+
+/**
+ * @brief Converts a float to IEEE 754 half precision (round to nearest even).
+ * @param value Value to convert.
+ * @return The bits of the half precision value.
+ */
+inline uint16_t float_to_half(float value) {
+#ifdef DENOISING_F16C
+	return static_cast<uint16_t>(_cvtss_sh(value, _MM_FROUND_TO_NEAREST_INT));
+#else
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+
+	const uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000u);
+	const uint32_t abs_bits = bits & 0x7FFFFFFFu;
+
+	// NaN keeps a quiet NaN, anything at least 65520 rounds to infinity
+	if (abs_bits > 0x7F800000u) {
+		return static_cast<uint16_t>(sign | 0x7E00u);
+	}
+	if (abs_bits >= 0x477FF000u) {
+		return static_cast<uint16_t>(sign | 0x7C00u);
+	}
+
+	// Subnormal results: shift the mantissa (with the implicit bit) right and round
+	if (abs_bits < 0x38800000u) {
+		if (abs_bits < 0x33000000u) {
+			return sign;
+		}
+		const uint32_t exponent = abs_bits >> 23;
+		const uint32_t mantissa = (abs_bits & 0x007FFFFFu) | 0x00800000u;
+		const uint32_t shift = 126u - exponent;
+		uint32_t half_mantissa = mantissa >> shift;
+		const uint32_t remainder = mantissa & ((1u << shift) - 1u);
+		const uint32_t halfway = 1u << (shift - 1u);
+		if (remainder > halfway || (remainder == halfway && (half_mantissa & 1u))) {
+			++half_mantissa;
+		}
+		return static_cast<uint16_t>(sign | half_mantissa);
+	}
+
+	// Normal results: rebias the exponent and round the mantissa, a carry correctly bumps the exponent
+	uint32_t half_bits = (abs_bits - 0x38000000u) >> 13;
+	const uint32_t remainder = abs_bits & 0x1FFFu;
+	if (remainder > 0x1000u || (remainder == 0x1000u && (half_bits & 1u))) {
+		++half_bits;
+	}
+	return static_cast<uint16_t>(sign | half_bits);
+#endif
+}
+
+/**
+ * @brief Converts an IEEE 754 half precision value to float (exact).
+ * @param value The bits of the half precision value.
+ * @return The converted value.
+ */
+inline float half_to_float(uint16_t value) {
+#ifdef DENOISING_F16C
+	return _cvtsh_ss(value);
+#else
+	const uint32_t sign = static_cast<uint32_t>(value & 0x8000u) << 16;
+	uint32_t exponent = (value >> 10) & 0x1Fu;
+	uint32_t mantissa = value & 0x03FFu;
+
+	uint32_t bits;
+	if (exponent == 0x1Fu) {
+		bits = sign | 0x7F800000u | (mantissa << 13);
+	}
+	else if (exponent != 0) {
+		bits = sign | ((exponent + 112u) << 23) | (mantissa << 13);
+	}
+	else if (mantissa == 0) {
+		bits = sign;
+	}
+	else {
+		// Normalize the subnormal value
+		exponent = 113u;
+		while ((mantissa & 0x0400u) == 0) {
+			mantissa <<= 1;
+			--exponent;
+		}
+		bits = sign | (exponent << 23) | ((mantissa & 0x03FFu) << 13);
+	}
+
+	float result;
+	std::memcpy(&result, &bits, sizeof(result));
+	return result;
+#endif
+}
+
+/**
+ * @brief Converts a float to bfloat16 (the upper half of a float, round to nearest even).
+ * @param value Value to convert.
+ * @return The bits of the bfloat16 value.
+ */
+inline uint16_t float_to_bfloat16(float value) {
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	if ((bits & 0x7FFFFFFFu) > 0x7F800000u) {
+		return static_cast<uint16_t>((bits >> 16) | 0x0040u);
+	}
+	bits += 0x7FFFu + ((bits >> 16) & 1u);
+	return static_cast<uint16_t>(bits >> 16);
+}
+
+/**
+ * @brief Converts a bfloat16 value to float (exact).
+ * @param value The bits of the bfloat16 value.
+ * @return The converted value.
+ */
+inline float bfloat16_to_float(uint16_t value) {
+	const uint32_t bits = static_cast<uint32_t>(value) << 16;
+	float result;
+	std::memcpy(&result, &bits, sizeof(result));
+	return result;
+}
+
+/**
+ * @brief Converts an array of half precision values to float, 8 at a time with F16C if available.
+ * @param src Half precision input (size: size).
+ * @param dst Float output (size: size).
+ * @param size Number of elements.
+ */
+inline void half_to_float(const uint16_t* src, float* dst, int size) {
+	int i = 0;
+#ifdef DENOISING_F16C
+	for (; i + 8 <= size; i += 8) {
+		const __m128i half8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		_mm256_storeu_ps(dst + i, _mm256_cvtph_ps(half8));
+	}
+#endif
+	for (; i < size; ++i) {
+		dst[i] = half_to_float(src[i]);
+	}
+}
+
+/**
+ * @brief Converts an array of floats to half precision, 8 at a time with F16C if available.
+ * @param src Float input (size: size).
+ * @param dst Half precision output (size: size).
+ * @param size Number of elements.
+ */
+inline void float_to_half(const float* src, uint16_t* dst, int size) {
+	int i = 0;
+#ifdef DENOISING_F16C
+	for (; i + 8 <= size; i += 8) {
+		const __m128i half8 = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), half8);
+	}
+#endif
+	for (; i < size; ++i) {
+		dst[i] = float_to_half(src[i]);
+	}
+}
+
+/**
+ * @brief Converts an array of bfloat16 values to float.
+ * @param src Bfloat16 input (size: size).
+ * @param dst Float output (size: size).
+ * @param size Number of elements.
+ */
+inline void bfloat16_to_float(const uint16_t* src, float* dst, int size) {
+	for (int i = 0; i < size; ++i) {
+		dst[i] = bfloat16_to_float(src[i]);
+	}
+}
+
+/**
+ * @brief Converts an array of floats to bfloat16.
+ * @param src Float input (size: size).
+ * @param dst Bfloat16 output (size: size).
+ * @param size Number of elements.
+ */
+inline void float_to_bfloat16(const float* src, uint16_t* dst, int size) {
+	for (int i = 0; i < size; ++i) {
+		dst[i] = float_to_bfloat16(src[i]);
+	}
+}
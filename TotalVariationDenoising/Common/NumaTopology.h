@@ -0,0 +1,243 @@
+#pragma once
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/**
+ * @brief Logical processors of every NUMA node of the machine.
+ */
+struct NumaTopology {
+	/** Logical processors of every node, in the order the operating system lists them. */
+	std::vector<std::vector<int>> node_processors;
+
+	/** @return Total number of logical processors. */
+	int processors() const {
+		int count = 0;
+		for (const std::vector<int>& node : node_processors) {
+			count += static_cast<int>(node.size());
+		}
+		return count;
+	}
+};
+
+/**
+ * @brief Parses a Linux cpu list such as "0-7,16-23".
+ */
+inline std::vector<int> parse_cpu_list(const std::string& list) {
+	std::vector<int> processors;
+	std::stringstream stream(list);
+	std::string range;
+	while (std::getline(stream, range, ',')) {
+		const size_t dash = range.find('-');
+		try {
+			const int first = std::stoi(range.substr(0, dash));
+			const int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+			for (int processor = first; processor <= last; ++processor) {
+				processors.push_back(processor);
+			}
+		}
+		catch (const std::exception&) {
+			// Blank or malformed entries (e.g. the empty list of a memory-only node) are skipped
+		}
+	}
+	return processors;
+}
+
+/**
+ * @brief Queries the NUMA nodes and their logical processors from the operating system.
+ *
+ * On Windows a processor is numbered group * 64 + bit of its processor group affinity.
+ * Nodes without processors are left out. If NUMA is not available, the result is a single node
+ * with every hardware thread.
+ *
+ * @return The topology, with at least one node of at least one processor.
+ */
+inline NumaTopology detect_numa_topology() {
+	NumaTopology topology;
+#ifdef _WIN32
+	ULONG highest_node = 0;
+	if (GetNumaHighestNodeNumber(&highest_node)) {
+		for (ULONG node = 0; node <= highest_node; ++node) {
+			GROUP_AFFINITY affinity = {};
+			if (!GetNumaNodeProcessorMaskEx(static_cast<USHORT>(node), &affinity)) {
+				continue;
+			}
+			std::vector<int> processors;
+			for (int bit = 0; bit < 64; ++bit) {
+				if (affinity.Mask & (static_cast<KAFFINITY>(1) << bit)) {
+					processors.push_back(affinity.Group * 64 + bit);
+				}
+			}
+			if (!processors.empty()) {
+				topology.node_processors.push_back(processors);
+			}
+		}
+	}
+#elif defined(__linux__)
+	std::ifstream online("/sys/devices/system/node/online");
+	std::string nodes;
+	if (online && std::getline(online, nodes)) {
+		for (int node : parse_cpu_list(nodes)) {
+			std::ifstream cpulist("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+			std::string list;
+			if (cpulist && std::getline(cpulist, list)) {
+				std::vector<int> processors = parse_cpu_list(list);
+				if (!processors.empty()) {
+					topology.node_processors.push_back(processors);
+				}
+			}
+		}
+	}
+#endif
+	if (topology.node_processors.empty()) {
+		const int count = static_cast<int>(std::max(std::thread::hardware_concurrency(), 1u));
+		topology.node_processors.emplace_back();
+		for (int processor = 0; processor < count; ++processor) {
+			topology.node_processors.back().push_back(processor);
+		}
+	}
+	return topology;
+}
+
+/**
+ * @brief Pins the calling thread to a logical processor.
+ * @param processor Logical processor as numbered by detect_numa_topology.
+ * @return True if the affinity was set, false if it failed or pinning is not supported.
+ */
+inline bool pin_current_thread(int processor) {
+#ifdef _WIN32
+	GROUP_AFFINITY affinity = {};
+	affinity.Group = static_cast<WORD>(processor / 64);
+	affinity.Mask = static_cast<KAFFINITY>(1) << (processor % 64);
+	return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0;
+#elif defined(__linux__)
+	if (processor >= CPU_SETSIZE) {
+		return false;
+	}
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(processor, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+	(void)processor;
+	return false;
+#endif
+}
+
+/**
+ * @brief Assignment of worker threads to NUMA nodes and logical processors.
+ *
+ * The threads are split over the nodes in proportion to their number of processors, consecutive threads
+ * share a node, so a solver handing consecutive row bands to consecutive threads keeps every band on one node.
+ * Within a node the threads take the processors in the listed order, which on most systems puts them on
+ * distinct physical cores before using the second hardware thread of a core.
+ */
+class ThreadPlacement {
+public:
+	/**
+	 * @param num_threads Number of worker threads, 0 for one per logical processor.
+	 * @param topology Topology to place the threads on.
+	 */
+	explicit ThreadPlacement(int num_threads, NumaTopology topology = detect_numa_topology())
+		: topology(std::move(topology)) {
+		const int total = this->topology.processors();
+		if (num_threads <= 0) {
+			num_threads = total;
+		}
+
+		int first_processor = 0;
+		for (int node = 0; node < static_cast<int>(this->topology.node_processors.size()); ++node) {
+			const std::vector<int>& processors = this->topology.node_processors[node];
+			const int first_thread = static_cast<int>(static_cast<long long>(num_threads) * first_processor / total);
+			first_processor += static_cast<int>(processors.size());
+			const int last_thread = static_cast<int>(static_cast<long long>(num_threads) * first_processor / total);
+			for (int thread = first_thread; thread < last_thread; ++thread) {
+				thread_nodes.push_back(node);
+				thread_processors.push_back(processors[(thread - first_thread) % processors.size()]);
+			}
+		}
+	}
+
+	/** @return Number of worker threads. */
+	int threads() const { return static_cast<int>(thread_processors.size()); }
+
+	/** @return NUMA node of a thread. */
+	int node(int thread) const { return thread_nodes[thread]; }
+
+	/** @return Logical processor of a thread. */
+	int processor(int thread) const { return thread_processors[thread]; }
+
+	/** @return Number of NUMA nodes. */
+	int nodes() const { return static_cast<int>(topology.node_processors.size()); }
+
+	/**
+	 * @brief Pins the calling thread to the processor of a worker thread.
+	 * @return True if the affinity was set.
+	 */
+	bool pin(int thread) const { return pin_current_thread(thread_processors[thread]); }
+
+	/**
+	 * @brief Describes the nodes, their processors and the threads placed on them.
+	 * @return One line per node, e.g. "node 0: processors 0-15, threads 0-7 on processors 0-7".
+	 */
+	std::string report() const {
+		std::ostringstream stream;
+		stream << "NUMA nodes: " << nodes() << ", threads: " << threads() << std::endl;
+		for (int node = 0; node < nodes(); ++node) {
+			stream << "  node " << node << ": processors " << format_list(topology.node_processors[node]);
+			std::vector<int> threads_on_node;
+			std::vector<int> processors_used;
+			for (int thread = 0; thread < threads(); ++thread) {
+				if (thread_nodes[thread] == node) {
+					threads_on_node.push_back(thread);
+					processors_used.push_back(thread_processors[thread]);
+				}
+			}
+			if (threads_on_node.empty()) {
+				stream << ", no threads" << std::endl;
+			}
+			else {
+				stream << ", threads " << format_list(threads_on_node) << " on processors " << format_list(processors_used) << std::endl;
+			}
+		}
+		return stream.str();
+	}
+
+private:
+	/** @brief Formats a list of numbers with ranges, e.g. "0-3,8". */
+	static std::string format_list(std::vector<int> values) {
+		std::sort(values.begin(), values.end());
+		std::ostringstream stream;
+		for (size_t i = 0; i < values.size();) {
+			size_t j = i;
+			while (j + 1 < values.size() && values[j + 1] <= values[j] + 1) {
+				++j;
+			}
+			stream << (i > 0 ? "," : "") << values[i];
+			if (values[j] != values[i]) {
+				stream << "-" << values[j];
+			}
+			i = j + 1;
+		}
+		return stream.str();
+	}
+
+	NumaTopology topology;
+	std::vector<int> thread_nodes;
+	std::vector<int> thread_processors;
+};
@@ -0,0 +1,325 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <cerrno>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @brief Hardware counter readings, either cumulative since the counters were opened or the difference of two readings.
+ */
+struct CounterValues {
+	double cycles = 0.0;
+	double instructions = 0.0;
+	/** Last level cache misses (the generic cache miss event, which the kernel maps to the LLC on x86). */
+	double llc_misses = 0.0;
+
+	CounterValues& operator+=(const CounterValues& other) {
+		cycles += other.cycles;
+		instructions += other.instructions;
+		llc_misses += other.llc_misses;
+		return *this;
+	}
+
+	CounterValues operator-(const CounterValues& other) const {
+		CounterValues difference = *this;
+		difference.cycles -= other.cycles;
+		difference.instructions -= other.instructions;
+		difference.llc_misses -= other.llc_misses;
+		return difference;
+	}
+};
+
+/**
+ * @brief Cycle, instruction and LLC miss counters of the calling thread (Linux perf_event_open).
+ *
+ * The three events are opened as one group, so they are scheduled on the PMU together and every reading
+ * covers the same interval. Kernel and hypervisor time is excluded. If the kernel multiplexes the group with
+ * other events, the readings are scaled by the fraction of the time it was running. Only the thread that
+ * constructs the counters is measured, threads it starts later are not.
+ *
+ * On other platforms, or if the kernel refuses the events (no PMU in a virtual machine, or
+ * /proc/sys/kernel/perf_event_paranoid too strict), the counters are unavailable and read zeros.
+ */
+class PerfCounters {
+public:
+	PerfCounters() {
+#ifdef __linux__
+		const uint64_t configs[event_count] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES };
+		for (int event = 0; event < event_count; ++event) {
+			perf_event_attr attr;
+			std::memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = configs[event];
+			attr.disabled = event == 0 ? 1 : 0;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+			const long fd = syscall(SYS_perf_event_open, &attr, 0, -1, event == 0 ? -1 : descriptors[0], 0);
+			if (fd < 0) {
+				error_message = std::string("perf_event_open failed: ") + std::strerror(errno);
+				close_all();
+				return;
+			}
+			descriptors[event] = static_cast<int>(fd);
+		}
+		ioctl(descriptors[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(descriptors[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#else
+		error_message = "hardware counters are only supported on Linux (perf_event_open)";
+#endif
+	}
+
+	~PerfCounters() {
+		close_all();
+	}
+
+	PerfCounters(const PerfCounters&) = delete;
+	PerfCounters& operator=(const PerfCounters&) = delete;
+
+	/** @return True if the counters are counting. */
+	bool available() const { return descriptors[0] >= 0; }
+
+	/** @return Why the counters are unavailable, empty if they are available. */
+	const std::string& error() const { return error_message; }
+
+	/** @return Counts since the counters were opened, zeros if they are unavailable. */
+	CounterValues read() const {
+		CounterValues values;
+#ifdef __linux__
+		if (!available()) {
+			return values;
+		}
+		// Layout of PERF_FORMAT_GROUP: number of events, time enabled, time running, one value per event
+		uint64_t buffer[3 + event_count] = {};
+		if (::read(descriptors[0], buffer, sizeof(buffer)) != static_cast<ssize_t>(sizeof(buffer)) || buffer[0] != event_count) {
+			return values;
+		}
+		const double scale = buffer[2] > 0 ? static_cast<double>(buffer[1]) / static_cast<double>(buffer[2]) : 0.0;
+		values.cycles = static_cast<double>(buffer[3]) * scale;
+		values.instructions = static_cast<double>(buffer[4]) * scale;
+		values.llc_misses = static_cast<double>(buffer[5]) * scale;
+#endif
+		return values;
+	}
+
+private:
+	static const int event_count = 3;
+
+	void close_all() {
+#ifdef __linux__
+		for (int event = event_count - 1; event >= 0; --event) {
+			if (descriptors[event] >= 0) {
+				close(descriptors[event]);
+				descriptors[event] = -1;
+			}
+		}
+#endif
+	}
+
+	int descriptors[event_count] = { -1, -1, -1 };
+	std::string error_message;
+};
+
+/**
+ * @brief Measures the memory bandwidth a single thread achieves, the ceiling of the roofline summary.
+ *
+ * Runs the STREAM triad a = b + s * c over arrays far larger than the last level cache and counts 12 bytes
+ * per element like STREAM (the write-allocate read of a is not counted). The solvers profiled by
+ * SolverProfiler run on one thread, so this, not the bandwidth of all cores, is the ceiling they can reach.
+ *
+ * @param megabytes Total size of the three arrays (default: 384).
+ * @param repeats Number of runs, the fastest one counts (default: 4).
+ * @return Bandwidth in GB/s.
+ */
+inline double measure_memory_bandwidth(size_t megabytes = 384, int repeats = 4) {
+	const size_t size = std::max<size_t>(megabytes * 1024 * 1024 / (3 * sizeof(float)), 1);
+	std::vector<float> a(size, 0.0f), b(size, 1.0f), c(size, 2.0f);
+	double best_seconds = 0.0;
+	for (int repeat = 0; repeat < repeats; ++repeat) {
+		const float scalar = 0.5f + static_cast<float>(repeat);
+		const auto start = std::chrono::steady_clock::now();
+		for (size_t k = 0; k < size; ++k) {
+			a[k] = b[k] + scalar * c[k];
+		}
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (repeat == 0 || seconds < best_seconds) {
+			best_seconds = seconds;
+		}
+	}
+	// Keeps the stores from being optimized away
+	volatile float sink = a[size / 2];
+	(void)sink;
+	return best_seconds > 0.0 ? 3.0 * sizeof(float) * size / best_seconds * 1e-9 : 0.0;
+}
+
+/**
+ * @brief Per-phase wall-clock time, hardware counters and modeled traffic of a solver, with a roofline summary.
+ *
+ * A solver wraps every phase of its iteration in a SolverProfiler::Phase, naming the phase and stating the bytes
+ * it has to move and the floating-point operations it performs. The byte count is a model of the compulsory
+ * traffic (every array the phase reads or writes streamed once), the LLC misses show how close the actual
+ * traffic comes to it. Phases with the same name are accumulated, so a profiler can be passed to several solves.
+ */
+class SolverProfiler {
+public:
+	/**
+	 * @brief Measures one execution of a phase from construction to destruction.
+	 *
+	 * Does nothing if the profiler is nullptr, so a solver can construct it unconditionally.
+	 */
+	class Phase {
+	public:
+		Phase(SolverProfiler* profiler, const char* name, double bytes, double flops)
+			: profiler(profiler), name(name), bytes(bytes), flops(flops) {
+			if (profiler) {
+				start_counters = profiler->counters.read();
+				start_time = std::chrono::steady_clock::now();
+			}
+		}
+
+		~Phase() {
+			if (profiler) {
+				const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+				profiler->record(name, seconds, profiler->counters.read() - start_counters, bytes, flops);
+			}
+		}
+
+		Phase(const Phase&) = delete;
+		Phase& operator=(const Phase&) = delete;
+
+	private:
+		SolverProfiler* profiler;
+		const char* name;
+		double bytes;
+		double flops;
+		CounterValues start_counters;
+		std::chrono::steady_clock::time_point start_time;
+	};
+
+	/** @brief Accumulated measurements of a phase. */
+	struct PhaseTotals {
+		std::string name;
+		long long calls = 0;
+		double seconds = 0.0;
+		CounterValues counters;
+		double bytes = 0.0;
+		double flops = 0.0;
+	};
+
+	/** @return True if the hardware counters are available, otherwise only times and modeled traffic are reported. */
+	bool counters_available() const { return counters.available(); }
+
+	/** @return The accumulated phases in the order they were first measured. */
+	const std::vector<PhaseTotals>& phases() const { return totals; }
+
+	/**
+	 * @brief Formats the per-iteration measurements of every phase and the roofline summary.
+	 *
+	 * Per iteration means per execution of the phase. The roofline compares every phase with the bandwidth
+	 * ceiling: at an arithmetic intensity of I flop/byte a memory-bound kernel reaches at most I * bandwidth
+	 * GFLOP/s. The TV iterations do a few flops per 4-byte value, far below the ridge point of any current CPU,
+	 * so the bandwidth ceiling is the one that applies and the fraction of it shows how much is left to gain.
+	 *
+	 * @param bandwidth_gbs Memory bandwidth ceiling in GB/s, 0 measures it with measure_memory_bandwidth (default: 0).
+	 * @return The report, one line per phase in each of the two tables.
+	 */
+	std::string report(double bandwidth_gbs = 0.0) const {
+		if (bandwidth_gbs <= 0.0) {
+			bandwidth_gbs = measure_memory_bandwidth();
+		}
+
+		std::ostringstream stream;
+		stream << std::fixed;
+		if (!counters_available()) {
+			stream << "Hardware counters unavailable (" << counters.error() << "), reporting times and modeled traffic only" << std::endl;
+		}
+
+		stream << std::left << std::setw(20) << "Phase" << std::right
+			<< std::setw(8) << "calls" << std::setw(12) << "ms/iter"
+			<< std::setw(14) << "cycles/iter" << std::setw(14) << "instr/iter" << std::setw(7) << "IPC"
+			<< std::setw(14) << "LLC miss/iter" << std::setw(12) << "MB/iter" << std::setw(11) << "miss/model"
+			<< std::setw(11) << "flop/byte" << std::endl;
+		for (const PhaseTotals& phase : totals) {
+			const double calls = static_cast<double>(phase.calls);
+			stream << std::left << std::setw(20) << phase.name << std::right
+				<< std::setw(8) << phase.calls << std::setw(12) << std::setprecision(3) << 1e3 * phase.seconds / calls;
+			if (counters_available()) {
+				const double miss_bytes = cache_line_bytes * phase.counters.llc_misses;
+				stream << std::setw(14) << std::setprecision(0) << phase.counters.cycles / calls
+					<< std::setw(14) << phase.counters.instructions / calls
+					<< std::setw(7) << std::setprecision(2) << ratio(phase.counters.instructions, phase.counters.cycles)
+					<< std::setw(14) << std::setprecision(0) << phase.counters.llc_misses / calls;
+				stream << std::setw(12) << std::setprecision(2) << 1e-6 * phase.bytes / calls
+					<< std::setw(11) << ratio(miss_bytes, phase.bytes);
+			}
+			else {
+				stream << std::setw(14) << "-" << std::setw(14) << "-" << std::setw(7) << "-" << std::setw(14) << "-"
+					<< std::setw(12) << std::setprecision(2) << 1e-6 * phase.bytes / calls << std::setw(11) << "-";
+			}
+			stream << std::setw(11) << std::setprecision(3) << ratio(phase.flops, phase.bytes) << std::endl;
+		}
+
+		stream << "Roofline (single-thread bandwidth ceiling " << std::setprecision(2) << bandwidth_gbs << " GB/s, "
+			<< static_cast<int>(cache_line_bytes) << "-byte lines per LLC miss)" << std::endl;
+		stream << std::left << std::setw(20) << "Phase" << std::right
+			<< std::setw(11) << "flop/byte" << std::setw(12) << "GFLOP/s" << std::setw(12) << "roof" << std::setw(11) << "of roof"
+			<< std::setw(12) << "GB/s" << std::setw(14) << "miss GB/s" << std::endl;
+		for (const PhaseTotals& phase : totals) {
+			const double intensity = ratio(phase.flops, phase.bytes);
+			const double gflops = 1e-9 * ratio(phase.flops, phase.seconds);
+			const double roof = intensity * bandwidth_gbs;
+			stream << std::left << std::setw(20) << phase.name << std::right
+				<< std::setw(11) << std::setprecision(3) << intensity
+				<< std::setw(12) << gflops << std::setw(12) << roof
+				<< std::setw(10) << std::setprecision(1) << 100.0 * ratio(gflops, roof) << "%"
+				<< std::setw(12) << std::setprecision(2) << 1e-9 * ratio(phase.bytes, phase.seconds);
+			if (counters_available()) {
+				stream << std::setw(14) << 1e-9 * ratio(cache_line_bytes * phase.counters.llc_misses, phase.seconds);
+			}
+			else {
+				stream << std::setw(14) << "-";
+			}
+			stream << std::endl;
+		}
+		return stream.str();
+	}
+
+private:
+	static constexpr double cache_line_bytes = 64.0;
+
+	/** @brief Quotient that is 0 instead of undefined for an empty denominator. */
+	static double ratio(double numerator, double denominator) {
+		return denominator > 0.0 ? numerator / denominator : 0.0;
+	}
+
+	void record(const char* name, double seconds, const CounterValues& delta, double bytes, double flops) {
+		auto phase = std::find_if(totals.begin(), totals.end(), [&](const PhaseTotals& entry) { return entry.name == name; });
+		if (phase == totals.end()) {
+			totals.emplace_back();
+			totals.back().name = name;
+			phase = totals.end() - 1;
+		}
+		++phase->calls;
+		phase->seconds += seconds;
+		phase->counters += delta;
+		phase->bytes += bytes;
+		phase->flops += flops;
+	}
+
+	PerfCounters counters;
+	std::vector<PhaseTotals> totals;
+};
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include "../Image/Image.h"
+
+/**
+ * @brief Flag to stop a running solve from another thread (see ProgressOptions).
+ *
+ * The solvers check it once per iteration (once per chunk for the device-resident GPU solver)
+ * and return their current iterate when it is set.
+ */
+class CancellationToken {
+public:
+	/** Requests the solve to stop. */
+	void cancel() { cancelled.store(true, std::memory_order_relaxed); }
+
+	/** Allows the token to be reused for another solve. */
+	void reset() { cancelled.store(false, std::memory_order_relaxed); }
+
+	/** @return True if cancel was called. */
+	bool is_cancelled() const { return cancelled.load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<bool> cancelled{ false };
+};
+
+/**
+ * @brief State of a running solve passed to the progress callback.
+ */
+struct DenoisingProgress {
+	/** Iteration the image belongs to. */
+	int iteration;
+	/** Loss of the last convergence check. */
+	float loss;
+	/** Current iterate on the CPU, a downsampled copy of it on the GPU. Only valid during the callback. */
+	const Image& image;
+};
+
+/**
+ * @brief Called by the solvers with the current state of the solve, runs on the thread of the solve.
+ */
+using ProgressCallback = std::function<void(const DenoisingProgress&)>;
+
+/**
+ * @brief Progress reporting and cancellation of a solve.
+ *
+ * The callback is invoked when interval_iterations iterations or interval_milliseconds milliseconds have passed
+ * since the previous call, whichever comes first (only the given intervals count, at every check if none is given).
+ */
+struct ProgressOptions {
+	/** Progress callback, may be empty to only use the cancellation. */
+	ProgressCallback callback;
+	/** Iterations between two calls, 0 to not report by iterations. */
+	int interval_iterations = 0;
+	/** Milliseconds between two calls, 0 to not report by time. */
+	int interval_milliseconds = 0;
+	/** Optional cancellation token, has to outlive the solve. */
+	const CancellationToken* cancellation = nullptr;
+	/** Side of the pixel blocks averaged into a pixel of the GPU preview. */
+	int preview_factor = 4;
+};
+
+/**
+ * @brief Decides when the progress callback of a solve is due.
+ */
+class ProgressSchedule {
+public:
+	/**
+	 * @param options Progress options of the solve, nullptr disables reporting and cancellation.
+	 */
+	explicit ProgressSchedule(const ProgressOptions* options)
+		: options(options && (options->callback || options->cancellation) ? options : nullptr),
+		  last_iteration(0), last_time(std::chrono::steady_clock::now()) {
+	}
+
+	/** @return True if the solve has to stop. */
+	bool cancelled() const {
+		return options && options->cancellation && options->cancellation->is_cancelled();
+	}
+
+	/**
+	 * @brief Checks whether the callback is due, and if so restarts both intervals.
+	 * @param iteration Current iteration.
+	 * @return True if the callback has to be invoked now.
+	 */
+	bool due(int iteration) {
+		if (!options || !options->callback) {
+			return false;
+		}
+
+		const auto now = std::chrono::steady_clock::now();
+		const bool by_iterations = options->interval_iterations > 0 && iteration - last_iteration >= options->interval_iterations;
+		const bool by_time = options->interval_milliseconds > 0 &&
+			now - last_time >= std::chrono::milliseconds(options->interval_milliseconds);
+		const bool every_check = options->interval_iterations <= 0 && options->interval_milliseconds <= 0;
+
+		if (!(by_iterations || by_time || every_check)) {
+			return false;
+		}
+		last_iteration = iteration;
+		last_time = now;
+		return true;
+	}
+
+	/** @brief Invokes the callback. */
+	void report(int iteration, float loss, const Image& image) const {
+		options->callback(DenoisingProgress{ iteration, loss, image });
+	}
+
+private:
+	const ProgressOptions* options;
+	int last_iteration;
+	std::chrono::steady_clock::time_point last_time;
+};
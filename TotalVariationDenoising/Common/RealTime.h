@@ -0,0 +1,327 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "../Image/Image.h"
+
+/**
+ * @brief Iteration and time budget of a single solve, and how the solve ended (see the real-time overloads of the solvers).
+ *
+ * Within a budget a solver stops at the first of: convergence, max_iterations iterations, or the last convergence
+ * check after which the next check would end past the deadline. It returns the checked iterate with the lowest loss,
+ * so a solve cut short by the deadline never returns an iterate its momentum has just pushed uphill.
+ */
+struct SolveBudget {
+	/** Largest number of iterations (updates of the iterate), 0 for no limit. */
+	int max_iterations = 0;
+	/** Time the solve has to end by, no limit by default. */
+	std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+
+	/** Set by the solver: number of iterations performed. */
+	int iterations = 0;
+	/** Set by the solver: loss of the returned iterate. */
+	float loss = 0.0f;
+	/** Set by the solver: true if the convergence test passed. */
+	bool converged = false;
+	/** Set by the solver: true if it stopped because of max_iterations or the deadline. */
+	bool exhausted = false;
+};
+
+/**
+ * @brief Averages factor x factor pixel blocks (partial blocks at the bottom and right border).
+ */
+inline Image downsample_image(const Image& image, int factor) {
+	const int rows = image.getRows();
+	const int cols = image.getCols();
+	const int coarse_rows = (rows + factor - 1) / factor;
+	const int coarse_cols = (cols + factor - 1) / factor;
+	Image coarse(coarse_rows, coarse_cols);
+	for (int i = 0; i < coarse_rows; ++i) {
+		const int i1 = std::min((i + 1) * factor, rows);
+		for (int j = 0; j < coarse_cols; ++j) {
+			const int j1 = std::min((j + 1) * factor, cols);
+			float sum = 0.0f;
+			for (int y = i * factor; y < i1; ++y) {
+				for (int x = j * factor; x < j1; ++x) {
+					sum += image(y, x);
+				}
+			}
+			coarse(i, j) = sum / static_cast<float>((i1 - i * factor) * (j1 - j * factor));
+		}
+	}
+	return coarse;
+}
+
+/**
+ * @brief Bilinear interpolation of a downsampled image back to rows x cols, aligned on the pixel centers.
+ */
+inline Image upsample_image(const Image& coarse, int rows, int cols) {
+	const int coarse_rows = coarse.getRows();
+	const int coarse_cols = coarse.getCols();
+	const float scale_y = static_cast<float>(coarse_rows) / rows;
+	const float scale_x = static_cast<float>(coarse_cols) / cols;
+
+	// Interpolation positions and weights of the columns are the same in every row
+	std::vector<int> x0(cols), x1(cols);
+	std::vector<float> wx(cols);
+	for (int j = 0; j < cols; ++j) {
+		const float x = std::min(std::max((j + 0.5f) * scale_x - 0.5f, 0.0f), static_cast<float>(coarse_cols - 1));
+		x0[j] = static_cast<int>(x);
+		x1[j] = std::min(x0[j] + 1, coarse_cols - 1);
+		wx[j] = x - x0[j];
+	}
+
+	Image fine(rows, cols);
+	for (int i = 0; i < rows; ++i) {
+		const float y = std::min(std::max((i + 0.5f) * scale_y - 0.5f, 0.0f), static_cast<float>(coarse_rows - 1));
+		const int y0 = static_cast<int>(y);
+		const int y1 = std::min(y0 + 1, coarse_rows - 1);
+		const float wy = y - y0;
+		for (int j = 0; j < cols; ++j) {
+			const float top = coarse(y0, x0[j]) + wx[j] * (coarse(y0, x1[j]) - coarse(y0, x0[j]));
+			const float bottom = coarse(y1, x0[j]) + wx[j] * (coarse(y1, x1[j]) - coarse(y1, x0[j]));
+			fine(i, j) = top + wy * (bottom - top);
+		}
+	}
+	return fine;
+}
+
+/**
+ * @brief Options of RealTimeDenoiser.
+ */
+struct RealTimeOptions {
+	/** Latency budget of a frame in milliseconds, 0 for none (only the iteration budget). */
+	double deadline_ms = 30.0;
+	/** Largest number of iterations per frame, 0 for no limit (only the deadline). */
+	int max_iterations = 0;
+	/** First frames solved at full resolution until the deadline, to measure the cost of an iteration. */
+	int calibration_frames = 3;
+	/** Fewest iterations worth running at a resolution level, if they do not fit the next coarser level is used. */
+	int min_iterations = 10;
+	/** Number of coarser levels that may be used, every level halves the width and the height. */
+	int max_level = 2;
+	/** Fraction of the deadline the solve is planned and cut off for, the rest absorbs the jitter of the iterations. */
+	double planning_margin = 0.85;
+	/** If true, a frame starts from the result of the previous frame instead of the noisy frame. */
+	bool warm_start = true;
+};
+
+/**
+ * @brief Measurements of one frame of RealTimeDenoiser.
+ */
+struct FrameStats {
+	/** Time from the call of denoise until its result was ready. */
+	double latency_ms = 0.0;
+	/** Part of the latency spent in the solver. */
+	double solve_ms = 0.0;
+	/** Resolution level the frame was solved at, 0 is the full resolution. */
+	int level = 0;
+	int iterations = 0;
+	/** Loss of the returned iterate at its resolution level. */
+	float loss = 0.0f;
+	bool converged = false;
+	/** True if the latency exceeded the deadline. */
+	bool missed = false;
+};
+
+/**
+ * @brief Solver of one frame within a budget: the frame (at the planned resolution), the initial iterate,
+ *        the strength for that resolution, and the budget to respect and fill in.
+ */
+using BudgetedSolver = std::function<Image(const Image& frame, const Image& initial, float strength, SolveBudget& budget)>;
+
+/**
+ * @brief Denoises a stream of frames with a bounded latency per frame.
+ *
+ * The first calibration_frames frames are solved at full resolution until the deadline, which measures the cost of
+ * an iteration. From then on every frame is planned: the finest resolution level at which at least min_iterations
+ * iterations fit into planning_margin of the deadline (the cost of a level that has not run yet is extrapolated
+ * from the full resolution, a quarter per level), and as many iterations as fit there. The solver still cuts the
+ * solve off at the deadline and returns its best iterate, so a slow frame costs accuracy and not the deadline. A frame
+ * solved at a coarser level is upsampled to the frame size. The strength is divided by the downsampling factor,
+ * which keeps the TV and the L2 term in the same proportion as at full resolution.
+ *
+ * Consecutive frames of a live stream differ little, so every frame is warm-started from the result of the previous
+ * one and usually only has to correct it by a few iterations.
+ */
+class RealTimeDenoiser {
+public:
+	/**
+	 * @param solver Solver of a frame within a budget, e.g. binding tv_denoise_gradient_descent with a SolveBudget.
+	 * @param strength Weight of the TV term at full resolution.
+	 * @param options Deadline, iteration budget and planning options.
+	 * @throws std::invalid_argument if neither a deadline nor an iteration budget is given.
+	 */
+	RealTimeDenoiser(BudgetedSolver solver, float strength, RealTimeOptions options = RealTimeOptions())
+		: solver(std::move(solver)), strength(strength), options(options),
+		  iteration_ms(options.max_level + 1, 0.0), upsample_ms(options.max_level + 1, 0.0) {
+		if (options.deadline_ms <= 0.0 && options.max_iterations <= 0) {
+			throw std::invalid_argument("A real-time solve needs a deadline or an iteration budget.");
+		}
+		if (options.max_level < 0 || options.planning_margin <= 0.0 || options.planning_margin > 1.0) {
+			throw std::invalid_argument("Invalid real-time options: the level must not be negative and the margin in (0, 1].");
+		}
+	}
+
+	/**
+	 * @brief Denoises the next frame of the stream.
+	 * @param frame Noisy frame, frames of a different size than the previous one are not warm-started.
+	 * @return The denoised frame, of the size of the input.
+	 */
+	Image denoise(const Image& frame) {
+		const auto start = std::chrono::steady_clock::now();
+		const int level = plan_level();
+		const int factor = 1 << level;
+
+		Image level_frame = factor > 1 ? downsample_image(frame, factor) : frame;
+		const bool warm = options.warm_start && previous.getRows() == frame.getRows() && previous.getCols() == frame.getCols();
+		Image initial = !warm ? level_frame : factor > 1 ? downsample_image(previous, factor) : previous;
+
+		SolveBudget budget;
+		budget.max_iterations = planned_iterations(level);
+		if (options.deadline_ms > 0.0) {
+			const double solve_ms = options.deadline_ms * options.planning_margin - upsample_ms[level];
+			budget.deadline = start + std::chrono::microseconds(static_cast<long long>(1e3 * std::max(solve_ms, 0.0)));
+		}
+
+		const auto solve_start = std::chrono::steady_clock::now();
+		Image result = solver(level_frame, initial, strength / factor, budget);
+		const auto solve_end = std::chrono::steady_clock::now();
+		if (factor > 1) {
+			Image upsampled = upsample_image(result, frame.getRows(), frame.getCols());
+			result.swap(upsampled);
+		}
+		const auto end = std::chrono::steady_clock::now();
+
+		FrameStats stats;
+		stats.latency_ms = std::chrono::duration<double, std::milli>(end - start).count();
+		stats.solve_ms = std::chrono::duration<double, std::milli>(solve_end - solve_start).count();
+		stats.level = level;
+		stats.iterations = budget.iterations;
+		stats.loss = budget.loss;
+		stats.converged = budget.converged;
+		stats.missed = options.deadline_ms > 0.0 && stats.latency_ms > options.deadline_ms;
+		frames.push_back(stats);
+
+		// The cost of an iteration includes the fixed cost of the solve, which errs on the side of fewer iterations.
+		// A solve that did not fit a single iteration counts as one, so the next frames move to a coarser level.
+		update_average(iteration_ms[level], stats.solve_ms / std::max(budget.iterations, 1));
+		update_average(upsample_ms[level], std::chrono::duration<double, std::milli>(end - solve_end).count());
+
+		previous = result;
+		return result;
+	}
+
+	/** @return The measurements of every frame so far. */
+	const std::vector<FrameStats>& frame_stats() const { return frames; }
+
+	/**
+	 * @brief Latency percentile of the frames so far (nearest rank).
+	 * @param percent Percentile in [0, 100].
+	 * @return The latency in milliseconds, 0 if no frame was denoised.
+	 */
+	double latency_percentile(double percent) const {
+		if (frames.empty()) {
+			return 0.0;
+		}
+		std::vector<double> latencies;
+		for (const FrameStats& stats : frames) {
+			latencies.push_back(stats.latency_ms);
+		}
+		std::sort(latencies.begin(), latencies.end());
+		const size_t rank = static_cast<size_t>(std::ceil(percent / 100.0 * latencies.size()));
+		return latencies[std::min(std::max(rank, static_cast<size_t>(1)), latencies.size()) - 1];
+	}
+
+	/** @return Number of frames whose latency exceeded the deadline. */
+	int deadline_misses() const {
+		return static_cast<int>(std::count_if(frames.begin(), frames.end(), [](const FrameStats& stats) { return stats.missed; }));
+	}
+
+	/**
+	 * @brief Summarizes the frames so far: deadline misses, latency percentiles and the use of the resolution levels.
+	 */
+	std::string report() const {
+		std::ostringstream stream;
+		stream << std::fixed << std::setprecision(2);
+		stream << "Frames: " << frames.size();
+		if (options.deadline_ms > 0.0) {
+			const int misses = deadline_misses();
+			stream << ", deadline " << options.deadline_ms << " ms, misses: " << misses
+				<< " (" << (frames.empty() ? 0.0 : 100.0 * misses / frames.size()) << "%)";
+		}
+		stream << std::endl;
+		stream << "Latency: p50 " << latency_percentile(50) << " ms, p90 " << latency_percentile(90)
+			<< " ms, p99 " << latency_percentile(99) << " ms, max " << latency_percentile(100) << " ms" << std::endl;
+		for (int level = 0; level <= options.max_level; ++level) {
+			int count = 0;
+			int converged = 0;
+			long long iterations = 0;
+			for (const FrameStats& stats : frames) {
+				if (stats.level == level) {
+					++count;
+					converged += stats.converged ? 1 : 0;
+					iterations += stats.iterations;
+				}
+			}
+			if (count > 0) {
+				stream << "Level " << level << " (1/" << (1 << level) << " resolution): " << count << " frames, "
+					<< static_cast<double>(iterations) / count << " iterations on average, " << converged << " converged" << std::endl;
+			}
+		}
+		return stream.str();
+	}
+
+private:
+	/** @brief Exponential moving average of the costs, the first measurement replaces the unknown 0. */
+	static void update_average(double& average, double value) {
+		average = average > 0.0 ? 0.75 * average + 0.25 * value : value;
+	}
+
+	/** @return Estimated milliseconds of an iteration at a level, 0 if nothing has been measured yet. */
+	double estimated_iteration_ms(int level) const {
+		return iteration_ms[level] > 0.0 ? iteration_ms[level] : iteration_ms[0] / std::pow(4.0, level);
+	}
+
+	/** @return Number of iterations that fit the deadline at a level, the iteration budget if it is smaller. */
+	int planned_iterations(int level) const {
+		int iterations = options.max_iterations;
+		const double cost = estimated_iteration_ms(level);
+		if (options.deadline_ms > 0.0 && cost > 0.0) {
+			const double available = options.deadline_ms * options.planning_margin - upsample_ms[level];
+			const int fit = static_cast<int>(std::max(available, 0.0) / cost);
+			iterations = iterations > 0 ? std::min(iterations, fit) : fit;
+		}
+		return std::max(iterations, options.max_iterations > 0 || cost > 0.0 ? 1 : 0);
+	}
+
+	/** @return The finest level at which enough iterations fit, the coarsest level if none does. */
+	int plan_level() const {
+		if (options.deadline_ms <= 0.0 || static_cast<int>(frames.size()) < options.calibration_frames || iteration_ms[0] <= 0.0) {
+			return 0;
+		}
+		const int wanted = options.max_iterations > 0 ? std::min(options.min_iterations, options.max_iterations) : options.min_iterations;
+		for (int level = 0; level < options.max_level; ++level) {
+			if (planned_iterations(level) >= wanted) {
+				return level;
+			}
+		}
+		return options.max_level;
+	}
+
+	BudgetedSolver solver;
+	float strength;
+	RealTimeOptions options;
+	/** Measured milliseconds per iteration and for the upsampling of every level, 0 while unknown. */
+	std::vector<double> iteration_ms;
+	std::vector<double> upsample_ms;
+	Image previous;
+	std::vector<FrameStats> frames;
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * @brief Sum of floating-point values whose result does not depend on the order of the additions.
+ *
+ * Every value is rounded to a multiple of 2^-32 and accumulated as a 64-bit integer. Integer addition is
+ * associative, so partial sums over any blocking (rows, tiles, threads or OpenCL work-groups) combine to a
+ * bit-identical total, where a float accumulator only reproduces its result for one fixed order. The solvers
+ * compare ratios of these sums to decide when to stop, so with an order-dependent sum the number of threads
+ * or the tile size could change the iteration the solve stops at, and with it the output image.
+ *
+ * The rounding is exact for values of at least 2^-8 (a float has 24 significant bits), smaller values are
+ * rounded by at most 2^-33, far below the resolution of the float loss the sum ends up in. Single values
+ * must stay below 2^19 and the sum below 2^31 (about a billion pixels of an image in [0, 1]).
+ * The OpenCL kernels round with the same scale (to_fixed in Denoising.cl), so their partial sums can be
+ * added to the ones computed here.
+ */
+class ReproducibleSum {
+public:
+	/** @brief Rounds a value to the nearest multiple of 2^-32 (ties to even), in units of 2^-32. */
+	static int64_t to_fixed(double value) {
+		// Adding and subtracting 1.5 * 2^52 rounds to an integer in the current (nearest) rounding mode,
+		// which compiles to plain additions instead of a call to llrint
+		const double round = 6755399441055744.0;
+		return static_cast<int64_t>((value * 4294967296.0 + round) - round);
+	}
+
+	/** @brief Converts a sum in units of 2^-32 to a value. */
+	static double from_fixed(int64_t fixed) {
+		return static_cast<double>(fixed) / 4294967296.0;
+	}
+
+	ReproducibleSum& operator+=(double value) {
+		fixed += to_fixed(value);
+		return *this;
+	}
+
+	ReproducibleSum& operator+=(const ReproducibleSum& other) {
+		fixed += other.fixed;
+		return *this;
+	}
+
+	/** @brief Adds a partial sum in units of 2^-32, e.g. one computed by a kernel. */
+	void add_fixed(int64_t partial) {
+		fixed += partial;
+	}
+
+	/** @return The sum. */
+	double value() const {
+		return from_fixed(fixed);
+	}
+
+	/** @return The sum in units of 2^-32. */
+	int64_t fixed_value() const {
+		return fixed;
+	}
+
+private:
+	int64_t fixed = 0;
+};
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include "../Image/Image.h"
+
+/**
+ * @brief Noise model of add_noise.
+ */
+enum class NoiseType {
+	/** Additive white Gaussian noise with standard deviation level. */
+	Gaussian,
+	/** Shot noise: a pixel of value v becomes Poisson(level * v) / level, level is the photon count of white. */
+	Poisson
+};
+
+/**
+ * @brief Source of random numbers seeded for reproducible noise.
+ *
+ * The engine output of std::mt19937 is fixed by the standard, the std distributions are not,
+ * so the samples are derived from the engine output here. The uniform samples are the same with every
+ * standard library. The normal and Poisson samples go through std::log, std::sin, std::cos and std::exp,
+ * which are not correctly rounded, so they may differ in the last bits between math libraries.
+ */
+class SeededNoise {
+public:
+	explicit SeededNoise(uint32_t seed) : engine(seed) {
+	}
+
+	/** @return Uniform sample in (0, 1). */
+	double uniform() {
+		return (static_cast<double>(engine()) + 0.5) / 4294967296.0;
+	}
+
+	/** @return Standard normal sample (Box-Muller). */
+	double normal() {
+		if (has_spare) {
+			has_spare = false;
+			return spare;
+		}
+		const double radius = std::sqrt(-2.0 * std::log(uniform()));
+		const double angle = 6.283185307179586 * uniform();
+		spare = radius * std::sin(angle);
+		has_spare = true;
+		return radius * std::cos(angle);
+	}
+
+	/**
+	 * @return Poisson sample with the given mean, exact below a mean of 64 (Knuth's method)
+	 *         and rounded from the normal approximation above.
+	 */
+	double poisson(double mean) {
+		if (mean <= 0.0) {
+			return 0.0;
+		}
+		if (mean >= 64.0) {
+			const double sample = std::floor(mean + std::sqrt(mean) * normal() + 0.5);
+			return sample > 0.0 ? sample : 0.0;
+		}
+		const double limit = std::exp(-mean);
+		double product = uniform();
+		int count = 0;
+		while (product > limit) {
+			product *= uniform();
+			++count;
+		}
+		return count;
+	}
+
+private:
+	std::mt19937 engine;
+	double spare = 0.0;
+	bool has_spare = false;
+};
+
+/**
+ * @brief Draws a synthetic test image in [0, 1] with the structures TV denoising is judged on.
+ *
+ * A horizontal ramp as background (smooth gradients, which TV turns into staircases), a bright rectangle and a
+ * dark disk (straight and curved edges), and a patch of thin stripes of decreasing width (fine detail
+ * that too strong a regularization wipes out).
+ *
+ * @param rows Number of rows.
+ * @param cols Number of columns.
+ * @return The clean image.
+ */
+inline Image make_test_pattern(int rows, int cols) {
+	if (rows < 1 || cols < 1) {
+		throw std::invalid_argument("Test pattern size must be positive.");
+	}
+
+	Image image(rows, cols);
+	const float radius = 0.2f * static_cast<float>(rows < cols ? rows : cols);
+	for (int i = 0; i < rows; ++i) {
+		for (int j = 0; j < cols; ++j) {
+			float value = 0.2f + 0.3f * static_cast<float>(j) / static_cast<float>(cols);
+			if (i >= rows / 8 && i < rows / 2 && j >= cols / 8 && j < cols / 2) {
+				value = 0.85f;
+			}
+			const float di = static_cast<float>(i) - 0.65f * rows;
+			const float dj = static_cast<float>(j) - 0.3f * cols;
+			if (di * di + dj * dj < radius * radius) {
+				value = 0.1f;
+			}
+			if (i >= rows / 8 && i < rows / 2 && j >= (5 * cols) / 8 && j < (7 * cols) / 8) {
+				// Stripe width halves every quarter of the patch height
+				const int band = 4 * (i - rows / 8) / (rows / 2 - rows / 8 > 0 ? rows / 2 - rows / 8 : 1);
+				const int width = 8 >> band;
+				value = ((j / (width > 0 ? width : 1)) % 2) ? 0.75f : 0.35f;
+			}
+			image(i, j) = value;
+		}
+	}
+	return image;
+}
+
+/**
+ * @brief Adds seeded noise to an image in memory (without the rounding to 8 bits of an image file).
+ *
+ * The same seed gives the same noise with the same math library (see SeededNoise). The values are
+ * not clipped to [0, 1], so the noise stays zero-mean near black and white.
+ *
+ * @param clean Image to add the noise to.
+ * @param type Noise model.
+ * @param level Standard deviation for Gaussian noise, photon count of white for Poisson noise.
+ * @param seed Seed of the random numbers.
+ * @return The noisy image.
+ */
+inline Image add_noise(const Image& clean, NoiseType type, float level, uint32_t seed) {
+	if (!(level > 0.0f)) {
+		throw std::invalid_argument("Noise level must be positive.");
+	}
+
+	SeededNoise noise(seed);
+	Image noisy(clean.getRows(), clean.getCols());
+	const size_t size = static_cast<size_t>(clean.getRows()) * clean.getCols();
+	const float* input = clean.data();
+	float* output = noisy.data();
+	for (size_t k = 0; k < size; ++k) {
+		if (type == NoiseType::Gaussian) {
+			output[k] = input[k] + level * static_cast<float>(noise.normal());
+		}
+		else {
+			output[k] = static_cast<float>(noise.poisson(static_cast<double>(level) * input[k]) / level);
+		}
+	}
+	return noisy;
+}
+
+/**
+ * @brief Parses the name of a noise model ("gaussian" or "poisson").
+ * @throws std::invalid_argument for other names.
+ */
+inline NoiseType parse_noise_type(const std::string& name) {
+	if (name == "gaussian") {
+		return NoiseType::Gaussian;
+	}
+	if (name == "poisson") {
+		return NoiseType::Poisson;
+	}
+	throw std::invalid_argument("Unknown noise type: " + name + " (expected gaussian or poisson)");
+}
@@ -12,6 +12,33 @@ __kernel void sum_float(__global float* data, int offset)
     data[idx] += data[right_idx];
 }
 
+// Tile and block losses are summed in fixed point, in units of 2^-32 (see ReproducibleSum in Common/Reduction.h).
+// Integer additions are associative, so the sums do not depend on the tile, block or work-group size.
+#define FIXED_POINT_SCALE 4294967296.0f
+
+long to_fixed(float value)
+{
+    return convert_long_rte(value * FIXED_POINT_SCALE);
+}
+
+float from_fixed(long fixed)
+{
+    return convert_float(fixed) * (1.0f / FIXED_POINT_SCALE);
+}
+
+// Convergence test on the debiased smoothed loss, the same as loss_converged in Common/Convergence.h:
+// a warm-started solve is only tested after the smoothed loss averages 1 / (1 - beta) iterations,
+// and only on a loss at or below its average
+#define SMOOTHED_LOSS_WINDOW 10
+
+int loss_converged(float loss, float loss_smoothed_debiased, float tol, int counter, int warm_start)
+{
+    if (warm_start) {
+        return counter > SMOOTHED_LOSS_WINDOW && loss_smoothed_debiased >= loss && loss_smoothed_debiased / loss < 1.0f + tol;
+    }
+    return counter > 1 && loss_smoothed_debiased / loss < 1.0f + tol;
+}
+
 __kernel void tv_norm_mtx_and_dx_dy(
     __global const float* img,
     __global float* tv_norm_mtx,
@@ -45,6 +72,8 @@ __kernel void tv_norm_mtx_and_dx_dy(
     dy_mtx[idx] = dy;
 }
 
+// The three steps add the terms of a pixel in the order of the CPU loop (the pixel above, the one on the left,
+// then the pixel itself), so both back ends round the TV gradient the same way
 __kernel void grad_from_dx_dy_step1(
     __global const float* dx, 
     __global const float* dy, 
@@ -61,11 +90,13 @@ __kernel void grad_from_dx_dy_step1(
     }
     grad[idx] = 0.0f;
 
-    if (i >= rows - 1 || j >= cols - 1) {
+    if (i < 1 || j >= cols - 1) {
         return;
     }
 
-    grad[idx] += dx[idx] + dy[idx];
+    const int idx_up = idx - cols;
+
+    grad[idx] -= dy[idx_up];
 }
 
 __kernel void grad_from_dx_dy_step2(
@@ -103,9 +134,7 @@ __kernel void grad_from_dx_dy_step3(
         return;
     }
 
-    const int idx_down = idx + cols;
-
-    grad[idx_down] -= dy[idx];
+    grad[idx] += dx[idx] + dy[idx];
 }
 
 __kernel void l2_norm_mtx_and_grad(
@@ -134,6 +163,24 @@ __kernel void eval_loss_and_grad(
     grad[idx] += strength * tv_or_l2_grad[idx];
 }
 
+__kernel void axpy(
+    __global float* y,
+    __global const float* x,
+    float alpha
+) {
+    int idx = get_global_id(0);
+    y[idx] += alpha * x[idx];
+}
+
+__kernel void dot_mtx(
+    __global const float* a,
+    __global const float* b,
+    __global float* dot_mtx
+) {
+    int idx = get_global_id(0);
+    dot_mtx[idx] = a[idx] * b[idx];
+}
+
 __kernel void eval_momentum(
     __global float* momentum,
     __global const float* grad,
@@ -155,3 +202,926 @@ __kernel void update_img(
     float bias_correction = 1.0f - pow(momentum_beta, (float)counter);
     img[idx] -= step / bias_correction * momentum[idx];
 }
+
+__kernel void loss_mtx(
+    __global const float* tv_norm_mtx,
+    __global const float* l2_norm_mtx,
+    __global float* loss_mtx,
+    float strength
+) {
+    int idx = get_global_id(0);
+    loss_mtx[idx] = strength * tv_norm_mtx[idx] + 0.5f * l2_norm_mtx[idx];
+}
+
+// state: smoothed loss, last loss, converged flag, iteration of convergence
+__kernel void convergence_check(
+    __global const float* loss_sum,
+    __global float* state,
+    float loss_smoothing_beta,
+    float tol,
+    int checks,
+    int counter,
+    int warm_start
+) {
+    if (state[2] != 0.0f) {
+        return;
+    }
+
+    const float loss = loss_sum[0];
+    state[1] = loss;
+    state[0] = state[0] * loss_smoothing_beta + loss * (1.0f - loss_smoothing_beta);
+
+    const float loss_smoothed_debiased = state[0] / (1.0f - pow(loss_smoothing_beta, (float)checks));
+    if (loss_converged(loss, loss_smoothed_debiased, tol, counter, warm_start)) {
+        state[2] = 1.0f;
+        state[3] = (float)counter;
+    }
+}
+
+// Budgeted solves keep the checked iterate with the lowest loss: best holds that loss and a flag
+// telling keep_best_iterate whether the iterate of the last check replaces it
+__kernel void best_loss_check(
+    __global const float* state,
+    __global float* best
+) {
+    if (state[1] < best[0]) {
+        best[0] = state[1];
+        best[1] = 1.0f;
+    }
+    else {
+        best[1] = 0.0f;
+    }
+}
+
+__kernel void keep_best_iterate(
+    __global const float* img,
+    __global float* best_img,
+    __global const float* best
+) {
+    if (best[1] == 0.0f) {
+        return;
+    }
+
+    int idx = get_global_id(0);
+    best_img[idx] = img[idx];
+}
+
+__kernel void momentum_update_img(
+    __global float* img,
+    __global float* momentum,
+    __global const float* grad,
+    __global const float* state,
+    float step,
+    float momentum_beta,
+    int counter
+) {
+    if (state[2] != 0.0f) {
+        return;
+    }
+
+    int idx = get_global_id(0);
+    momentum[idx] = momentum[idx] * momentum_beta + grad[idx] * (1.0f - momentum_beta);
+
+    float bias_correction = 1.0f - pow(momentum_beta, (float)counter);
+    img[idx] -= step / bias_correction * momentum[idx];
+}
+
+// One work item per preview pixel, averaging a factor x factor block (partial at the bottom and right border)
+__kernel void downsample_preview(
+    __global const float* img,
+    __global float* preview,
+    int rows,
+    int cols,
+    int factor,
+    int preview_cols
+) {
+    int idx = get_global_id(0);
+    int i0 = (idx / preview_cols) * factor;
+    int j0 = (idx % preview_cols) * factor;
+    int i1 = min(i0 + factor, rows);
+    int j1 = min(j0 + factor, cols);
+
+    float sum = 0.0f;
+    for (int i = i0; i < i1; ++i) {
+        for (int j = j0; j < j1; ++j) {
+            sum += img[i * cols + j];
+        }
+    }
+    preview[idx] = sum / (float)((i1 - i0) * (j1 - j0));
+}
+
+// Storage formats of the mixed precision solver, every value is converted to float when it is loaded
+inline ushort float_to_bfloat16(float value)
+{
+    uint bits = as_uint(value);
+    bits += 0x7FFF + ((bits >> 16) & 1);
+    return (ushort)(bits >> 16);
+}
+
+#define LOAD_F32(p, i) ((p)[i])
+#define STORE_F32(p, i, v) ((p)[i] = (v))
+#define LOAD_F16(p, i) vload_half((i), (p))
+#define STORE_F16(p, i, v) vstore_half_rte((v), (i), (p))
+#define LOAD_BF16(p, i) as_float((uint)(p)[i] << 16)
+#define STORE_BF16(p, i, v) ((p)[i] = float_to_bfloat16(v))
+
+// One fused gradient descent iteration: the TV gradient is gathered from the three stencils touching the pixel,
+// so no intermediate matrix is written. The iterate is double buffered as every pixel reads its neighbours.
+#define MIXED_STEP_KERNEL(NAME, T, LOAD, STORE, IMG_T, LOAD_IMG, STORE_IMG)                                     \
+__kernel void NAME(                                                                                             \
+    __global const IMG_T* img,                                                                                  \
+    __global IMG_T* next_img,                                                                                   \
+    __global const T* orig,                                                                                     \
+    __global T* momentum,                                                                                       \
+    __global float* loss_mtx,                                                                                   \
+    __global const float* state,                                                                                \
+    int rows,                                                                                                   \
+    int cols,                                                                                                   \
+    float strength,                                                                                             \
+    float eps,                                                                                                  \
+    float step,                                                                                                 \
+    float momentum_beta,                                                                                        \
+    int counter,                                                                                                \
+    int eval_loss                                                                                               \
+) {                                                                                                             \
+    const int idx = get_global_id(0);                                                                           \
+    if (idx >= rows * cols || state[2] != 0.0f) {                                                               \
+        return;                                                                                                 \
+    }                                                                                                           \
+    const int i = idx / cols;                                                                                   \
+    const int j = idx % cols;                                                                                   \
+                                                                                                                \
+    const float center = LOAD_IMG(img, idx);                                                                    \
+    float grad = center - LOAD(orig, idx);                                                                      \
+    const float l2_norm = grad * grad;                                                                          \
+    float tv_norm = 0.0f;                                                                                       \
+                                                                                                                \
+    if (i < rows - 1 && j < cols - 1) {                                                                         \
+        const float x_diff = center - LOAD_IMG(img, idx + 1);                                                   \
+        const float y_diff = center - LOAD_IMG(img, idx + cols);                                                \
+        const float grad_mag = sqrt(x_diff * x_diff + y_diff * y_diff + eps);                                   \
+        tv_norm = grad_mag;                                                                                     \
+        grad += strength * (x_diff + y_diff) / grad_mag;                                                        \
+    }                                                                                                           \
+    if (i < rows - 1 && j > 0) {                                                                                \
+        const float left = LOAD_IMG(img, idx - 1);                                                              \
+        const float x_diff = left - center;                                                                     \
+        const float y_diff = left - LOAD_IMG(img, idx - 1 + cols);                                              \
+        grad -= strength * x_diff / sqrt(x_diff * x_diff + y_diff * y_diff + eps);                              \
+    }                                                                                                           \
+    if (i > 0 && j < cols - 1) {                                                                                \
+        const float up = LOAD_IMG(img, idx - cols);                                                             \
+        const float x_diff = up - LOAD_IMG(img, idx - cols + 1);                                                \
+        const float y_diff = up - center;                                                                       \
+        grad -= strength * y_diff / sqrt(x_diff * x_diff + y_diff * y_diff + eps);                              \
+    }                                                                                                           \
+                                                                                                                \
+    if (eval_loss) {                                                                                            \
+        loss_mtx[idx] = strength * tv_norm + 0.5f * l2_norm;                                                    \
+    }                                                                                                           \
+                                                                                                                \
+    const float m = LOAD(momentum, idx) * momentum_beta + grad * (1.0f - momentum_beta);                       \
+    STORE(momentum, idx, m);                                                                                    \
+    const float bias_correction = 1.0f - pow(momentum_beta, (float)counter);                                   \
+    STORE_IMG(next_img, idx, center - step / bias_correction * m);                                              \
+}
+
+MIXED_STEP_KERNEL(mixed_step_f32_f32, float, LOAD_F32, STORE_F32, float, LOAD_F32, STORE_F32)
+MIXED_STEP_KERNEL(mixed_step_f16_f32, half, LOAD_F16, STORE_F16, float, LOAD_F32, STORE_F32)
+MIXED_STEP_KERNEL(mixed_step_f16_f16, half, LOAD_F16, STORE_F16, half, LOAD_F16, STORE_F16)
+MIXED_STEP_KERNEL(mixed_step_bf16_f32, ushort, LOAD_BF16, STORE_BF16, float, LOAD_F32, STORE_F32)
+MIXED_STEP_KERNEL(mixed_step_bf16_bf16, ushort, LOAD_BF16, STORE_BF16, ushort, LOAD_BF16, STORE_BF16)
+
+// TV model solver (see tv_denoise_gradient_descent_model): the variant, boundary condition and scalar type are
+// chosen when the program is built (-D TV_VARIANT=0|1|2 isotropic|anisotropic|huber, -D TV_BOUNDARY=0|1|2
+// truncated|neumann|periodic, -D TV_DOUBLE), so the conditions below are constants the compiler removes.
+#ifndef TV_VARIANT
+#define TV_VARIANT 0
+#endif
+#ifndef TV_BOUNDARY
+#define TV_BOUNDARY 0
+#endif
+
+#ifdef TV_DOUBLE
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+typedef double tv_real;
+#else
+typedef float tv_real;
+#endif
+
+// TV value of a stencil and its derivatives by the forward differences
+inline tv_real tv_penalty(tv_real x_diff, tv_real y_diff, tv_real eps, tv_real delta, tv_real* dx, tv_real* dy)
+{
+#if TV_VARIANT == 1
+    const tv_real x_mag = sqrt(x_diff * x_diff + eps);
+    const tv_real y_mag = sqrt(y_diff * y_diff + eps);
+    *dx = x_diff / x_mag;
+    *dy = y_diff / y_mag;
+    return x_mag + y_mag;
+#elif TV_VARIANT == 2
+    const tv_real grad_mag = sqrt(x_diff * x_diff + y_diff * y_diff);
+    const tv_real scale = 1 / fmax(grad_mag, delta);
+    *dx = x_diff * scale;
+    *dy = y_diff * scale;
+    return grad_mag > delta ? grad_mag - (tv_real)0.5 * delta : (tv_real)0.5 * grad_mag * grad_mag / delta;
+#else
+    const tv_real grad_mag = sqrt(x_diff * x_diff + y_diff * y_diff + eps);
+    *dx = x_diff / grad_mag;
+    *dy = y_diff / grad_mag;
+    return grad_mag;
+#endif
+}
+
+// Stencil of the pixel (i, j), false if the boundary condition gives it none
+inline bool tv_stencil(
+    __global const tv_real* img, int i, int j, int rows, int cols, tv_real eps, tv_real delta,
+    tv_real* value, tv_real* dx, tv_real* dy
+)
+{
+    if (TV_BOUNDARY == 0 && (i == rows - 1 || j == cols - 1)) {
+        return false;
+    }
+    const int idx = i * cols + j;
+    // Neumann: the pixel is its own neighbour across the border, periodic: the first pixel of the row / column
+    const int right = j < cols - 1 ? idx + 1 : (TV_BOUNDARY == 2 ? idx - cols + 1 : idx);
+    const int down = i < rows - 1 ? idx + cols : (TV_BOUNDARY == 2 ? j : idx);
+    *value = tv_penalty(img[idx] - img[right], img[idx] - img[down], eps, delta, dx, dy);
+    return true;
+}
+
+// One fused gradient descent iteration as in MIXED_STEP_KERNEL, gathering the own stencil and the stencils
+// of the left and upper neighbour (which wrap around for the periodic boundary condition)
+__kernel void model_step(
+    __global const tv_real* img,
+    __global tv_real* next_img,
+    __global const tv_real* orig,
+    __global tv_real* momentum,
+    __global float* loss_mtx,
+    __global const float* state,
+    int rows,
+    int cols,
+    float strength,
+    float eps,
+    float huber_delta,
+    float step,
+    float momentum_beta,
+    int counter,
+    int eval_loss
+) {
+    const int idx = get_global_id(0);
+    if (idx >= rows * cols || state[2] != 0.0f) {
+        return;
+    }
+    const int i = idx / cols;
+    const int j = idx % cols;
+    const tv_real weight = strength;
+    const tv_real smoothing = eps;
+    const tv_real delta = huber_delta;
+
+    const tv_real center = img[idx];
+    tv_real grad = center - orig[idx];
+    const tv_real l2_norm = grad * grad;
+    tv_real tv_norm = 0;
+
+    tv_real value, dx, dy;
+    if (tv_stencil(img, i, j, rows, cols, smoothing, delta, &value, &dx, &dy)) {
+        tv_norm = value;
+        grad += weight * (dx + dy);
+    }
+    if ((j > 0 || TV_BOUNDARY == 2) && tv_stencil(img, i, j > 0 ? j - 1 : cols - 1, rows, cols, smoothing, delta, &value, &dx, &dy)) {
+        grad -= weight * dx;
+    }
+    if ((i > 0 || TV_BOUNDARY == 2) && tv_stencil(img, i > 0 ? i - 1 : rows - 1, j, rows, cols, smoothing, delta, &value, &dx, &dy)) {
+        grad -= weight * dy;
+    }
+
+    if (eval_loss) {
+        loss_mtx[idx] = (float)(weight * tv_norm + (tv_real)0.5 * l2_norm);
+    }
+
+    const tv_real beta = momentum_beta;
+    const tv_real m = momentum[idx] * beta + grad * (1 - beta);
+    momentum[idx] = m;
+    const tv_real bias_correction = 1 - pow(beta, (tv_real)counter);
+    next_img[idx] = center - (tv_real)step / bias_correction * m;
+}
+
+// Lets the host check the options the program was built with: TV_VARIANT * 100 + TV_BOUNDARY * 10 + double
+__kernel void model_id(__global int* id)
+{
+#ifdef TV_DOUBLE
+    id[0] = TV_VARIANT * 100 + TV_BOUNDARY * 10 + 1;
+#else
+    id[0] = TV_VARIANT * 100 + TV_BOUNDARY * 10;
+#endif
+}
+
+// Active-set solver: every work-group processes one tile of the active tile list.
+// The local size is tile_size * tile_size, a power of two.
+__kernel void active_tiles_grad(
+    __global const float* img,
+    __global const float* orig,
+    __global float* grad,
+    __global long* tile_loss,
+    __global const int* active_tiles,
+    int rows,
+    int cols,
+    int tile_size,
+    int tile_cols,
+    float strength,
+    float eps,
+    __local long* scratch
+) {
+    const int tile = active_tiles[get_group_id(0)];
+    const int lid = get_local_id(0);
+    const int i = (tile / tile_cols) * tile_size + lid / tile_size;
+    const int j = (tile % tile_cols) * tile_size + lid % tile_size;
+
+    float loss = 0.0f;
+    if (i < rows && j < cols) {
+        const int idx = i * cols + j;
+        const float center = img[idx];
+        const float diff = center - orig[idx];
+        float g = diff;
+        loss = 0.5f * diff * diff;
+
+        // Gather the contributions of the three stencils touching the pixel
+        if (i < rows - 1 && j < cols - 1) {
+            const float x_diff = center - img[idx + 1];
+            const float y_diff = center - img[idx + cols];
+            const float grad_mag = sqrt(x_diff * x_diff + y_diff * y_diff + eps);
+            loss += strength * grad_mag;
+            g += strength * (x_diff + y_diff) / grad_mag;
+        }
+        if (i < rows - 1 && j > 0) {
+            const float x_diff = img[idx - 1] - center;
+            const float y_diff = img[idx - 1] - img[idx - 1 + cols];
+            g -= strength * x_diff / sqrt(x_diff * x_diff + y_diff * y_diff + eps);
+        }
+        if (i > 0 && j < cols - 1) {
+            const float x_diff = img[idx - cols] - img[idx - cols + 1];
+            const float y_diff = img[idx - cols] - center;
+            g -= strength * y_diff / sqrt(x_diff * x_diff + y_diff * y_diff + eps);
+        }
+        grad[idx] = g;
+    }
+
+    scratch[lid] = to_fixed(loss);
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (int offset = get_local_size(0) / 2; offset > 0; offset >>= 1) {
+        if (lid < offset) {
+            scratch[lid] += scratch[lid + offset];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    if (lid == 0) {
+        tile_loss[tile] = scratch[0];
+    }
+}
+
+__kernel void active_tiles_update(
+    __global float* img,
+    __global float* momentum,
+    __global const float* grad,
+    __global const int* active_tiles,
+    int rows,
+    int cols,
+    int tile_size,
+    int tile_cols,
+    float update_scale,
+    float momentum_beta
+) {
+    const int tile = active_tiles[get_group_id(0)];
+    const int lid = get_local_id(0);
+    const int i = (tile / tile_cols) * tile_size + lid / tile_size;
+    const int j = (tile % tile_cols) * tile_size + lid % tile_size;
+    if (i >= rows || j >= cols) {
+        return;
+    }
+
+    const int idx = i * cols + j;
+    momentum[idx] = momentum[idx] * momentum_beta + grad[idx] * (1.0f - momentum_beta);
+    img[idx] -= update_scale * momentum[idx];
+}
+
+// Zeroes the momentum of the tiles that were reactivated at the end of a tracking window
+__kernel void active_tiles_reset_momentum(
+    __global float* momentum,
+    __global const int* tiles,
+    int rows,
+    int cols,
+    int tile_size,
+    int tile_cols
+) {
+    const int tile = tiles[get_group_id(0)];
+    const int lid = get_local_id(0);
+    const int i = (tile / tile_cols) * tile_size + lid / tile_size;
+    const int j = (tile % tile_cols) * tile_size + lid % tile_size;
+    if (i < rows && j < cols) {
+        momentum[i * cols + j] = 0.0f;
+    }
+}
+
+// Masked solver: every work-group processes one tile of the domain (the tiles containing a masked pixel), slot is
+// the position of the tile in the domain. The mask, the momentum and the gradient are stored per slot, tile_slot
+// maps every tile of the image to its slot or -1. Only masked pixels are updated, the others keep their input values.
+inline bool masked_in_domain(__global const int* tile_slot, int i, int j, int tile_size, int tile_cols)
+{
+    return tile_slot[(i / tile_size) * tile_cols + j / tile_size] >= 0;
+}
+
+__kernel void masked_tiles_grad(
+    __global const float* img,
+    __global const float* orig,
+    __global float* grad,
+    __global long* tile_loss,
+    __global const int* domain_tiles,
+    __global const int* tile_slot,
+    int rows,
+    int cols,
+    int tile_size,
+    int tile_cols,
+    float strength,
+    float eps,
+    __local long* scratch
+) {
+    const int slot = get_group_id(0);
+    const int tile = domain_tiles[slot];
+    const int lid = get_local_id(0);
+    const int r0 = (tile / tile_cols) * tile_size;
+    const int c0 = (tile % tile_cols) * tile_size;
+    const int i = r0 + lid / tile_size;
+    const int j = c0 + lid % tile_size;
+
+    float loss = 0.0f;
+    if (i < rows && j < cols) {
+        const int idx = i * cols + j;
+        const float center = img[idx];
+        const float diff = center - orig[idx];
+        float g = diff;
+        // Zero outside the mask, as these pixels keep the input
+        loss = 0.5f * diff * diff;
+
+        // Gather the contributions of the three stencils touching the pixel. Every stencil is counted once in the
+        // loss: those of the tile, and a halo stencil outside the domain by the tile below it, or else by the tile
+        // right of it (as in the CPU version)
+        if (i < rows - 1 && j < cols - 1) {
+            const float x_diff = center - img[idx + 1];
+            const float y_diff = center - img[idx + cols];
+            const float grad_mag = sqrt(x_diff * x_diff + y_diff * y_diff + eps);
+            loss += strength * grad_mag;
+            g += strength * (x_diff + y_diff) / grad_mag;
+        }
+        if (i < rows - 1 && j > 0) {
+            const float x_diff = img[idx - 1] - center;
+            const float y_diff = img[idx - 1] - img[idx - 1 + cols];
+            const float grad_mag = sqrt(x_diff * x_diff + y_diff * y_diff + eps);
+            if (j == c0 && !masked_in_domain(tile_slot, i, j - 1, tile_size, tile_cols)
+                && !masked_in_domain(tile_slot, i + 1, j - 1, tile_size, tile_cols)) {
+                loss += strength * grad_mag;
+            }
+            g -= strength * x_diff / grad_mag;
+        }
+        if (i > 0 && j < cols - 1) {
+            const float x_diff = img[idx - cols] - img[idx - cols + 1];
+            const float y_diff = img[idx - cols] - center;
+            const float grad_mag = sqrt(x_diff * x_diff + y_diff * y_diff + eps);
+            if (i == r0 && !masked_in_domain(tile_slot, i - 1, j, tile_size, tile_cols)) {
+                loss += strength * grad_mag;
+            }
+            g -= strength * y_diff / grad_mag;
+        }
+        grad[slot * get_local_size(0) + lid] = g;
+    }
+
+    scratch[lid] = to_fixed(loss);
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (int offset = get_local_size(0) / 2; offset > 0; offset >>= 1) {
+        if (lid < offset) {
+            scratch[lid] += scratch[lid + offset];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    if (lid == 0) {
+        tile_loss[slot] = scratch[0];
+    }
+}
+
+__kernel void masked_tiles_update(
+    __global float* img,
+    __global float* momentum,
+    __global const float* grad,
+    __global const float* mask,
+    __global const int* domain_tiles,
+    int rows,
+    int cols,
+    int tile_size,
+    int tile_cols,
+    float update_scale,
+    float momentum_beta
+) {
+    const int slot = get_group_id(0);
+    const int tile = domain_tiles[slot];
+    const int lid = get_local_id(0);
+    const int i = (tile / tile_cols) * tile_size + lid / tile_size;
+    const int j = (tile % tile_cols) * tile_size + lid % tile_size;
+    const int p = slot * get_local_size(0) + lid;
+    if (i >= rows || j >= cols || mask[p] <= 0.0f) {
+        return;
+    }
+
+    momentum[p] = momentum[p] * momentum_beta + grad[p] * (1.0f - momentum_beta);
+    img[i * cols + j] -= update_scale * momentum[p];
+}
+
+// Largest change of the pixels of a tile since the snapshot, overall and along each side (top, bottom, left,
+// right), and of the upper right and lower left corners: 7 values per tile. The snapshot is updated.
+__kernel void active_tiles_drift(
+    __global const float* img,
+    __global float* snapshot,
+    __global float* tile_drift,
+    __global const int* active_tiles,
+    int rows,
+    int cols,
+    int tile_size,
+    int tile_cols,
+    __local float* scratch
+) {
+    const int tile = active_tiles[get_group_id(0)];
+    const int lid = get_local_id(0);
+    const int size = get_local_size(0);
+    const int r0 = (tile / tile_cols) * tile_size;
+    const int c0 = (tile % tile_cols) * tile_size;
+    const int r1 = min(r0 + tile_size, rows);
+    const int c1 = min(c0 + tile_size, cols);
+    const int i = r0 + lid / tile_size;
+    const int j = c0 + lid % tile_size;
+
+    float change = 0.0f;
+    if (i < rows && j < cols) {
+        const int idx = i * cols + j;
+        change = fabs(img[idx] - snapshot[idx]);
+        snapshot[idx] = img[idx];
+
+        if (i == r0 && j == c1 - 1) {
+            tile_drift[tile * 7 + 5] = change;
+        }
+        if (i == r1 - 1 && j == c0) {
+            tile_drift[tile * 7 + 6] = change;
+        }
+    }
+
+    scratch[lid] = change;
+    scratch[size + lid] = i == r0 ? change : 0.0f;
+    scratch[2 * size + lid] = i == r1 - 1 ? change : 0.0f;
+    scratch[3 * size + lid] = j == c0 ? change : 0.0f;
+    scratch[4 * size + lid] = j == c1 - 1 ? change : 0.0f;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (int offset = size / 2; offset > 0; offset >>= 1) {
+        if (lid < offset) {
+            for (int k = 0; k < 5; ++k) {
+                scratch[k * size + lid] = fmax(scratch[k * size + lid], scratch[k * size + lid + offset]);
+            }
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    if (lid == 0) {
+        for (int k = 0; k < 5; ++k) {
+            tile_drift[tile * 7 + k] = scratch[k * size];
+        }
+    }
+}
+
+// Batched solver: the images are packed one after the other into an atlas, image_info holds 4 ints per image
+// (offset in the atlas, rows, cols, first block). Every work-group processes one block of block_size pixels
+// of one image, only the blocks of the images that have not converged yet are in the active block list.
+__kernel void batched_grad(
+    __global const float* img,
+    __global const float* orig,
+    __global float* grad,
+    __global long* block_loss,
+    __global const int* active_blocks,
+    __global const int* block_image,
+    __global const int* image_info,
+    float strength,
+    float eps,
+    int eval_loss,
+    __local long* scratch
+) {
+    const int block = active_blocks[get_group_id(0)];
+    const int lid = get_local_id(0);
+    const int image = block_image[block];
+    const int offset = image_info[image * 4];
+    const int rows = image_info[image * 4 + 1];
+    const int cols = image_info[image * 4 + 2];
+    const int local_idx = (block - image_info[image * 4 + 3]) * get_local_size(0) + lid;
+
+    float loss = 0.0f;
+    if (local_idx < rows * cols) {
+        const int i = local_idx / cols;
+        const int j = local_idx % cols;
+        const int idx = offset + local_idx;
+        const float center = img[idx];
+        const float diff = center - orig[idx];
+        float g = diff;
+        loss = 0.5f * diff * diff;
+
+        // Gather the contributions of the three stencils touching the pixel
+        if (i < rows - 1 && j < cols - 1) {
+            const float x_diff = center - img[idx + 1];
+            const float y_diff = center - img[idx + cols];
+            const float grad_mag = sqrt(x_diff * x_diff + y_diff * y_diff + eps);
+            loss += strength * grad_mag;
+            g += strength * (x_diff + y_diff) / grad_mag;
+        }
+        if (i < rows - 1 && j > 0) {
+            const float x_diff = img[idx - 1] - center;
+            const float y_diff = img[idx - 1] - img[idx - 1 + cols];
+            g -= strength * x_diff / sqrt(x_diff * x_diff + y_diff * y_diff + eps);
+        }
+        if (i > 0 && j < cols - 1) {
+            const float x_diff = img[idx - cols] - img[idx - cols + 1];
+            const float y_diff = img[idx - cols] - center;
+            g -= strength * y_diff / sqrt(x_diff * x_diff + y_diff * y_diff + eps);
+        }
+        grad[idx] = g;
+    }
+
+    // eval_loss is the same for the whole launch, so every work item takes the same branch
+    if (eval_loss) {
+        scratch[lid] = to_fixed(loss);
+        barrier(CLK_LOCAL_MEM_FENCE);
+        for (int offset = get_local_size(0) / 2; offset > 0; offset >>= 1) {
+            if (lid < offset) {
+                scratch[lid] += scratch[lid + offset];
+            }
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+        if (lid == 0) {
+            block_loss[block] = scratch[0];
+        }
+    }
+}
+
+// One work item per active image: sums the losses of its blocks and runs convergence_check on its 4 state values
+__kernel void batched_convergence_check(
+    __global const long* block_loss,
+    __global float* state,
+    __global const int* active_images,
+    __global const int* image_info,
+    int block_size,
+    float loss_smoothing_beta,
+    float tol,
+    int checks,
+    int counter,
+    int warm_start
+) {
+    const int image = active_images[get_global_id(0)];
+    __global float* image_state = state + image * 4;
+    if (image_state[2] != 0.0f) {
+        return;
+    }
+
+    const int first_block = image_info[image * 4 + 3];
+    const int blocks = (image_info[image * 4 + 1] * image_info[image * 4 + 2] + block_size - 1) / block_size;
+    long loss_sum = 0;
+    for (int b = 0; b < blocks; ++b) {
+        loss_sum += block_loss[first_block + b];
+    }
+    const float loss = from_fixed(loss_sum);
+
+    image_state[1] = loss;
+    image_state[0] = image_state[0] * loss_smoothing_beta + loss * (1.0f - loss_smoothing_beta);
+
+    const float loss_smoothed_debiased = image_state[0] / (1.0f - pow(loss_smoothing_beta, (float)checks));
+    if (loss_converged(loss, loss_smoothed_debiased, tol, counter, warm_start)) {
+        image_state[2] = 1.0f;
+        image_state[3] = (float)counter;
+    }
+}
+
+__kernel void batched_update(
+    __global float* img,
+    __global float* momentum,
+    __global const float* grad,
+    __global const float* state,
+    __global const int* active_blocks,
+    __global const int* block_image,
+    __global const int* image_info,
+    float step,
+    float momentum_beta,
+    int counter
+) {
+    const int block = active_blocks[get_group_id(0)];
+    const int image = block_image[block];
+    const int local_idx = (block - image_info[image * 4 + 3]) * get_local_size(0) + get_local_id(0);
+    if (local_idx >= image_info[image * 4 + 1] * image_info[image * 4 + 2] || state[image * 4 + 2] != 0.0f) {
+        return;
+    }
+
+    const int idx = image_info[image * 4] + local_idx;
+    momentum[idx] = momentum[idx] * momentum_beta + grad[idx] * (1.0f - momentum_beta);
+
+    float bias_correction = 1.0f - pow(momentum_beta, (float)counter);
+    img[idx] -= step / bias_correction * momentum[idx];
+}
+
+// Lagged diffusivity solver: the linear system of an outer iteration on a multigrid level is diag(mass) plus a
+// weighted graph Laplacian, wx and wy are the weights of the edges to the right and lower neighbour (0 at the border)
+__kernel void lagged_diffusivity_weights(
+    __global const float* img,
+    __global const float* orig,
+    __global float* wx,
+    __global float* wy,
+    __global float* loss_mtx,
+    int rows,
+    int cols,
+    float strength,
+    float eps
+) {
+    int idx = get_global_id(0);
+    int i = idx / cols;
+    int j = idx % cols;
+
+    float diff = img[idx] - orig[idx];
+    float loss = 0.5f * diff * diff;
+
+    float weight = 0.0f;
+    if (i < rows - 1 && j < cols - 1) {
+        float x_diff = img[idx] - img[idx + 1];
+        float y_diff = img[idx] - img[idx + cols];
+        float grad_mag = sqrt(x_diff * x_diff + y_diff * y_diff + eps);
+        loss += strength * grad_mag;
+        weight = strength / grad_mag;
+    }
+    wx[idx] = weight;
+    wy[idx] = weight;
+    loss_mtx[idx] = loss;
+}
+
+inline float diffusion_diagonal(
+    __global const float* mass, __global const float* wx, __global const float* wy, int idx, int i, int j, int rows, int cols
+) {
+    float diagonal = mass[idx];
+    if (j + 1 < cols) diagonal += wx[idx];
+    if (j > 0) diagonal += wx[idx - 1];
+    if (i + 1 < rows) diagonal += wy[idx];
+    if (i > 0) diagonal += wy[idx - cols];
+    return diagonal;
+}
+
+inline float diffusion_off_diagonal(
+    __global const float* x, __global const float* wx, __global const float* wy, int idx, int i, int j, int rows, int cols
+) {
+    float sum = 0.0f;
+    if (j + 1 < cols) sum += wx[idx] * x[idx + 1];
+    if (j > 0) sum += wx[idx - 1] * x[idx - 1];
+    if (i + 1 < rows) sum += wy[idx] * x[idx + cols];
+    if (i > 0) sum += wy[idx - cols] * x[idx - cols];
+    return sum;
+}
+
+__kernel void diffusion_apply(
+    __global const float* x,
+    __global const float* mass,
+    __global const float* wx,
+    __global const float* wy,
+    __global float* y,
+    int rows,
+    int cols
+) {
+    int idx = get_global_id(0);
+    int i = idx / cols;
+    int j = idx % cols;
+    y[idx] = diffusion_diagonal(mass, wx, wy, idx, i, j, rows, cols) * x[idx] - diffusion_off_diagonal(x, wx, wy, idx, i, j, rows, cols);
+}
+
+__kernel void diffusion_residual(
+    __global const float* x,
+    __global const float* b,
+    __global const float* mass,
+    __global const float* wx,
+    __global const float* wy,
+    __global float* residual,
+    int rows,
+    int cols
+) {
+    int idx = get_global_id(0);
+    int i = idx / cols;
+    int j = idx % cols;
+    residual[idx] = b[idx] - diffusion_diagonal(mass, wx, wy, idx, i, j, rows, cols) * x[idx]
+        + diffusion_off_diagonal(x, wx, wy, idx, i, j, rows, cols);
+}
+
+__kernel void jacobi_precondition(
+    __global const float* residual,
+    __global const float* mass,
+    __global const float* wx,
+    __global const float* wy,
+    __global float* z,
+    int rows,
+    int cols
+) {
+    int idx = get_global_id(0);
+    z[idx] = residual[idx] / diffusion_diagonal(mass, wx, wy, idx, idx / cols, idx % cols, rows, cols);
+}
+
+// Gauss-Seidel update of the pixels of one color of the checkerboard (color 0 has i + j even),
+// the pixels of a color only depend on the other color, so they are updated in parallel
+__kernel void red_black_sweep(
+    __global float* x,
+    __global const float* b,
+    __global const float* mass,
+    __global const float* wx,
+    __global const float* wy,
+    int rows,
+    int cols,
+    int color
+) {
+    int idx = get_global_id(0);
+    int i = idx / cols;
+    int j = idx % cols;
+    if (((i + j) & 1) != color) {
+        return;
+    }
+    x[idx] = (b[idx] + diffusion_off_diagonal(x, wx, wy, idx, i, j, rows, cols)) / diffusion_diagonal(mass, wx, wy, idx, i, j, rows, cols);
+}
+
+// Galerkin coarse operator of aggregating 2x2 pixels, one work item per coarse pixel
+__kernel void coarsen_diffusion(
+    __global const float* mass,
+    __global const float* wx,
+    __global const float* wy,
+    __global float* coarse_mass,
+    __global float* coarse_wx,
+    __global float* coarse_wy,
+    int rows,
+    int cols,
+    int coarse_cols
+) {
+    int idx = get_global_id(0);
+    int i0 = (idx / coarse_cols) * 2;
+    int j0 = (idx % coarse_cols) * 2;
+
+    float sum_mass = 0.0f;
+    float sum_wx = 0.0f;
+    float sum_wy = 0.0f;
+    for (int i = i0; i < min(i0 + 2, rows); ++i) {
+        for (int j = j0; j < min(j0 + 2, cols); ++j) {
+            sum_mass += mass[i * cols + j];
+        }
+    }
+    // Only the edges leaving the aggregate to the right and to the bottom remain
+    if (j0 + 1 < cols) {
+        for (int i = i0; i < min(i0 + 2, rows); ++i) {
+            sum_wx += wx[i * cols + j0 + 1];
+        }
+    }
+    if (i0 + 1 < rows) {
+        for (int j = j0; j < min(j0 + 2, cols); ++j) {
+            sum_wy += wy[(i0 + 1) * cols + j];
+        }
+    }
+    coarse_mass[idx] = sum_mass;
+    coarse_wx[idx] = sum_wx;
+    coarse_wy[idx] = sum_wy;
+}
+
+__kernel void restrict_residual(
+    __global const float* residual,
+    __global float* coarse_b,
+    int rows,
+    int cols,
+    int coarse_cols
+) {
+    int idx = get_global_id(0);
+    int i0 = (idx / coarse_cols) * 2;
+    int j0 = (idx % coarse_cols) * 2;
+
+    float sum = 0.0f;
+    for (int i = i0; i < min(i0 + 2, rows); ++i) {
+        for (int j = j0; j < min(j0 + 2, cols); ++j) {
+            sum += residual[i * cols + j];
+        }
+    }
+    coarse_b[idx] = sum;
+}
+
+__kernel void prolongate_correction(
+    __global float* x,
+    __global const float* coarse_x,
+    int cols,
+    int coarse_cols
+) {
+    int idx = get_global_id(0);
+    x[idx] += coarse_x[(idx / cols / 2) * coarse_cols + (idx % cols) / 2];
+}
+
+__kernel void cg_direction(
+    __global float* direction,
+    __global const float* z,
+    float beta
+) {
+    int idx = get_global_id(0);
+    direction[idx] = z[idx] + beta * direction[idx];
+}
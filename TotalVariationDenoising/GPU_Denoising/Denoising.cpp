@@ -1,7 +1,18 @@
 #include <CL/cl.hpp>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
 #include <vector>
 #include "Denoising.h"
 #include "../Image/Image.h"
+#include "../Common/HalfPrecision.h"
+#include "../Common/Reduction.h"
+#include "../Common/Convergence.h"
 
 template <>
 cl::Kernel init_sum_kernel<int>(cl::Program& program) {
@@ -159,7 +170,7 @@ float l2_norm_and_grad(
 
 	delete[] l2_norm_mtx;
 
-	return l2_norm;
+	return 0.5f * l2_norm;
 }
 
 float eval_loss_and_grad(
@@ -208,6 +219,77 @@ float eval_loss_and_grad(
 }
 
 
+void eval_grad(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const Image& img, const Image& orig, float strength, float* grad, float eps
+) {
+	const int img_size = img.getRows() * img.getCols();
+
+	std::vector<float> tv_norm_mtx(img_size);
+	std::vector<float> dx_mtx(img_size);
+	std::vector<float> dy_mtx(img_size);
+	std::vector<float> tv_grad(img_size);
+	std::vector<float> l2_norm_mtx(img_size);
+
+	// Same as eval_loss_and_grad, but the per-pixel norms are not reduced
+	tv_norm_mtx_and_dx_dy_mtx(context, queue, program, img, tv_norm_mtx.data(), dx_mtx.data(), dy_mtx.data(), eps);
+	grad_from_dx_dy_mtxs(context, queue, program, dx_mtx.data(), dy_mtx.data(), tv_grad.data(), img.getRows(), img.getCols());
+
+	l2_norm_mtx_and_grad(context, queue, program, img, orig, l2_norm_mtx.data(), grad);
+	axpy(context, queue, program, grad, tv_grad.data(), strength, img_size);
+}
+
+void axpy(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	float* y, const float* x, float alpha, int size
+) {
+	cl::Kernel kernel(program, "axpy");
+
+	cl::Buffer y_buffer(context, CL_MEM_READ_WRITE, size * sizeof(float));
+	queue.enqueueWriteBuffer(y_buffer, CL_TRUE, 0, size * sizeof(float), y);
+	queue.finish();
+
+	cl::Buffer x_buffer(context, CL_MEM_READ_WRITE, size * sizeof(float));
+	queue.enqueueWriteBuffer(x_buffer, CL_TRUE, 0, size * sizeof(float), x);
+	queue.finish();
+
+	kernel.setArg(0, y_buffer);
+	kernel.setArg(1, x_buffer);
+	kernel.setArg(2, alpha);
+
+	queue.enqueueNDRangeKernel(kernel, cl::NullRange, size, cl::NullRange);
+
+	queue.enqueueReadBuffer(y_buffer, CL_TRUE, 0, size * sizeof(float), y);
+}
+
+float dot(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const float* a, const float* b, int size
+) {
+	cl::Kernel kernel(program, "dot_mtx");
+
+	cl::Buffer a_buffer(context, CL_MEM_READ_WRITE, size * sizeof(float));
+	queue.enqueueWriteBuffer(a_buffer, CL_TRUE, 0, size * sizeof(float), a);
+	queue.finish();
+
+	cl::Buffer b_buffer(context, CL_MEM_READ_WRITE, size * sizeof(float));
+	queue.enqueueWriteBuffer(b_buffer, CL_TRUE, 0, size * sizeof(float), b);
+	queue.finish();
+
+	cl::Buffer dot_mtx_buffer(context, CL_MEM_READ_WRITE, size * sizeof(float));
+
+	kernel.setArg(0, a_buffer);
+	kernel.setArg(1, b_buffer);
+	kernel.setArg(2, dot_mtx_buffer);
+
+	queue.enqueueNDRangeKernel(kernel, cl::NullRange, size, cl::NullRange);
+
+	std::vector<float> dot_mtx(size);
+	queue.enqueueReadBuffer(dot_mtx_buffer, CL_TRUE, 0, size * sizeof(float), dot_mtx.data());
+
+	return sum<float>(context, queue, program, dot_mtx.data(), size);
+}
+
 void eval_momentum(
 	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
 	float* momentum, const float* grad, float momentum_beta, int img_size
@@ -256,50 +338,1792 @@ void update_img(
 	queue.enqueueReadBuffer(img_buffer, CL_TRUE, 0, img_size * sizeof(float), img);
 }
 
-Image tv_denoise_gradient_descent(
+/**
+ * @brief Gradient descent of both tv_denoise_gradient_descent overloads, initial (the input by default) may be nullptr.
+ */
+static Image gradient_descent(
 	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
-	const Image& input, float strength, float step_size, float tol, bool suppress_log
+	const Image& input, float strength, float step_size, float tol, bool suppress_log, const Image* initial, int check_every
 ) {
 	const int img_size = input.getRows() * input.getCols();
 
+	if (initial && (initial->getRows() != input.getRows() || initial->getCols() != input.getCols())) {
+		throw std::invalid_argument("Initial image must have the same size as the input image.");
+	}
+	if (check_every < 1) {
+		throw std::invalid_argument("Convergence check frequency must be at least 1.");
+	}
+
 	std::vector<float> momentum_vector(img_size, 0.0f);
 	float* momentum = momentum_vector.data();
 
-	Image img = input;
-	const Image orig_img = input;
+	Image img = initial ? *initial : input;
+	const Image& orig_img = input;
 
 	const float momentum_beta = 0.9f;
 	const float loss_smoothing_beta = 0.9f;
 	float loss_smoothed = 0.0f;
 
+	const float check_smoothing_beta = static_cast<float>(std::pow(loss_smoothing_beta, check_every));
+	int checks = 0;
+
 	const float step = step_size / (strength + 1);
 
+	std::vector<float> grad(img_size);
 	int counter = 1;
 	while (true) {
-		float* grad = new float[img_size];
-		float loss = eval_loss_and_grad(context, queue, program, img, orig_img, strength, grad);
+		// In between the convergence checks the two reductions of the loss are skipped
+		if ((counter - 1) % check_every != 0) {
+			eval_grad(context, queue, program, img, orig_img, strength, grad.data());
+		}
+		else {
+			float loss = eval_loss_and_grad(context, queue, program, img, orig_img, strength, grad.data());
+			++checks;
+
+			if (!suppress_log) {
+				std::cout << "Iteration: " << counter << ", Loss: " << loss << std::endl;
+			}
+
+			loss_smoothed = loss_smoothed * check_smoothing_beta + loss * (1.0f - check_smoothing_beta);
+
+			float loss_smoothed_debiased = loss_smoothed / (1.0f - static_cast<float>(std::pow(check_smoothing_beta, checks)));
+			if (loss_converged(loss, loss_smoothed_debiased, tol, counter, initial != nullptr)) {
+				if (!suppress_log) {
+					std::cout << "Converged after " << counter << " iterations with loss: " << loss_smoothed_debiased << std::endl;
+				}
+				break;
+			}
+		}
+
+		eval_momentum(context, queue, program, momentum, grad.data(), momentum_beta, img_size);
+		update_img(context, queue, program, img.data(), momentum, img_size, step, momentum_beta, counter);
+
+		++counter;
+	}
+
+	return img;
+}
+
+Image tv_denoise_gradient_descent(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const Image& input, float strength, float step_size, float tol, bool suppress_log, int check_every
+) {
+	return gradient_descent(context, queue, program, input, strength, step_size, tol, suppress_log, nullptr, check_every);
+}
+
+Image tv_denoise_gradient_descent(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const Image& input, float strength, float step_size, float tol, bool suppress_log, const Image& initial, int check_every
+) {
+	return gradient_descent(context, queue, program, input, strength, step_size, tol, suppress_log, &initial, check_every);
+}
+
+/**
+ * @brief Device-resident gradient descent of every tv_denoise_gradient_descent_chunked overload,
+ *        progress, checkpoint, initial (the input by default) and budget may be nullptr.
+ */
+static Image gradient_descent_chunked(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const Image& input, float strength, float step_size, float tol, bool suppress_log, int check_every, int chunk_size,
+	const ProgressOptions* progress, const CheckpointOptions* checkpoint, const Image* initial, SolveBudget* budget
+) {
+	const int rows = input.getRows();
+	const int cols = input.getCols();
+	const int img_size = rows * cols;
+
+	if (check_every < 1 || chunk_size < 1) {
+		throw std::invalid_argument("Convergence check frequency and chunk size must be at least 1.");
+	}
+	if (initial && (initial->getRows() != rows || initial->getCols() != cols)) {
+		throw std::invalid_argument("Initial image must have the same size as the input image.");
+	}
+
+	int extended_size = 1;
+	while (extended_size < img_size) {
+		extended_size *= 2;
+	}
+
+	const float momentum_beta = 0.9f;
+	const float loss_smoothing_beta = 0.9f;
+	const float check_smoothing_beta = static_cast<float>(std::pow(loss_smoothing_beta, check_every));
+	const float step = step_size / (strength + 1);
+	const float eps = 1e-8f;
+
+	// Every buffer stays on the device for the whole solve, the zero initialization of the
+	// borders (never written by the kernels) and of the padding of the loss is done only once
+	std::vector<float> zeros(extended_size, 0.0f);
+
+	cl::Buffer img_buffer(context, CL_MEM_READ_WRITE, img_size * sizeof(float));
+	queue.enqueueWriteBuffer(img_buffer, CL_TRUE, 0, img_size * sizeof(float), initial ? initial->data() : input.data());
+
+	cl::Buffer orig_buffer(context, CL_MEM_READ_WRITE, img_size * sizeof(float));
+	queue.enqueueWriteBuffer(orig_buffer, CL_TRUE, 0, img_size * sizeof(float), input.data());
+
+	cl::Buffer momentum_buffer(context, CL_MEM_READ_WRITE, img_size * sizeof(float));
+	queue.enqueueWriteBuffer(momentum_buffer, CL_TRUE, 0, img_size * sizeof(float), zeros.data());
+
+	cl::Buffer tv_norm_mtx_buffer(context, CL_MEM_READ_WRITE, img_size * sizeof(float));
+	queue.enqueueWriteBuffer(tv_norm_mtx_buffer, CL_TRUE, 0, img_size * sizeof(float), zeros.data());
+
+	cl::Buffer dx_mtx_buffer(context, CL_MEM_READ_WRITE, img_size * sizeof(float));
+	queue.enqueueWriteBuffer(dx_mtx_buffer, CL_TRUE, 0, img_size * sizeof(float), zeros.data());
+
+	cl::Buffer dy_mtx_buffer(context, CL_MEM_READ_WRITE, img_size * sizeof(float));
+	queue.enqueueWriteBuffer(dy_mtx_buffer, CL_TRUE, 0, img_size * sizeof(float), zeros.data());
+
+	cl::Buffer tv_grad_buffer(context, CL_MEM_READ_WRITE, img_size * sizeof(float));
+	cl::Buffer grad_buffer(context, CL_MEM_READ_WRITE, img_size * sizeof(float));
+	cl::Buffer l2_norm_mtx_buffer(context, CL_MEM_READ_WRITE, img_size * sizeof(float));
+
+	cl::Buffer loss_mtx_buffer(context, CL_MEM_READ_WRITE, extended_size * sizeof(float));
+	queue.enqueueWriteBuffer(loss_mtx_buffer, CL_TRUE, 0, extended_size * sizeof(float), zeros.data());
 
+	// state: smoothed loss, last loss, converged flag, iteration of convergence
+	float state[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	cl::Buffer state_buffer(context, CL_MEM_READ_WRITE, sizeof(state));
+
+	// Resuming restores the iterate, the momentum, the smoothed loss and the counters
+	int checks = 0;
+	int counter = 1;
+	std::unique_ptr<SolverCheckpoint> resumed = checkpoint
+		? load_resume_checkpoint(*checkpoint, rows, cols, strength, step_size, check_every) : nullptr;
+	if (resumed) {
+		queue.enqueueWriteBuffer(img_buffer, CL_TRUE, 0, img_size * sizeof(float), resumed->img.data());
+		queue.enqueueWriteBuffer(momentum_buffer, CL_TRUE, 0, img_size * sizeof(float), resumed->momentum.data());
+		state[0] = resumed->loss_smoothed;
+		checks = resumed->checks;
+		counter = resumed->counter;
 		if (!suppress_log) {
-			std::cout << "Iteration: " << counter << ", Loss: " << loss << std::endl;
+			std::cout << "Resumed at iteration " << counter << std::endl;
 		}
+	}
+	queue.enqueueWriteBuffer(state_buffer, CL_TRUE, 0, sizeof(state), state);
 
-		loss_smoothed = loss_smoothed * loss_smoothing_beta + loss * (1.0f - loss_smoothing_beta);
+	// Checkpoints are taken between two chunks, the state is read back and written in the background.
+	// A chunk ends at the next checkpoint, so they are taken at the same iterations as on the CPU.
+	std::unique_ptr<CheckpointWriter> writer;
+	if (checkpoint && checkpoint->interval_iterations > 0) {
+		writer.reset(new CheckpointWriter(checkpoint->path));
+	}
+	const int first_iteration = counter;
+
+	cl::Kernel tv_kernel(program, "tv_norm_mtx_and_dx_dy");
+	tv_kernel.setArg(0, img_buffer);
+	tv_kernel.setArg(1, tv_norm_mtx_buffer);
+	tv_kernel.setArg(2, dx_mtx_buffer);
+	tv_kernel.setArg(3, dy_mtx_buffer);
+	tv_kernel.setArg(4, rows);
+	tv_kernel.setArg(5, cols);
+	tv_kernel.setArg(6, eps);
+
+	std::vector<cl::Kernel> grad_kernels;
+	for (int i = 1; i <= 3; ++i) {
+		std::string kernel_name = "grad_from_dx_dy_step" + std::to_string(i);
+		cl::Kernel kernel(program, kernel_name.c_str());
+		kernel.setArg(0, dx_mtx_buffer);
+		kernel.setArg(1, dy_mtx_buffer);
+		kernel.setArg(2, tv_grad_buffer);
+		kernel.setArg(3, rows);
+		kernel.setArg(4, cols);
+		grad_kernels.push_back(kernel);
+	}
 
-		float loss_smoothed_debiased = loss_smoothed / (1.0f - static_cast<float>(std::pow(loss_smoothing_beta, counter)));
-		if (counter > 1 && loss_smoothed_debiased / loss < 1.0f + tol) {
+	cl::Kernel l2_kernel(program, "l2_norm_mtx_and_grad");
+	l2_kernel.setArg(0, img_buffer);
+	l2_kernel.setArg(1, orig_buffer);
+	l2_kernel.setArg(2, l2_norm_mtx_buffer);
+	l2_kernel.setArg(3, grad_buffer);
+	l2_kernel.setArg(4, rows);
+	l2_kernel.setArg(5, cols);
+
+	cl::Kernel combine_kernel(program, "eval_loss_and_grad");
+	combine_kernel.setArg(0, grad_buffer);
+	combine_kernel.setArg(1, tv_grad_buffer);
+	combine_kernel.setArg(2, strength);
+
+	cl::Kernel loss_kernel(program, "loss_mtx");
+	loss_kernel.setArg(0, tv_norm_mtx_buffer);
+	loss_kernel.setArg(1, l2_norm_mtx_buffer);
+	loss_kernel.setArg(2, loss_mtx_buffer);
+	loss_kernel.setArg(3, strength);
+
+	cl::Kernel sum_kernel = init_sum_kernel<float>(program);
+	sum_kernel.setArg(0, loss_mtx_buffer);
+
+	cl::Kernel check_kernel(program, "convergence_check");
+	check_kernel.setArg(0, loss_mtx_buffer);
+	check_kernel.setArg(1, state_buffer);
+	check_kernel.setArg(2, check_smoothing_beta);
+	check_kernel.setArg(3, tol);
+	check_kernel.setArg(6, initial ? 1 : 0);
+
+	cl::Kernel update_kernel(program, "momentum_update_img");
+	update_kernel.setArg(0, img_buffer);
+	update_kernel.setArg(1, momentum_buffer);
+	update_kernel.setArg(2, grad_buffer);
+	update_kernel.setArg(3, state_buffer);
+	update_kernel.setArg(4, step);
+	update_kernel.setArg(5, momentum_beta);
+
+	// Within a budget every check also keeps the iterate if its loss is the lowest so far (see SolveBudget).
+	// The deadline is checked after every chunk, the solve stops if the longest chunk so far would end past it.
+	cl::Buffer best_img_buffer;
+	cl::Buffer best_buffer;
+	cl::Kernel best_check_kernel;
+	cl::Kernel keep_best_kernel;
+	std::chrono::steady_clock::duration chunk_duration(0);
+	if (budget) {
+		const float best[2] = { std::numeric_limits<float>::max(), 0.0f };
+		best_buffer = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(best));
+		queue.enqueueWriteBuffer(best_buffer, CL_TRUE, 0, sizeof(best), best);
+		best_img_buffer = cl::Buffer(context, CL_MEM_READ_WRITE, img_size * sizeof(float));
+		queue.enqueueCopyBuffer(img_buffer, best_img_buffer, 0, 0, img_size * sizeof(float));
+
+		best_check_kernel = cl::Kernel(program, "best_loss_check");
+		best_check_kernel.setArg(0, state_buffer);
+		best_check_kernel.setArg(1, best_buffer);
+
+		keep_best_kernel = cl::Kernel(program, "keep_best_iterate");
+		keep_best_kernel.setArg(0, img_buffer);
+		keep_best_kernel.setArg(1, best_img_buffer);
+		keep_best_kernel.setArg(2, best_buffer);
+
+		budget->converged = false;
+		budget->exhausted = false;
+	}
+
+	// The preview is a downsampled copy of the iterate, read back asynchronously. It is enqueued after a chunk
+	// and handed to the callback once the next chunk is enqueued, so the callback runs while the device computes.
+	ProgressSchedule schedule(progress);
+	const int preview_factor = progress ? std::max(progress->preview_factor, 1) : 1;
+	const int preview_rows = (rows + preview_factor - 1) / preview_factor;
+	const int preview_cols = (cols + preview_factor - 1) / preview_factor;
+	Image preview(preview_rows, preview_cols);
+	cl::Buffer preview_buffer(context, CL_MEM_READ_WRITE, preview_rows * preview_cols * sizeof(float));
+
+	cl::Kernel preview_kernel(program, "downsample_preview");
+	preview_kernel.setArg(0, img_buffer);
+	preview_kernel.setArg(1, preview_buffer);
+	preview_kernel.setArg(2, rows);
+	preview_kernel.setArg(3, cols);
+	preview_kernel.setArg(4, preview_factor);
+	preview_kernel.setArg(5, preview_cols);
+
+	cl::Event preview_event;
+	bool preview_pending = false;
+	int preview_iteration = 0;
+	float preview_loss = 0.0f;
+
+	// Iterations are enqueued in chunks without any synchronization, the convergence test runs on the device
+	// and only its flag is read back after each chunk. Once converged, the remaining updates of the chunk are no-ops.
+	while (true) {
+		if (schedule.cancelled()) {
+			// The pending read still writes to the preview
+			if (preview_pending) {
+				preview_event.wait();
+			}
 			if (!suppress_log) {
-				std::cout << "Converged after " << counter << " iterations with loss: " << loss_smoothed_debiased << std::endl;
+				std::cout << "Cancelled after " << counter - 1 << " iterations" << std::endl;
 			}
 			break;
 		}
 
-		eval_momentum(context, queue, program, momentum, grad, momentum_beta, img_size);
-		update_img(context, queue, program, img.data(), momentum, img_size, step, momentum_beta, counter);
+		if (writer && counter > first_iteration && (counter - 1) % checkpoint->interval_iterations == 0) {
+			std::shared_ptr<SolverCheckpoint> state_copy = std::make_shared<SolverCheckpoint>(SolverCheckpoint{
+				counter, checks, state[0], strength, step_size, check_every, Image(rows, cols), Image(rows, cols)
+			});
+			queue.enqueueReadBuffer(img_buffer, CL_FALSE, 0, img_size * sizeof(float), state_copy->img.data());
+			queue.enqueueReadBuffer(momentum_buffer, CL_TRUE, 0, img_size * sizeof(float), state_copy->momentum.data());
+			writer->write(state_copy);
+		}
 
-		++counter;
+		const int chunk_length = writer
+			? std::min(chunk_size, checkpoint->interval_iterations - (counter - 1) % checkpoint->interval_iterations)
+			: chunk_size;
+		const auto chunk_start = std::chrono::steady_clock::now();
+		bool last_iteration = false;
+		for (int i = 0; i < chunk_length; ++i, ++counter) {
+			// The iterate after the last iteration of a budget is only checked, not updated
+			last_iteration = budget && budget->max_iterations > 0 && counter > budget->max_iterations;
+
+			queue.enqueueNDRangeKernel(tv_kernel, cl::NullRange, img_size, cl::NullRange);
+			for (cl::Kernel& kernel : grad_kernels) {
+				queue.enqueueNDRangeKernel(kernel, cl::NullRange, img_size, cl::NullRange);
+			}
+			queue.enqueueNDRangeKernel(l2_kernel, cl::NullRange, img_size, cl::NullRange);
+			queue.enqueueNDRangeKernel(combine_kernel, cl::NullRange, img_size, cl::NullRange);
+
+			if ((counter - 1) % check_every == 0 || last_iteration) {
+				++checks;
+				queue.enqueueNDRangeKernel(loss_kernel, cl::NullRange, img_size, cl::NullRange);
+				for (int offset = extended_size / 2; offset > 0; offset >>= 1) {
+					sum_kernel.setArg(1, offset);
+					queue.enqueueNDRangeKernel(sum_kernel, cl::NullRange, offset, cl::NullRange);
+				}
+				check_kernel.setArg(4, checks);
+				check_kernel.setArg(5, counter);
+				queue.enqueueNDRangeKernel(check_kernel, cl::NullRange, 1, cl::NullRange);
+
+				if (budget) {
+					queue.enqueueNDRangeKernel(best_check_kernel, cl::NullRange, 1, cl::NullRange);
+					queue.enqueueNDRangeKernel(keep_best_kernel, cl::NullRange, img_size, cl::NullRange);
+				}
+			}
+			if (last_iteration) {
+				break;
+			}
+
+			update_kernel.setArg(6, counter);
+			queue.enqueueNDRangeKernel(update_kernel, cl::NullRange, img_size, cl::NullRange);
+		}
+
+		if (preview_pending) {
+			queue.flush();
+			preview_event.wait();
+			schedule.report(preview_iteration, preview_loss, preview);
+			preview_pending = false;
+		}
+
+		queue.enqueueReadBuffer(state_buffer, CL_TRUE, 0, sizeof(state), state);
+
+		if (!suppress_log) {
+			std::cout << "Iteration: " << counter - 1 << ", Loss: " << state[1] << std::endl;
+		}
+		if (state[2] != 0.0f) {
+			if (!suppress_log) {
+				const float loss_smoothed_debiased = state[0] / (1.0f - static_cast<float>(std::pow(check_smoothing_beta, checks)));
+				std::cout << "Converged after " << static_cast<int>(state[3]) << " iterations with loss: " << loss_smoothed_debiased << std::endl;
+			}
+			break;
+		}
+
+		if (budget) {
+			const auto now = std::chrono::steady_clock::now();
+			chunk_duration = std::max(chunk_duration, now - chunk_start);
+			if (last_iteration || now >= budget->deadline || budget->deadline - now < chunk_duration) {
+				if (!suppress_log) {
+					std::cout << "Budget exhausted after " << counter - 1 << " iterations" << std::endl;
+				}
+				budget->exhausted = true;
+				break;
+			}
+		}
+
+		if (schedule.due(counter - 1)) {
+			queue.enqueueNDRangeKernel(preview_kernel, cl::NullRange, preview_rows * preview_cols, cl::NullRange);
+			queue.enqueueReadBuffer(
+				preview_buffer, CL_FALSE, 0, preview_rows * preview_cols * sizeof(float), preview.data(), nullptr, &preview_event
+			);
+			preview_pending = true;
+			preview_iteration = counter - 1;
+			preview_loss = state[1];
+		}
+	}
+
+	if (writer) {
+		writer->wait();
+	}
+
+	Image img(rows, cols);
+	if (budget) {
+		budget->converged = state[2] != 0.0f;
+		budget->iterations = budget->converged ? static_cast<int>(state[3]) - 1 : counter - 1;
+		if (!budget->converged) {
+			float best[2];
+			queue.enqueueReadBuffer(best_buffer, CL_TRUE, 0, sizeof(best), best);
+			queue.enqueueReadBuffer(best_img_buffer, CL_TRUE, 0, img_size * sizeof(float), img.data());
+			budget->loss = best[0];
+			return img;
+		}
+		budget->loss = state[1];
+	}
+	queue.enqueueReadBuffer(img_buffer, CL_TRUE, 0, img_size * sizeof(float), img.data());
+
+	return img;
+}
+
+Image tv_denoise_gradient_descent_chunked(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const Image& input, float strength, float step_size, float tol, bool suppress_log, int check_every, int chunk_size
+) {
+	return gradient_descent_chunked(context, queue, program, input, strength, step_size, tol, suppress_log, check_every, chunk_size, nullptr, nullptr, nullptr, nullptr);
+}
+
+Image tv_denoise_gradient_descent_chunked(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const Image& input, float strength, float step_size, float tol, bool suppress_log, const ProgressOptions& progress,
+	int check_every, int chunk_size
+) {
+	return gradient_descent_chunked(context, queue, program, input, strength, step_size, tol, suppress_log, check_every, chunk_size, &progress, nullptr, nullptr, nullptr);
+}
+
+Image tv_denoise_gradient_descent_chunked(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const Image& input, float strength, float step_size, float tol, bool suppress_log, const CheckpointOptions& checkpoint,
+	int check_every, int chunk_size
+) {
+	return gradient_descent_chunked(context, queue, program, input, strength, step_size, tol, suppress_log, check_every, chunk_size, nullptr, &checkpoint, nullptr, nullptr);
+}
+
+Image tv_denoise_gradient_descent_chunked(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const Image& input, float strength, float step_size, float tol, bool suppress_log, const Image& initial, SolveBudget& budget,
+	int check_every, int chunk_size
+) {
+	return gradient_descent_chunked(context, queue, program, input, strength, step_size, tol, suppress_log, check_every, chunk_size, nullptr, nullptr, &initial, &budget);
+}
+
+/**
+ * @brief Uploads an image to a new device buffer in the given storage format.
+ */
+static cl::Buffer upload_with_precision(
+	cl::Context& context, cl::CommandQueue& queue, const float* values, int size, StoragePrecision precision
+) {
+	if (precision == StoragePrecision::Float32) {
+		cl::Buffer buffer(context, CL_MEM_READ_WRITE, size * sizeof(float));
+		queue.enqueueWriteBuffer(buffer, CL_TRUE, 0, size * sizeof(float), values);
+		return buffer;
+	}
+
+	std::vector<uint16_t> compact(size);
+	if (precision == StoragePrecision::Float16) {
+		float_to_half(values, compact.data(), size);
+	}
+	else {
+		float_to_bfloat16(values, compact.data(), size);
+	}
+	cl::Buffer buffer(context, CL_MEM_READ_WRITE, size * sizeof(uint16_t));
+	queue.enqueueWriteBuffer(buffer, CL_TRUE, 0, size * sizeof(uint16_t), compact.data());
+	return buffer;
+}
+
+/**
+ * @brief Reads back a device buffer stored in the given storage format.
+ */
+static void download_with_precision(
+	cl::CommandQueue& queue, const cl::Buffer& buffer, float* values, int size, StoragePrecision precision
+) {
+	if (precision == StoragePrecision::Float32) {
+		queue.enqueueReadBuffer(buffer, CL_TRUE, 0, size * sizeof(float), values);
+		return;
+	}
+
+	std::vector<uint16_t> compact(size);
+	queue.enqueueReadBuffer(buffer, CL_TRUE, 0, size * sizeof(uint16_t), compact.data());
+	if (precision == StoragePrecision::Float16) {
+		half_to_float(compact.data(), values, size);
+	}
+	else {
+		bfloat16_to_float(compact.data(), values, size);
+	}
+}
+
+static const char* precision_suffix(StoragePrecision precision) {
+	switch (precision) {
+	case StoragePrecision::Float16:
+		return "f16";
+	case StoragePrecision::BFloat16:
+		return "bf16";
+	default:
+		return "f32";
+	}
+}
+
+Image tv_denoise_gradient_descent_mixed(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const Image& input, float strength, float step_size, float tol, bool suppress_log,
+	StoragePrecision precision, bool compact_image, int check_every, int chunk_size
+) {
+	const int rows = input.getRows();
+	const int cols = input.getCols();
+	const int img_size = rows * cols;
+
+	if (check_every < 1 || chunk_size < 1) {
+		throw std::invalid_argument("Convergence check frequency and chunk size must be at least 1.");
+	}
+
+	int extended_size = 1;
+	while (extended_size < img_size) {
+		extended_size *= 2;
+	}
+
+	const float momentum_beta = 0.9f;
+	const float loss_smoothing_beta = 0.9f;
+	const float check_smoothing_beta = static_cast<float>(std::pow(loss_smoothing_beta, check_every));
+	const float step = step_size / (strength + 1);
+	const float eps = 1e-8f;
+
+	const StoragePrecision image_precision = compact_image ? precision : StoragePrecision::Float32;
+	std::vector<float> zeros(extended_size, 0.0f);
+
+	// The iterate is double buffered: every pixel of the fused kernel reads its neighbours
+	cl::Buffer img_buffers[2] = {
+		upload_with_precision(context, queue, input.data(), img_size, image_precision),
+		upload_with_precision(context, queue, input.data(), img_size, image_precision)
+	};
+	cl::Buffer orig_buffer = upload_with_precision(context, queue, input.data(), img_size, precision);
+	cl::Buffer momentum_buffer = upload_with_precision(context, queue, zeros.data(), img_size, precision);
+
+	cl::Buffer loss_mtx_buffer(context, CL_MEM_READ_WRITE, extended_size * sizeof(float));
+	queue.enqueueWriteBuffer(loss_mtx_buffer, CL_TRUE, 0, extended_size * sizeof(float), zeros.data());
+
+	// state: smoothed loss, last loss, converged flag, iteration of convergence
+	float state[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	cl::Buffer state_buffer(context, CL_MEM_READ_WRITE, sizeof(state));
+	queue.enqueueWriteBuffer(state_buffer, CL_TRUE, 0, sizeof(state), state);
+
+	const std::string kernel_name = std::string("mixed_step_") + precision_suffix(precision) + "_" + precision_suffix(image_precision);
+	cl::Kernel step_kernel(program, kernel_name.c_str());
+	step_kernel.setArg(2, orig_buffer);
+	step_kernel.setArg(3, momentum_buffer);
+	step_kernel.setArg(4, loss_mtx_buffer);
+	step_kernel.setArg(5, state_buffer);
+	step_kernel.setArg(6, rows);
+	step_kernel.setArg(7, cols);
+	step_kernel.setArg(8, strength);
+	step_kernel.setArg(9, eps);
+	step_kernel.setArg(10, step);
+	step_kernel.setArg(11, momentum_beta);
+
+	cl::Kernel sum_kernel = init_sum_kernel<float>(program);
+	sum_kernel.setArg(0, loss_mtx_buffer);
+
+	cl::Kernel check_kernel(program, "convergence_check");
+	check_kernel.setArg(0, loss_mtx_buffer);
+	check_kernel.setArg(1, state_buffer);
+	check_kernel.setArg(2, check_smoothing_beta);
+	check_kernel.setArg(3, tol);
+	check_kernel.setArg(6, 0);
+
+	// Same chunked scheme as tv_denoise_gradient_descent_chunked, with a single kernel per iteration
+	int checks = 0;
+	int counter = 1;
+	while (true) {
+		for (int i = 0; i < chunk_size; ++i, ++counter) {
+			const int eval_loss = (counter - 1) % check_every == 0 ? 1 : 0;
+
+			step_kernel.setArg(0, img_buffers[(counter - 1) % 2]);
+			step_kernel.setArg(1, img_buffers[counter % 2]);
+			step_kernel.setArg(12, counter);
+			step_kernel.setArg(13, eval_loss);
+			queue.enqueueNDRangeKernel(step_kernel, cl::NullRange, img_size, cl::NullRange);
+
+			if (eval_loss) {
+				++checks;
+				for (int offset = extended_size / 2; offset > 0; offset >>= 1) {
+					sum_kernel.setArg(1, offset);
+					queue.enqueueNDRangeKernel(sum_kernel, cl::NullRange, offset, cl::NullRange);
+				}
+				check_kernel.setArg(4, checks);
+				check_kernel.setArg(5, counter);
+				queue.enqueueNDRangeKernel(check_kernel, cl::NullRange, 1, cl::NullRange);
+			}
+		}
+
+		queue.enqueueReadBuffer(state_buffer, CL_TRUE, 0, sizeof(state), state);
+
+		if (!suppress_log) {
+			std::cout << "Iteration: " << counter - 1 << ", Loss: " << state[1] << std::endl;
+		}
+		if (state[2] != 0.0f) {
+			if (!suppress_log) {
+				const float loss_smoothed_debiased = state[0] / (1.0f - static_cast<float>(std::pow(check_smoothing_beta, checks)));
+				std::cout << "Converged after " << static_cast<int>(state[3]) << " iterations with loss: " << loss_smoothed_debiased << std::endl;
+			}
+			break;
+		}
+	}
+
+	// The loss of the converged iteration was evaluated on its input, the update it made is dropped
+	const int converged_iteration = static_cast<int>(state[3]);
+	Image img(rows, cols);
+	download_with_precision(queue, img_buffers[(converged_iteration - 1) % 2], img.data(), img_size, image_precision);
+
+	return img;
+}
+
+std::string tv_model_build_options(const TvModel& model) {
+	std::string options = "-D TV_VARIANT=" + std::to_string(static_cast<int>(model.variant))
+		+ " -D TV_BOUNDARY=" + std::to_string(static_cast<int>(model.boundary));
+	if (model.scalar == ScalarType::Double) {
+		options += " -D TV_DOUBLE";
+	}
+	return options;
+}
+
+Image tv_denoise_gradient_descent_model(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const Image& input, float strength, float step_size, float tol, bool suppress_log, const TvModel& model,
+	int check_every, int chunk_size
+) {
+	const int rows = input.getRows();
+	const int cols = input.getCols();
+	const int img_size = rows * cols;
+
+	if (check_every < 1 || chunk_size < 1) {
+		throw std::invalid_argument("Convergence check frequency and chunk size must be at least 1.");
+	}
+	if (model.variant == TvVariant::Huber && !(model.huber_delta > 0.0f)) {
+		throw std::invalid_argument("The Huber threshold must be positive.");
+	}
+
+	// A program built for another model would silently solve that one
+	const int expected_id = static_cast<int>(model.variant) * 100 + static_cast<int>(model.boundary) * 10
+		+ (model.scalar == ScalarType::Double ? 1 : 0);
+	int program_id = -1;
+	cl::Buffer id_buffer(context, CL_MEM_READ_WRITE, sizeof(int));
+	cl::Kernel id_kernel(program, "model_id");
+	id_kernel.setArg(0, id_buffer);
+	queue.enqueueNDRangeKernel(id_kernel, cl::NullRange, 1, cl::NullRange);
+	queue.enqueueReadBuffer(id_buffer, CL_TRUE, 0, sizeof(int), &program_id);
+	if (program_id != expected_id) {
+		throw std::invalid_argument("The program was not built with the options of the TV model (see tv_model_build_options).");
+	}
+
+	int extended_size = 1;
+	while (extended_size < img_size) {
+		extended_size *= 2;
+	}
+
+	const float momentum_beta = 0.9f;
+	const float loss_smoothing_beta = 0.9f;
+	const float check_smoothing_beta = static_cast<float>(std::pow(loss_smoothing_beta, check_every));
+	const float step = step_size / (strength + 1);
+
+	// The iterate, the original image and the momentum are stored in the scalar type of the model
+	const bool use_double = model.scalar == ScalarType::Double;
+	const size_t scalar_size = use_double ? sizeof(double) : sizeof(float);
+	std::vector<double> input_double(input.data(), input.data() + img_size);
+	const void* input_values = use_double ? static_cast<const void*>(input_double.data()) : static_cast<const void*>(input.data());
+	std::vector<char> zero_values(img_size * scalar_size, 0);
+
+	// The iterate is double buffered: every pixel of the fused kernel reads its neighbours
+	cl::Buffer img_buffers[2] = {
+		cl::Buffer(context, CL_MEM_READ_WRITE, img_size * scalar_size),
+		cl::Buffer(context, CL_MEM_READ_WRITE, img_size * scalar_size)
+	};
+	cl::Buffer orig_buffer(context, CL_MEM_READ_WRITE, img_size * scalar_size);
+	cl::Buffer momentum_buffer(context, CL_MEM_READ_WRITE, img_size * scalar_size);
+	queue.enqueueWriteBuffer(img_buffers[0], CL_TRUE, 0, img_size * scalar_size, input_values);
+	queue.enqueueWriteBuffer(img_buffers[1], CL_TRUE, 0, img_size * scalar_size, input_values);
+	queue.enqueueWriteBuffer(orig_buffer, CL_TRUE, 0, img_size * scalar_size, input_values);
+	queue.enqueueWriteBuffer(momentum_buffer, CL_TRUE, 0, img_size * scalar_size, zero_values.data());
+
+	std::vector<float> zeros(extended_size, 0.0f);
+	cl::Buffer loss_mtx_buffer(context, CL_MEM_READ_WRITE, extended_size * sizeof(float));
+	queue.enqueueWriteBuffer(loss_mtx_buffer, CL_TRUE, 0, extended_size * sizeof(float), zeros.data());
+
+	// state: smoothed loss, last loss, converged flag, iteration of convergence
+	float state[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	cl::Buffer state_buffer(context, CL_MEM_READ_WRITE, sizeof(state));
+	queue.enqueueWriteBuffer(state_buffer, CL_TRUE, 0, sizeof(state), state);
+
+	cl::Kernel step_kernel(program, "model_step");
+	step_kernel.setArg(2, orig_buffer);
+	step_kernel.setArg(3, momentum_buffer);
+	step_kernel.setArg(4, loss_mtx_buffer);
+	step_kernel.setArg(5, state_buffer);
+	step_kernel.setArg(6, rows);
+	step_kernel.setArg(7, cols);
+	step_kernel.setArg(8, strength);
+	step_kernel.setArg(9, model.eps);
+	step_kernel.setArg(10, model.huber_delta);
+	step_kernel.setArg(11, step);
+	step_kernel.setArg(12, momentum_beta);
+
+	cl::Kernel sum_kernel = init_sum_kernel<float>(program);
+	sum_kernel.setArg(0, loss_mtx_buffer);
+
+	cl::Kernel check_kernel(program, "convergence_check");
+	check_kernel.setArg(0, loss_mtx_buffer);
+	check_kernel.setArg(1, state_buffer);
+	check_kernel.setArg(2, check_smoothing_beta);
+	check_kernel.setArg(3, tol);
+	check_kernel.setArg(6, 0);
+
+	int checks = 0;
+	int counter = 1;
+	while (true) {
+		for (int i = 0; i < chunk_size; ++i, ++counter) {
+			const int eval_loss = (counter - 1) % check_every == 0 ? 1 : 0;
+
+			step_kernel.setArg(0, img_buffers[(counter - 1) % 2]);
+			step_kernel.setArg(1, img_buffers[counter % 2]);
+			step_kernel.setArg(13, counter);
+			step_kernel.setArg(14, eval_loss);
+			queue.enqueueNDRangeKernel(step_kernel, cl::NullRange, img_size, cl::NullRange);
+
+			if (eval_loss) {
+				++checks;
+				for (int offset = extended_size / 2; offset > 0; offset >>= 1) {
+					sum_kernel.setArg(1, offset);
+					queue.enqueueNDRangeKernel(sum_kernel, cl::NullRange, offset, cl::NullRange);
+				}
+				check_kernel.setArg(4, checks);
+				check_kernel.setArg(5, counter);
+				queue.enqueueNDRangeKernel(check_kernel, cl::NullRange, 1, cl::NullRange);
+			}
+		}
+
+		queue.enqueueReadBuffer(state_buffer, CL_TRUE, 0, sizeof(state), state);
+
+		if (!suppress_log) {
+			std::cout << "Iteration: " << counter - 1 << ", Loss: " << state[1] << std::endl;
+		}
+		if (state[2] != 0.0f) {
+			if (!suppress_log) {
+				const float loss_smoothed_debiased = state[0] / (1.0f - static_cast<float>(std::pow(check_smoothing_beta, checks)));
+				std::cout << "Converged after " << static_cast<int>(state[3]) << " iterations with loss: " << loss_smoothed_debiased << std::endl;
+			}
+			break;
+		}
+	}
 
-		delete[] grad;
+	// The loss of the converged iteration was evaluated on its input, the update it made is dropped
+	const int converged_iteration = static_cast<int>(state[3]);
+	const cl::Buffer& result_buffer = img_buffers[(converged_iteration - 1) % 2];
+	Image img(rows, cols);
+	if (use_double) {
+		queue.enqueueReadBuffer(result_buffer, CL_TRUE, 0, img_size * sizeof(double), input_double.data());
+		std::transform(input_double.begin(), input_double.end(), img.data(), [](double value) { return static_cast<float>(value); });
+	}
+	else {
+		queue.enqueueReadBuffer(result_buffer, CL_TRUE, 0, img_size * sizeof(float), img.data());
 	}
 
 	return img;
 }
+
+Image tv_denoise_gradient_descent_active_set(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const Image& input, float strength, float step_size, float tol, bool suppress_log, int tile_size, float freeze_threshold
+) {
+	const int rows = input.getRows();
+	const int cols = input.getCols();
+	const int img_size = rows * cols;
+	const float eps = 1e-8f;
+
+	// A work-group processes a tile, the reductions over the tile need a power of two local size
+	const int local_size = tile_size * tile_size;
+	if (tile_size < 1 || (local_size & (local_size - 1)) != 0) {
+		throw std::invalid_argument("Tile size must be a power of two.");
+	}
+
+	const int tile_rows = (rows + tile_size - 1) / tile_size;
+	const int tile_cols = (cols + tile_size - 1) / tile_size;
+	const int num_tiles = tile_rows * tile_cols;
+
+	cl::Buffer img_buffer(context, CL_MEM_READ_WRITE, img_size * sizeof(float));
+	queue.enqueueWriteBuffer(img_buffer, CL_TRUE, 0, img_size * sizeof(float), input.data());
+
+	cl::Buffer orig_buffer(context, CL_MEM_READ_WRITE, img_size * sizeof(float));
+	queue.enqueueWriteBuffer(orig_buffer, CL_TRUE, 0, img_size * sizeof(float), input.data());
+
+	cl::Buffer snapshot_buffer(context, CL_MEM_READ_WRITE, img_size * sizeof(float));
+	queue.enqueueWriteBuffer(snapshot_buffer, CL_TRUE, 0, img_size * sizeof(float), input.data());
+
+	cl::Buffer momentum_buffer(context, CL_MEM_READ_WRITE, img_size * sizeof(float));
+	queue.enqueueWriteBuffer(momentum_buffer, CL_TRUE, 0, img_size * sizeof(float), std::vector<float>(img_size, 0.0f).data());
+
+	cl::Buffer grad_buffer(context, CL_MEM_READ_WRITE, img_size * sizeof(float));
+
+	// Per tile: its loss contribution when it was last active and its drift over the last tracking window
+	std::vector<cl_long> tile_loss(num_tiles, 0);
+	cl::Buffer tile_loss_buffer(context, CL_MEM_READ_WRITE, num_tiles * sizeof(cl_long));
+	queue.enqueueWriteBuffer(tile_loss_buffer, CL_TRUE, 0, num_tiles * sizeof(cl_long), tile_loss.data());
+
+	std::vector<float> tile_drift(num_tiles * 7, 0.0f);
+	cl::Buffer tile_drift_buffer(context, CL_MEM_READ_WRITE, num_tiles * 7 * sizeof(float));
+
+	std::vector<char> active(num_tiles, 1);
+	std::vector<int> active_tiles;
+	cl::Buffer active_tiles_buffer(context, CL_MEM_READ_WRITE, num_tiles * sizeof(int));
+
+	cl::Kernel grad_kernel(program, "active_tiles_grad");
+	grad_kernel.setArg(0, img_buffer);
+	grad_kernel.setArg(1, orig_buffer);
+	grad_kernel.setArg(2, grad_buffer);
+	grad_kernel.setArg(3, tile_loss_buffer);
+	grad_kernel.setArg(4, active_tiles_buffer);
+	grad_kernel.setArg(5, rows);
+	grad_kernel.setArg(6, cols);
+	grad_kernel.setArg(7, tile_size);
+	grad_kernel.setArg(8, tile_cols);
+	grad_kernel.setArg(9, strength);
+	grad_kernel.setArg(10, eps);
+	grad_kernel.setArg(11, cl::Local(local_size * sizeof(cl_long)));
+
+	cl::Kernel update_kernel(program, "active_tiles_update");
+	update_kernel.setArg(0, img_buffer);
+	update_kernel.setArg(1, momentum_buffer);
+	update_kernel.setArg(2, grad_buffer);
+	update_kernel.setArg(3, active_tiles_buffer);
+	update_kernel.setArg(4, rows);
+	update_kernel.setArg(5, cols);
+	update_kernel.setArg(6, tile_size);
+	update_kernel.setArg(7, tile_cols);
+
+	cl::Kernel drift_kernel(program, "active_tiles_drift");
+	drift_kernel.setArg(0, img_buffer);
+	drift_kernel.setArg(1, snapshot_buffer);
+	drift_kernel.setArg(2, tile_drift_buffer);
+	drift_kernel.setArg(3, active_tiles_buffer);
+	drift_kernel.setArg(4, rows);
+	drift_kernel.setArg(5, cols);
+	drift_kernel.setArg(6, tile_size);
+	drift_kernel.setArg(7, tile_cols);
+	drift_kernel.setArg(8, cl::Local(5 * local_size * sizeof(float)));
+
+	// Reactivated tiles are listed in their own buffer, the active tile list is rewritten in the next iteration anyway
+	std::vector<int> reactivated_tiles;
+	cl::Buffer reactivated_tiles_buffer(context, CL_MEM_READ_ONLY, num_tiles * sizeof(int));
+
+	cl::Kernel reset_kernel(program, "active_tiles_reset_momentum");
+	reset_kernel.setArg(0, momentum_buffer);
+	reset_kernel.setArg(1, reactivated_tiles_buffer);
+	reset_kernel.setArg(2, rows);
+	reset_kernel.setArg(3, cols);
+	reset_kernel.setArg(4, tile_size);
+	reset_kernel.setArg(5, tile_cols);
+
+	const float momentum_beta = 0.9f;
+	const float loss_smoothing_beta = 0.9f;
+	float loss_smoothed = 0.0f;
+
+	// Same tracking windows as the CPU version
+	const int window = active_set_interval;
+
+	const float step = step_size / (strength + 1);
+
+	bool active_changed = true;
+	int counter = 1;
+	while (true) {
+		// The active tile list only changes at the end of a tracking window
+		if (active_changed) {
+			active_tiles.clear();
+			for (int tile = 0; tile < num_tiles; ++tile) {
+				if (active[tile]) {
+					active_tiles.push_back(tile);
+				}
+			}
+			if (!active_tiles.empty()) {
+				queue.enqueueWriteBuffer(active_tiles_buffer, CL_TRUE, 0, active_tiles.size() * sizeof(int), active_tiles.data());
+			}
+			active_changed = false;
+		}
+		const int global_size = static_cast<int>(active_tiles.size()) * local_size;
+
+		if (!active_tiles.empty()) {
+			queue.enqueueNDRangeKernel(grad_kernel, cl::NullRange, global_size, local_size);
+			queue.enqueueReadBuffer(tile_loss_buffer, CL_TRUE, 0, num_tiles * sizeof(cl_long), tile_loss.data());
+		}
+
+		// Frozen tiles contribute the loss they had when they were last updated
+		ReproducibleSum loss_sum;
+		for (int tile = 0; tile < num_tiles; ++tile) {
+			loss_sum.add_fixed(tile_loss[tile]);
+		}
+		const float loss = static_cast<float>(loss_sum.value());
+
+		if (!suppress_log) {
+			std::cout << "Iteration: " << counter << ", Loss: " << loss << ", Active tiles: " << active_tiles.size() << std::endl;
+		}
+
+		loss_smoothed = loss_smoothed * loss_smoothing_beta + loss * (1.0f - loss_smoothing_beta);
+		float loss_smoothed_debiased = loss_smoothed / (1.0f - static_cast<float>(std::pow(loss_smoothing_beta, counter)));
+		if (active_tiles.empty() || loss_converged(loss, loss_smoothed_debiased, tol, counter, false)) {
+			if (!suppress_log) {
+				std::cout << "Converged after " << counter << " iterations with loss: " << loss_smoothed_debiased << std::endl;
+			}
+			break;
+		}
+
+		update_kernel.setArg(8, step / (1.0f - static_cast<float>(std::pow(momentum_beta, counter))));
+		update_kernel.setArg(9, momentum_beta);
+		queue.enqueueNDRangeKernel(update_kernel, cl::NullRange, global_size, local_size);
+
+		if (counter % window == 0) {
+			queue.enqueueNDRangeKernel(drift_kernel, cl::NullRange, global_size, local_size);
+			queue.enqueueReadBuffer(tile_drift_buffer, CL_TRUE, 0, num_tiles * 7 * sizeof(float), tile_drift.data());
+
+			// A tile stays active while its pixels drift, a moving boundary (top, bottom, left, right, upper right
+			// and lower left corner) reactivates the neighbouring tile on that side
+			std::vector<char> next_active(num_tiles, 0);
+			for (int tile : active_tiles) {
+				const int tile_row = tile / tile_cols;
+				const int tile_col = tile % tile_cols;
+				const float* drift = &tile_drift[tile * 7];
+
+				if (drift[0] >= freeze_threshold) next_active[tile] = 1;
+				if (drift[1] >= freeze_threshold && tile_row > 0) next_active[tile - tile_cols] = 1;
+				if (drift[2] >= freeze_threshold && tile_row < tile_rows - 1) next_active[tile + tile_cols] = 1;
+				if (drift[3] >= freeze_threshold && tile_col > 0) next_active[tile - 1] = 1;
+				if (drift[4] >= freeze_threshold && tile_col < tile_cols - 1) next_active[tile + 1] = 1;
+				if (drift[5] >= freeze_threshold && tile_row > 0 && tile_col < tile_cols - 1) next_active[tile - tile_cols + 1] = 1;
+				if (drift[6] >= freeze_threshold && tile_row < tile_rows - 1 && tile_col > 0) next_active[tile + tile_cols - 1] = 1;
+			}
+
+			// A reactivated tile starts without momentum, as on the CPU
+			reactivated_tiles.clear();
+			for (int tile = 0; tile < num_tiles; ++tile) {
+				if (next_active[tile] && !active[tile]) {
+					reactivated_tiles.push_back(tile);
+				}
+			}
+			if (!reactivated_tiles.empty()) {
+				queue.enqueueWriteBuffer(reactivated_tiles_buffer, CL_TRUE, 0, reactivated_tiles.size() * sizeof(int), reactivated_tiles.data());
+				queue.enqueueNDRangeKernel(reset_kernel, cl::NullRange, static_cast<int>(reactivated_tiles.size()) * local_size, local_size);
+			}
+
+			active.swap(next_active);
+			active_changed = true;
+		}
+
+		++counter;
+	}
+
+	Image img(rows, cols);
+	queue.enqueueReadBuffer(img_buffer, CL_TRUE, 0, img_size * sizeof(float), img.data());
+
+	return img;
+}
+
+Image tv_denoise_gradient_descent_masked(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const Image& input, const Image& mask, float strength, float step_size, float tol, bool suppress_log, int tile_size
+) {
+	const int rows = input.getRows();
+	const int cols = input.getCols();
+	const int img_size = rows * cols;
+	const float eps = 1e-8f;
+
+	if (mask.getRows() != rows || mask.getCols() != cols) {
+		throw std::invalid_argument("Mask must have the same size as the input image.");
+	}
+	// A work-group processes a tile, the reduction over the tile needs a power of two local size
+	const int local_size = tile_size * tile_size;
+	if (tile_size < 1 || (local_size & (local_size - 1)) != 0) {
+		throw std::invalid_argument("Tile size must be a power of two.");
+	}
+
+	const int tile_rows = (rows + tile_size - 1) / tile_size;
+	const int tile_cols = (cols + tile_size - 1) / tile_size;
+	const int num_tiles = tile_rows * tile_cols;
+
+	// The domain is the list of tiles containing a masked pixel, the mask is uploaded per domain tile
+	std::vector<int> domain_tiles;
+	std::vector<int> tile_slot(num_tiles, -1);
+	std::vector<float> domain_mask;
+	for (int tile = 0; tile < num_tiles; ++tile) {
+		const int r0 = (tile / tile_cols) * tile_size;
+		const int c0 = (tile % tile_cols) * tile_size;
+		std::vector<float> tile_mask(local_size, 0.0f);
+		bool masked = false;
+		for (int i = r0; i < std::min(r0 + tile_size, rows); ++i) {
+			for (int j = c0; j < std::min(c0 + tile_size, cols); ++j) {
+				tile_mask[(i - r0) * tile_size + (j - c0)] = mask(i, j);
+				masked = masked || mask(i, j) > 0.0f;
+			}
+		}
+		if (masked) {
+			tile_slot[tile] = static_cast<int>(domain_tiles.size());
+			domain_tiles.push_back(tile);
+			domain_mask.insert(domain_mask.end(), tile_mask.begin(), tile_mask.end());
+		}
+	}
+	if (domain_tiles.empty()) {
+		return input;
+	}
+	const int num_slots = static_cast<int>(domain_tiles.size());
+	const int global_size = num_slots * local_size;
+
+	// The stencils read a halo around the domain, so the iterate is the whole frame, the rest only covers the domain
+	cl::Buffer img_buffer(context, CL_MEM_READ_WRITE, img_size * sizeof(float));
+	queue.enqueueWriteBuffer(img_buffer, CL_TRUE, 0, img_size * sizeof(float), input.data());
+
+	cl::Buffer orig_buffer(context, CL_MEM_READ_WRITE, img_size * sizeof(float));
+	queue.enqueueWriteBuffer(orig_buffer, CL_TRUE, 0, img_size * sizeof(float), input.data());
+
+	cl::Buffer mask_buffer(context, CL_MEM_READ_WRITE, global_size * sizeof(float));
+	queue.enqueueWriteBuffer(mask_buffer, CL_TRUE, 0, global_size * sizeof(float), domain_mask.data());
+
+	cl::Buffer momentum_buffer(context, CL_MEM_READ_WRITE, global_size * sizeof(float));
+	queue.enqueueWriteBuffer(momentum_buffer, CL_TRUE, 0, global_size * sizeof(float), std::vector<float>(global_size, 0.0f).data());
+
+	cl::Buffer grad_buffer(context, CL_MEM_READ_WRITE, global_size * sizeof(float));
+
+	cl::Buffer domain_tiles_buffer(context, CL_MEM_READ_WRITE, num_slots * sizeof(int));
+	queue.enqueueWriteBuffer(domain_tiles_buffer, CL_TRUE, 0, num_slots * sizeof(int), domain_tiles.data());
+
+	cl::Buffer tile_slot_buffer(context, CL_MEM_READ_WRITE, num_tiles * sizeof(int));
+	queue.enqueueWriteBuffer(tile_slot_buffer, CL_TRUE, 0, num_tiles * sizeof(int), tile_slot.data());
+
+	std::vector<cl_long> tile_loss(num_slots, 0);
+	cl::Buffer tile_loss_buffer(context, CL_MEM_READ_WRITE, num_slots * sizeof(cl_long));
+
+	cl::Kernel grad_kernel(program, "masked_tiles_grad");
+	grad_kernel.setArg(0, img_buffer);
+	grad_kernel.setArg(1, orig_buffer);
+	grad_kernel.setArg(2, grad_buffer);
+	grad_kernel.setArg(3, tile_loss_buffer);
+	grad_kernel.setArg(4, domain_tiles_buffer);
+	grad_kernel.setArg(5, tile_slot_buffer);
+	grad_kernel.setArg(6, rows);
+	grad_kernel.setArg(7, cols);
+	grad_kernel.setArg(8, tile_size);
+	grad_kernel.setArg(9, tile_cols);
+	grad_kernel.setArg(10, strength);
+	grad_kernel.setArg(11, eps);
+	grad_kernel.setArg(12, cl::Local(local_size * sizeof(cl_long)));
+
+	cl::Kernel update_kernel(program, "masked_tiles_update");
+	update_kernel.setArg(0, img_buffer);
+	update_kernel.setArg(1, momentum_buffer);
+	update_kernel.setArg(2, grad_buffer);
+	update_kernel.setArg(3, mask_buffer);
+	update_kernel.setArg(4, domain_tiles_buffer);
+	update_kernel.setArg(5, rows);
+	update_kernel.setArg(6, cols);
+	update_kernel.setArg(7, tile_size);
+	update_kernel.setArg(8, tile_cols);
+
+	const float momentum_beta = 0.9f;
+	const float loss_smoothing_beta = 0.9f;
+	float loss_smoothed = 0.0f;
+
+	const float step = step_size / (strength + 1);
+
+	int counter = 1;
+	while (true) {
+		queue.enqueueNDRangeKernel(grad_kernel, cl::NullRange, global_size, local_size);
+		queue.enqueueReadBuffer(tile_loss_buffer, CL_TRUE, 0, num_slots * sizeof(cl_long), tile_loss.data());
+
+		ReproducibleSum loss_sum;
+		for (cl_long value : tile_loss) {
+			loss_sum.add_fixed(value);
+		}
+		const float loss = static_cast<float>(loss_sum.value());
+
+		if (!suppress_log) {
+			std::cout << "Iteration: " << counter << ", Loss: " << loss << ", Domain tiles: " << num_slots << " of " << num_tiles << std::endl;
+		}
+
+		loss_smoothed = loss_smoothed * loss_smoothing_beta + loss * (1.0f - loss_smoothing_beta);
+		float loss_smoothed_debiased = loss_smoothed / (1.0f - static_cast<float>(std::pow(loss_smoothing_beta, counter)));
+		if (loss_converged(loss, loss_smoothed_debiased, tol, counter, false)) {
+			if (!suppress_log) {
+				std::cout << "Converged after " << counter << " iterations with loss: " << loss_smoothed_debiased << std::endl;
+			}
+			break;
+		}
+
+		update_kernel.setArg(9, step / (1.0f - static_cast<float>(std::pow(momentum_beta, counter))));
+		update_kernel.setArg(10, momentum_beta);
+		queue.enqueueNDRangeKernel(update_kernel, cl::NullRange, global_size, local_size);
+
+		++counter;
+	}
+
+	Image img(rows, cols);
+	queue.enqueueReadBuffer(img_buffer, CL_TRUE, 0, img_size * sizeof(float), img.data());
+
+	// Weights below 1 blend the denoised pixels with the input, which feathers the edge of the region
+	for (int tile : domain_tiles) {
+		const int r0 = (tile / tile_cols) * tile_size;
+		const int c0 = (tile % tile_cols) * tile_size;
+		for (int i = r0; i < std::min(r0 + tile_size, rows); ++i) {
+			for (int j = c0; j < std::min(c0 + tile_size, cols); ++j) {
+				const float weight = mask(i, j);
+				if (weight > 0.0f && weight < 1.0f) {
+					img(i, j) = input(i, j) + weight * (img(i, j) - input(i, j));
+				}
+			}
+		}
+	}
+
+	return img;
+}
+
+/**
+ * @brief Solves inputs[first, last) of tv_denoise_gradient_descent_batched in one atlas and appends them to results.
+ *
+ * The kernels index the atlas with int, the caller splits the batch so its padded size fits.
+ */
+static void gradient_descent_batch(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const std::vector<Image>& inputs, size_t first, size_t last, float strength, float step_size, float tol, bool suppress_log,
+	int check_every, int chunk_size, int block_size, std::vector<Image>& results
+) {
+	const int num_images = static_cast<int>(last - first);
+
+	// Atlas layout: the images one after the other, each split into blocks of block_size pixels
+	std::vector<int> image_info(num_images * 4);
+	std::vector<int> block_image;
+	int atlas_size = 0;
+	for (int image = 0; image < num_images; ++image) {
+		const Image& input = inputs[first + image];
+		const int size = input.getRows() * input.getCols();
+		image_info[image * 4] = atlas_size;
+		image_info[image * 4 + 1] = input.getRows();
+		image_info[image * 4 + 2] = input.getCols();
+		image_info[image * 4 + 3] = static_cast<int>(block_image.size());
+		block_image.insert(block_image.end(), (size + block_size - 1) / block_size, image);
+		atlas_size += size;
+	}
+	const int num_blocks = static_cast<int>(block_image.size());
+
+	std::vector<float> atlas(atlas_size);
+	for (int image = 0; image < num_images; ++image) {
+		const Image& input = inputs[first + image];
+		std::copy(input.data(), input.data() + input.getRows() * input.getCols(), atlas.begin() + image_info[image * 4]);
+	}
+
+	const float momentum_beta = 0.9f;
+	const float loss_smoothing_beta = 0.9f;
+	const float check_smoothing_beta = static_cast<float>(std::pow(loss_smoothing_beta, check_every));
+	const float step = step_size / (strength + 1);
+	const float eps = 1e-8f;
+
+	cl::Buffer img_buffer(context, CL_MEM_READ_WRITE, atlas_size * sizeof(float));
+	queue.enqueueWriteBuffer(img_buffer, CL_TRUE, 0, atlas_size * sizeof(float), atlas.data());
+
+	cl::Buffer orig_buffer(context, CL_MEM_READ_WRITE, atlas_size * sizeof(float));
+	queue.enqueueWriteBuffer(orig_buffer, CL_TRUE, 0, atlas_size * sizeof(float), atlas.data());
+
+	cl::Buffer momentum_buffer(context, CL_MEM_READ_WRITE, atlas_size * sizeof(float));
+	queue.enqueueWriteBuffer(momentum_buffer, CL_TRUE, 0, atlas_size * sizeof(float), std::vector<float>(atlas_size, 0.0f).data());
+
+	cl::Buffer grad_buffer(context, CL_MEM_READ_WRITE, atlas_size * sizeof(float));
+	cl::Buffer block_loss_buffer(context, CL_MEM_READ_WRITE, num_blocks * sizeof(cl_long));
+
+	cl::Buffer image_info_buffer(context, CL_MEM_READ_ONLY, image_info.size() * sizeof(int));
+	queue.enqueueWriteBuffer(image_info_buffer, CL_TRUE, 0, image_info.size() * sizeof(int), image_info.data());
+
+	cl::Buffer block_image_buffer(context, CL_MEM_READ_ONLY, num_blocks * sizeof(int));
+	queue.enqueueWriteBuffer(block_image_buffer, CL_TRUE, 0, num_blocks * sizeof(int), block_image.data());
+
+	// Per image state: smoothed loss, last loss, converged flag, iteration of convergence (see convergence_check)
+	std::vector<float> state(num_images * 4, 0.0f);
+	cl::Buffer state_buffer(context, CL_MEM_READ_WRITE, state.size() * sizeof(float));
+	queue.enqueueWriteBuffer(state_buffer, CL_TRUE, 0, state.size() * sizeof(float), state.data());
+
+	std::vector<int> active_images;
+	std::vector<int> active_blocks;
+	cl::Buffer active_images_buffer(context, CL_MEM_READ_ONLY, num_images * sizeof(int));
+	cl::Buffer active_blocks_buffer(context, CL_MEM_READ_ONLY, num_blocks * sizeof(int));
+
+	cl::Kernel grad_kernel(program, "batched_grad");
+	grad_kernel.setArg(0, img_buffer);
+	grad_kernel.setArg(1, orig_buffer);
+	grad_kernel.setArg(2, grad_buffer);
+	grad_kernel.setArg(3, block_loss_buffer);
+	grad_kernel.setArg(4, active_blocks_buffer);
+	grad_kernel.setArg(5, block_image_buffer);
+	grad_kernel.setArg(6, image_info_buffer);
+	grad_kernel.setArg(7, strength);
+	grad_kernel.setArg(8, eps);
+	grad_kernel.setArg(10, cl::Local(block_size * sizeof(cl_long)));
+
+	cl::Kernel check_kernel(program, "batched_convergence_check");
+	check_kernel.setArg(0, block_loss_buffer);
+	check_kernel.setArg(1, state_buffer);
+	check_kernel.setArg(2, active_images_buffer);
+	check_kernel.setArg(3, image_info_buffer);
+	check_kernel.setArg(4, block_size);
+	check_kernel.setArg(5, check_smoothing_beta);
+	check_kernel.setArg(6, tol);
+	check_kernel.setArg(9, 0);
+
+	cl::Kernel update_kernel(program, "batched_update");
+	update_kernel.setArg(0, img_buffer);
+	update_kernel.setArg(1, momentum_buffer);
+	update_kernel.setArg(2, grad_buffer);
+	update_kernel.setArg(3, state_buffer);
+	update_kernel.setArg(4, active_blocks_buffer);
+	update_kernel.setArg(5, block_image_buffer);
+	update_kernel.setArg(6, image_info_buffer);
+	update_kernel.setArg(7, step);
+	update_kernel.setArg(8, momentum_beta);
+
+	// Every launch covers the blocks of all active images. The convergence test runs per image on the device and
+	// the host reads back the state after each chunk: converged images are no-ops for the rest of the chunk and
+	// are dropped from the active lists before the next one.
+	int checks = 0;
+	int counter = 1;
+	while (true) {
+		active_images.clear();
+		active_blocks.clear();
+		for (int image = 0; image < num_images; ++image) {
+			if (state[image * 4 + 2] == 0.0f) {
+				active_images.push_back(image);
+				for (int block = image_info[image * 4 + 3]; block < num_blocks && block_image[block] == image; ++block) {
+					active_blocks.push_back(block);
+				}
+			}
+		}
+		if (active_images.empty()) {
+			break;
+		}
+		queue.enqueueWriteBuffer(active_images_buffer, CL_FALSE, 0, active_images.size() * sizeof(int), active_images.data());
+		queue.enqueueWriteBuffer(active_blocks_buffer, CL_FALSE, 0, active_blocks.size() * sizeof(int), active_blocks.data());
+
+		const int global_size = static_cast<int>(active_blocks.size()) * block_size;
+		for (int i = 0; i < chunk_size; ++i, ++counter) {
+			const bool check = (counter - 1) % check_every == 0;
+			grad_kernel.setArg(9, check ? 1 : 0);
+			queue.enqueueNDRangeKernel(grad_kernel, cl::NullRange, global_size, block_size);
+
+			if (check) {
+				++checks;
+				check_kernel.setArg(7, checks);
+				check_kernel.setArg(8, counter);
+				queue.enqueueNDRangeKernel(check_kernel, cl::NullRange, active_images.size(), cl::NullRange);
+			}
+
+			update_kernel.setArg(9, counter);
+			queue.enqueueNDRangeKernel(update_kernel, cl::NullRange, global_size, block_size);
+		}
+
+		queue.enqueueReadBuffer(state_buffer, CL_TRUE, 0, state.size() * sizeof(float), state.data());
+
+		if (!suppress_log) {
+			std::cout << "Iteration: " << counter - 1 << ", Active images: " << active_images.size() << std::endl;
+			for (int image : active_images) {
+				if (state[image * 4 + 2] != 0.0f) {
+					const float loss_smoothed_debiased = state[image * 4] / (1.0f - static_cast<float>(std::pow(check_smoothing_beta, checks)));
+					std::cout << "Image " << first + image << " converged after " << static_cast<int>(state[image * 4 + 3])
+						<< " iterations with loss: " << loss_smoothed_debiased << std::endl;
+				}
+			}
+		}
+	}
+
+	queue.enqueueReadBuffer(img_buffer, CL_TRUE, 0, atlas_size * sizeof(float), atlas.data());
+
+	for (int image = 0; image < num_images; ++image) {
+		results.emplace_back(image_info[image * 4 + 1], image_info[image * 4 + 2]);
+		const int offset = image_info[image * 4];
+		std::copy(atlas.begin() + offset, atlas.begin() + offset + image_info[image * 4 + 1] * image_info[image * 4 + 2], results.back().data());
+	}
+}
+
+std::vector<Image> tv_denoise_gradient_descent_batched(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const std::vector<Image>& inputs, float strength, float step_size, float tol, bool suppress_log,
+	int check_every, int chunk_size, int block_size
+) {
+	if (check_every < 1 || chunk_size < 1) {
+		throw std::invalid_argument("Convergence check frequency and chunk size must be at least 1.");
+	}
+	// A work-group processes a block, the loss reduction over the block needs a power of two local size
+	if (block_size < 1 || (block_size & (block_size - 1)) != 0) {
+		throw std::invalid_argument("Block size must be a power of two.");
+	}
+	const size_t max_work_group_size = queue.getInfo<CL_QUEUE_DEVICE>().getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+	if (static_cast<size_t>(block_size) > max_work_group_size) {
+		throw std::invalid_argument("Block size must not exceed the maximum work-group size of the device (" + std::to_string(max_work_group_size) + ").");
+	}
+
+	// The atlas offsets and the launch sizes are ints, a batch whose padded size does not fit is solved in parts
+	const size_t max_batch_size = static_cast<size_t>(std::numeric_limits<int>::max());
+	std::vector<Image> results;
+	results.reserve(inputs.size());
+	size_t first = 0;
+	size_t batch_size = 0;
+	for (size_t image = 0; image < inputs.size(); ++image) {
+		const size_t size = static_cast<size_t>(inputs[image].getRows()) * inputs[image].getCols();
+		const size_t padded_size = (size + block_size - 1) / block_size * block_size;
+		if (padded_size > max_batch_size) {
+			throw std::invalid_argument("Image " + std::to_string(image) + " is too large for the batched solver.");
+		}
+		if (batch_size + padded_size > max_batch_size) {
+			gradient_descent_batch(context, queue, program, inputs, first, image, strength, step_size, tol, suppress_log, check_every, chunk_size, block_size, results);
+			first = image;
+			batch_size = 0;
+		}
+		batch_size += padded_size;
+	}
+	if (first < inputs.size()) {
+		gradient_descent_batch(context, queue, program, inputs, first, inputs.size(), strength, step_size, tol, suppress_log, check_every, chunk_size, block_size, results);
+	}
+	return results;
+}
+
+/**
+ * @brief Device buffers of the linear system of a lagged diffusivity step on one multigrid level (see the CPU DiffusionLevel).
+ */
+struct DiffusionLevelBuffers {
+	int rows;
+	int cols;
+	cl::Buffer mass;
+	cl::Buffer wx;
+	cl::Buffer wy;
+	cl::Buffer x;
+	cl::Buffer b;
+	cl::Buffer residual;
+};
+
+/**
+ * @brief Kernels of the multigrid V-cycle.
+ */
+struct MultigridKernels {
+	cl::Kernel sweep;
+	cl::Kernel residual;
+	cl::Kernel restrict_residual;
+	cl::Kernel prolongate;
+};
+
+static void enqueue_red_black_sweep(cl::CommandQueue& queue, cl::Kernel& kernel, DiffusionLevelBuffers& level, int color) {
+	kernel.setArg(0, level.x);
+	kernel.setArg(1, level.b);
+	kernel.setArg(2, level.mass);
+	kernel.setArg(3, level.wx);
+	kernel.setArg(4, level.wy);
+	kernel.setArg(5, level.rows);
+	kernel.setArg(6, level.cols);
+	kernel.setArg(7, color);
+	queue.enqueueNDRangeKernel(kernel, cl::NullRange, level.rows * level.cols, cl::NullRange);
+}
+
+/**
+ * @brief Enqueues the symmetric V-cycle of the CPU solver, approximately solving levels[level] for b starting from x = 0.
+ */
+static void enqueue_v_cycle(
+	cl::CommandQueue& queue, MultigridKernels& kernels, std::vector<DiffusionLevelBuffers>& levels, size_t level
+) {
+	DiffusionLevelBuffers& fine = levels[level];
+	queue.enqueueFillBuffer(fine.x, 0.0f, 0, fine.rows * fine.cols * sizeof(float));
+
+	if (level + 1 == levels.size()) {
+		for (int k = 0; k < 16; ++k) {
+			enqueue_red_black_sweep(queue, kernels.sweep, fine, 0);
+			enqueue_red_black_sweep(queue, kernels.sweep, fine, 1);
+		}
+		for (int k = 0; k < 16; ++k) {
+			enqueue_red_black_sweep(queue, kernels.sweep, fine, 1);
+			enqueue_red_black_sweep(queue, kernels.sweep, fine, 0);
+		}
+		return;
+	}
+
+	enqueue_red_black_sweep(queue, kernels.sweep, fine, 0);
+	enqueue_red_black_sweep(queue, kernels.sweep, fine, 1);
+
+	kernels.residual.setArg(0, fine.x);
+	kernels.residual.setArg(1, fine.b);
+	kernels.residual.setArg(2, fine.mass);
+	kernels.residual.setArg(3, fine.wx);
+	kernels.residual.setArg(4, fine.wy);
+	kernels.residual.setArg(5, fine.residual);
+	kernels.residual.setArg(6, fine.rows);
+	kernels.residual.setArg(7, fine.cols);
+	queue.enqueueNDRangeKernel(kernels.residual, cl::NullRange, fine.rows * fine.cols, cl::NullRange);
+
+	DiffusionLevelBuffers& coarse = levels[level + 1];
+	kernels.restrict_residual.setArg(0, fine.residual);
+	kernels.restrict_residual.setArg(1, coarse.b);
+	kernels.restrict_residual.setArg(2, fine.rows);
+	kernels.restrict_residual.setArg(3, fine.cols);
+	kernels.restrict_residual.setArg(4, coarse.cols);
+	queue.enqueueNDRangeKernel(kernels.restrict_residual, cl::NullRange, coarse.rows * coarse.cols, cl::NullRange);
+
+	enqueue_v_cycle(queue, kernels, levels, level + 1);
+
+	kernels.prolongate.setArg(0, fine.x);
+	kernels.prolongate.setArg(1, coarse.x);
+	kernels.prolongate.setArg(2, fine.cols);
+	kernels.prolongate.setArg(3, coarse.cols);
+	queue.enqueueNDRangeKernel(kernels.prolongate, cl::NullRange, fine.rows * fine.cols, cl::NullRange);
+
+	enqueue_red_black_sweep(queue, kernels.sweep, fine, 1);
+	enqueue_red_black_sweep(queue, kernels.sweep, fine, 0);
+}
+
+/**
+ * @brief Sums the first size values of a zero padded buffer of extended_size (a power of two) on the device.
+ * @return The sum, the buffer is overwritten by the reduction.
+ */
+static float enqueue_sum(cl::CommandQueue& queue, cl::Kernel& sum_kernel, cl::Buffer& buffer, int extended_size) {
+	sum_kernel.setArg(0, buffer);
+	for (int offset = extended_size / 2; offset > 0; offset >>= 1) {
+		sum_kernel.setArg(1, offset);
+		queue.enqueueNDRangeKernel(sum_kernel, cl::NullRange, offset, cl::NullRange);
+	}
+	float result = 0.0f;
+	queue.enqueueReadBuffer(buffer, CL_TRUE, 0, sizeof(float), &result);
+	return result;
+}
+
+Image tv_denoise_lagged_diffusivity(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const Image& input, float strength, float tol, bool suppress_log, Preconditioner preconditioner, int max_cg_iterations, float cg_tol
+) {
+	const int rows = input.getRows();
+	const int cols = input.getCols();
+	const int img_size = rows * cols;
+	const float eps = 1e-8f;
+
+	if (max_cg_iterations < 1) {
+		throw std::invalid_argument("The number of conjugate gradient iterations must be at least 1.");
+	}
+
+	int extended_size = 1;
+	while (extended_size < img_size) {
+		extended_size *= 2;
+	}
+
+	cl::Buffer img_buffer(context, CL_MEM_READ_WRITE, img_size * sizeof(float));
+	queue.enqueueWriteBuffer(img_buffer, CL_TRUE, 0, img_size * sizeof(float), input.data());
+
+	cl::Buffer orig_buffer(context, CL_MEM_READ_WRITE, img_size * sizeof(float));
+	queue.enqueueWriteBuffer(orig_buffer, CL_TRUE, 0, img_size * sizeof(float), input.data());
+
+	cl::Buffer z_buffer(context, CL_MEM_READ_WRITE, img_size * sizeof(float));
+	cl::Buffer direction_buffer(context, CL_MEM_READ_WRITE, img_size * sizeof(float));
+	cl::Buffer product_buffer(context, CL_MEM_READ_WRITE, img_size * sizeof(float));
+	cl::Buffer residual_buffer(context, CL_MEM_READ_WRITE, img_size * sizeof(float));
+
+	// Every reduction (the loss and the dot products) writes its terms into the first img_size values
+	cl::Buffer reduction_buffer(context, CL_MEM_READ_WRITE, extended_size * sizeof(float));
+	queue.enqueueWriteBuffer(reduction_buffer, CL_TRUE, 0, extended_size * sizeof(float), std::vector<float>(extended_size, 0.0f).data());
+
+	// The fine level solves for the conjugate gradient residual, its solution is the preconditioned residual
+	std::vector<DiffusionLevelBuffers> levels;
+	levels.push_back(DiffusionLevelBuffers{
+		rows, cols,
+		cl::Buffer(context, CL_MEM_READ_WRITE, img_size * sizeof(float)),
+		cl::Buffer(context, CL_MEM_READ_WRITE, img_size * sizeof(float)),
+		cl::Buffer(context, CL_MEM_READ_WRITE, img_size * sizeof(float)),
+		z_buffer, residual_buffer,
+		cl::Buffer(context, CL_MEM_READ_WRITE, img_size * sizeof(float))
+	});
+	queue.enqueueWriteBuffer(levels[0].mass, CL_TRUE, 0, img_size * sizeof(float), std::vector<float>(img_size, 1.0f).data());
+	if (preconditioner == Preconditioner::Multigrid) {
+		while (levels.back().rows > 8 || levels.back().cols > 8) {
+			const int coarse_rows = (levels.back().rows + 1) / 2;
+			const int coarse_cols = (levels.back().cols + 1) / 2;
+			const size_t coarse_size = coarse_rows * coarse_cols * sizeof(float);
+			levels.push_back(DiffusionLevelBuffers{
+				coarse_rows, coarse_cols,
+				cl::Buffer(context, CL_MEM_READ_WRITE, coarse_size), cl::Buffer(context, CL_MEM_READ_WRITE, coarse_size),
+				cl::Buffer(context, CL_MEM_READ_WRITE, coarse_size), cl::Buffer(context, CL_MEM_READ_WRITE, coarse_size),
+				cl::Buffer(context, CL_MEM_READ_WRITE, coarse_size), cl::Buffer(context, CL_MEM_READ_WRITE, coarse_size)
+			});
+		}
+	}
+	DiffusionLevelBuffers& fine = levels[0];
+
+	cl::Kernel weights_kernel(program, "lagged_diffusivity_weights");
+	weights_kernel.setArg(0, img_buffer);
+	weights_kernel.setArg(1, orig_buffer);
+	weights_kernel.setArg(2, fine.wx);
+	weights_kernel.setArg(3, fine.wy);
+	weights_kernel.setArg(4, reduction_buffer);
+	weights_kernel.setArg(5, rows);
+	weights_kernel.setArg(6, cols);
+	weights_kernel.setArg(7, strength);
+	weights_kernel.setArg(8, eps);
+
+	cl::Kernel apply_kernel(program, "diffusion_apply");
+	apply_kernel.setArg(0, direction_buffer);
+	apply_kernel.setArg(1, fine.mass);
+	apply_kernel.setArg(2, fine.wx);
+	apply_kernel.setArg(3, fine.wy);
+	apply_kernel.setArg(4, product_buffer);
+	apply_kernel.setArg(5, rows);
+	apply_kernel.setArg(6, cols);
+
+	cl::Kernel jacobi_kernel(program, "jacobi_precondition");
+	jacobi_kernel.setArg(0, residual_buffer);
+	jacobi_kernel.setArg(1, fine.mass);
+	jacobi_kernel.setArg(2, fine.wx);
+	jacobi_kernel.setArg(3, fine.wy);
+	jacobi_kernel.setArg(4, z_buffer);
+	jacobi_kernel.setArg(5, rows);
+	jacobi_kernel.setArg(6, cols);
+
+	cl::Kernel coarsen_kernel(program, "coarsen_diffusion");
+	MultigridKernels multigrid_kernels{
+		cl::Kernel(program, "red_black_sweep"), cl::Kernel(program, "diffusion_residual"),
+		cl::Kernel(program, "restrict_residual"), cl::Kernel(program, "prolongate_correction")
+	};
+
+	cl::Kernel direction_kernel(program, "cg_direction");
+	direction_kernel.setArg(0, direction_buffer);
+	direction_kernel.setArg(1, z_buffer);
+
+	cl::Kernel axpy_kernel(program, "axpy");
+	cl::Kernel dot_kernel(program, "dot_mtx");
+	dot_kernel.setArg(2, reduction_buffer);
+	cl::Kernel sum_kernel = init_sum_kernel<float>(program);
+
+	auto dot = [&](cl::Buffer& a, cl::Buffer& b) {
+		dot_kernel.setArg(0, a);
+		dot_kernel.setArg(1, b);
+		queue.enqueueNDRangeKernel(dot_kernel, cl::NullRange, img_size, cl::NullRange);
+		return enqueue_sum(queue, sum_kernel, reduction_buffer, extended_size);
+	};
+	auto axpy = [&](cl::Buffer& y, cl::Buffer& x, float alpha) {
+		axpy_kernel.setArg(0, y);
+		axpy_kernel.setArg(1, x);
+		axpy_kernel.setArg(2, alpha);
+		queue.enqueueNDRangeKernel(axpy_kernel, cl::NullRange, img_size, cl::NullRange);
+	};
+	auto precondition = [&]() {
+		if (preconditioner == Preconditioner::Jacobi) {
+			queue.enqueueNDRangeKernel(jacobi_kernel, cl::NullRange, img_size, cl::NullRange);
+		}
+		else {
+			enqueue_v_cycle(queue, multigrid_kernels, levels, 0);
+		}
+	};
+
+	float previous_loss = std::numeric_limits<float>::infinity();
+	int total_cg_iterations = 0;
+	int counter = 1;
+	while (true) {
+		queue.enqueueNDRangeKernel(weights_kernel, cl::NullRange, img_size, cl::NullRange);
+		const float loss = enqueue_sum(queue, sum_kernel, reduction_buffer, extended_size);
+
+		if (!suppress_log) {
+			std::cout << "Iteration: " << counter << ", Loss: " << loss << std::endl;
+		}
+
+		if (loss >= previous_loss * (1.0f - tol)) {
+			if (!suppress_log) {
+				std::cout << "Converged after " << counter << " iterations (" << total_cg_iterations
+					<< " conjugate gradient iterations) with loss: " << loss << std::endl;
+			}
+			break;
+		}
+		previous_loss = loss;
+
+		for (size_t level = 1; level < levels.size(); ++level) {
+			coarsen_kernel.setArg(0, levels[level - 1].mass);
+			coarsen_kernel.setArg(1, levels[level - 1].wx);
+			coarsen_kernel.setArg(2, levels[level - 1].wy);
+			coarsen_kernel.setArg(3, levels[level].mass);
+			coarsen_kernel.setArg(4, levels[level].wx);
+			coarsen_kernel.setArg(5, levels[level].wy);
+			coarsen_kernel.setArg(6, levels[level - 1].rows);
+			coarsen_kernel.setArg(7, levels[level - 1].cols);
+			coarsen_kernel.setArg(8, levels[level].cols);
+			queue.enqueueNDRangeKernel(coarsen_kernel, cl::NullRange, levels[level].rows * levels[level].cols, cl::NullRange);
+		}
+
+		// Preconditioned conjugate gradient warm-started from the current image, the host only reads back the dot products
+		multigrid_kernels.residual.setArg(0, img_buffer);
+		multigrid_kernels.residual.setArg(1, orig_buffer);
+		multigrid_kernels.residual.setArg(2, fine.mass);
+		multigrid_kernels.residual.setArg(3, fine.wx);
+		multigrid_kernels.residual.setArg(4, fine.wy);
+		multigrid_kernels.residual.setArg(5, residual_buffer);
+		multigrid_kernels.residual.setArg(6, rows);
+		multigrid_kernels.residual.setArg(7, cols);
+		queue.enqueueNDRangeKernel(multigrid_kernels.residual, cl::NullRange, img_size, cl::NullRange);
+
+		float residual_norm = dot(residual_buffer, residual_buffer);
+		const float target_norm = cg_tol * cg_tol * residual_norm;
+
+		precondition();
+		float rz = dot(residual_buffer, z_buffer);
+		queue.enqueueCopyBuffer(z_buffer, direction_buffer, 0, 0, img_size * sizeof(float));
+
+		int cg_iteration = 0;
+		for (; cg_iteration < max_cg_iterations && residual_norm > target_norm; ++cg_iteration) {
+			queue.enqueueNDRangeKernel(apply_kernel, cl::NullRange, img_size, cl::NullRange);
+			const float alpha = rz / dot(direction_buffer, product_buffer);
+
+			axpy(img_buffer, direction_buffer, alpha);
+			axpy(residual_buffer, product_buffer, -alpha);
+			residual_norm = dot(residual_buffer, residual_buffer);
+
+			precondition();
+			const float rz_next = dot(residual_buffer, z_buffer);
+			direction_kernel.setArg(2, rz_next / rz);
+			queue.enqueueNDRangeKernel(direction_kernel, cl::NullRange, img_size, cl::NullRange);
+			rz = rz_next;
+		}
+		total_cg_iterations += cg_iteration;
+
+		++counter;
+	}
+
+	Image img(rows, cols);
+	queue.enqueueReadBuffer(img_buffer, CL_TRUE, 0, img_size * sizeof(float), img.data());
+
+	return img;
+}
+
+/**
+ * @brief Barzilai-Borwein solver of every tv_denoise_barzilai_borwein overload, initial (the input by default) and progress may be nullptr.
+ */
+static Image barzilai_borwein(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const Image& input, float strength, float tol, bool suppress_log, const Image* initial, const ProgressOptions* progress
+) {
+	const int img_size = input.getRows() * input.getCols();
+
+	if (initial && (initial->getRows() != input.getRows() || initial->getCols() != input.getCols())) {
+		throw std::invalid_argument("Initial image must have the same size as the input image.");
+	}
+
+	Image img = initial ? *initial : input;
+	const Image& orig_img = input;
+	Image trial_img = img;
+
+	std::vector<float> grad(img_size);
+	std::vector<float> trial_grad(img_size);
+	std::vector<float> grad_diff(img_size);
+
+	const float loss_smoothing_beta = 0.9f;
+	float loss_smoothed = 0.0f;
+
+	const size_t loss_history_size = 10;
+	const float sufficient_decrease = 1e-4f;
+	const float backtracking_factor = 0.5f;
+	const float min_step = 1e-10f;
+	const float max_step = 1e10f;
+	const int bb_cycle_length = 8;
+	std::deque<float> loss_history;
+
+	ProgressSchedule schedule(progress);
+
+	float loss = eval_loss_and_grad(context, queue, program, img, orig_img, strength, grad.data());
+	float best_loss = loss;
+	// The line search accepts losses above the best one, so the solve returns the best iterate instead of the last
+	Image best_img = img;
+
+	float max_abs_grad = 0.0f;
+	for (float g : grad) {
+		max_abs_grad = std::max(max_abs_grad, std::abs(g));
+	}
+	float step = max_abs_grad > 0.0f ? std::min(1.0f / max_abs_grad, 1.0f) : 1.0f;
+
+	int counter = 1;
+	while (true) {
+		if (schedule.cancelled()) {
+			if (!suppress_log) {
+				std::cout << "Cancelled after " << counter - 1 << " iterations" << std::endl;
+			}
+			break;
+		}
+
+		if (!suppress_log) {
+			std::cout << "Iteration: " << counter << ", Loss: " << loss << ", Step: " << step << std::endl;
+		}
+
+		// The iterate is kept on the host between the kernel calls, so the full image is reported instead of a preview
+		if (schedule.due(counter)) {
+			schedule.report(counter, loss, img);
+		}
+
+		// The loss is not monotone with spectral steps, so the convergence test is fed with the best loss so far
+		if (loss < best_loss) {
+			best_loss = loss;
+			std::copy(img.data(), img.data() + img_size, best_img.data());
+		}
+		loss_smoothed = loss_smoothed * loss_smoothing_beta + best_loss * (1.0f - loss_smoothing_beta);
+
+		float loss_smoothed_debiased = loss_smoothed / (1.0f - static_cast<float>(std::pow(loss_smoothing_beta, counter)));
+		if (loss_converged(best_loss, loss_smoothed_debiased, tol, counter, initial != nullptr)) {
+			if (!suppress_log) {
+				std::cout << "Converged after " << counter << " iterations with loss: " << loss_smoothed_debiased << std::endl;
+			}
+			break;
+		}
+
+		loss_history.push_back(loss);
+		if (loss_history.size() > loss_history_size) {
+			loss_history.pop_front();
+		}
+		const float reference_loss = *std::max_element(loss_history.begin(), loss_history.end());
+
+		const float grad_sq = dot(context, queue, program, grad.data(), grad.data(), img_size);
+
+		float trial_loss;
+		while (true) {
+			std::copy(img.data(), img.data() + img_size, trial_img.data());
+			axpy(context, queue, program, trial_img.data(), grad.data(), -step, img_size);
+
+			trial_loss = eval_loss_and_grad(context, queue, program, trial_img, orig_img, strength, trial_grad.data());
+			if (trial_loss <= reference_loss - sufficient_decrease * step * grad_sq || step <= min_step) {
+				break;
+			}
+			step *= backtracking_factor;
+		}
+
+		if (counter % bb_cycle_length == 0) {
+			std::copy(trial_grad.begin(), trial_grad.end(), grad_diff.begin());
+			axpy(context, queue, program, grad_diff.data(), grad.data(), -1.0f, img_size);
+
+			const float curvature = -dot(context, queue, program, grad.data(), grad_diff.data(), img_size);
+			step = curvature > 0.0f ? step * grad_sq / curvature : max_step;
+			step = std::min(std::max(step, min_step), max_step);
+		}
+
+		img.swap(trial_img);
+		grad.swap(trial_grad);
+		loss = trial_loss;
+
+		++counter;
+	}
+
+	return best_img;
+}
+
+Image tv_denoise_barzilai_borwein(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const Image& input, float strength, float tol, bool suppress_log
+) {
+	return barzilai_borwein(context, queue, program, input, strength, tol, suppress_log, nullptr, nullptr);
+}
+
+Image tv_denoise_barzilai_borwein(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const Image& input, float strength, float tol, bool suppress_log, const Image& initial
+) {
+	return barzilai_borwein(context, queue, program, input, strength, tol, suppress_log, &initial, nullptr);
+}
+
+Image tv_denoise_barzilai_borwein(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const Image& input, float strength, float tol, bool suppress_log, const ProgressOptions& progress
+) {
+	return barzilai_borwein(context, queue, program, input, strength, tol, suppress_log, nullptr, &progress);
+}
+
+std::vector<RegularizationPathResult> tv_denoise_regularization_path(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const Image& input, std::vector<float> strengths, float step_size, float tol, bool suppress_log, bool barzilai_borwein
+) {
+	const int img_size = input.getRows() * input.getCols();
+
+	std::sort(strengths.begin(), strengths.end(), std::greater<float>());
+
+	std::vector<RegularizationPathResult> results;
+	results.reserve(strengths.size());
+
+	std::vector<float> grad(img_size);
+
+	for (float strength : strengths) {
+		if (!suppress_log) {
+			std::cout << "Strength: " << strength << std::endl;
+		}
+
+		// The strongest strength is a plain solve from the noisy input, the others are warm-started from the previous result
+		Image img = results.empty()
+			? (barzilai_borwein
+				? tv_denoise_barzilai_borwein(context, queue, program, input, strength, tol, suppress_log)
+				: tv_denoise_gradient_descent(context, queue, program, input, strength, step_size, tol, suppress_log))
+			: (barzilai_borwein
+				? tv_denoise_barzilai_borwein(context, queue, program, input, strength, tol, suppress_log, results.back().image)
+				: tv_denoise_gradient_descent(context, queue, program, input, strength, step_size, tol, suppress_log, results.back().image));
+
+		const float tv_norm = tv_norm_and_grad(context, queue, program, img, grad.data());
+		const float l2_norm = l2_norm_and_grad(context, queue, program, img, input, grad.data());
+		results.push_back({ strength, img, strength * tv_norm + l2_norm, tv_norm, l2_norm });
+	}
+
+	return results;
+}
@@ -3,7 +3,12 @@
 #include <CL/cl.hpp>
 #include <string>
 #include <typeinfo>
+#include <vector>
 #include "../Image/Image.h"
+#include "../Common/DenoisingTypes.h"
+#include "../Common/Progress.h"
+#include "../Common/Checkpoint.h"
+#include "../Common/RealTime.h"
 
 /**
  * @brief Initializes the sum reduction kernel for the given type.
@@ -170,6 +175,55 @@ float eval_loss_and_grad(
 );
 
 
+/**
+ * @brief Computes only the gradient of the total loss (TV + L2) for an image on the GPU.
+ *
+ * Cheaper than eval_loss_and_grad as the loss reductions are skipped, used in between convergence checks.
+ *
+ * @param context OpenCL context.
+ * @param queue OpenCL command queue.
+ * @param program Compiled OpenCL program.
+ * @param img Input image.
+ * @param orig Original/reference image.
+ * @param strength Weight for the TV loss term.
+ * @param grad Output gradient buffer (size: rows * cols).
+ * @param eps Small epsilon value to avoid division by zero (default: 1e-8f).
+ */
+void eval_grad(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const Image& img, const Image& orig, float strength, float* grad, float eps = 1e-8f
+);
+
+/**
+ * @brief Computes y += alpha * x on the GPU.
+ * @param context OpenCL context.
+ * @param queue OpenCL command queue.
+ * @param program Compiled OpenCL program.
+ * @param y Input/output buffer (size: size).
+ * @param x Input buffer (size: size).
+ * @param alpha Scaling factor of x.
+ * @param size Number of elements.
+ */
+void axpy(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	float* y, const float* x, float alpha, int size
+);
+
+/**
+ * @brief Computes the dot product of two arrays on the GPU.
+ * @param context OpenCL context.
+ * @param queue OpenCL command queue.
+ * @param program Compiled OpenCL program.
+ * @param a First input buffer (size: size).
+ * @param b Second input buffer (size: size).
+ * @param size Number of elements.
+ * @return The dot product of a and b.
+ */
+float dot(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const float* a, const float* b, int size
+);
+
 /**
  * @brief Updates the momentum buffer using the current gradient on the GPU.
  * @param context OpenCL context.
@@ -212,9 +266,414 @@ void update_img(
  * @param step_size Step size (learning rate) for gradient descent (default: 1e-2f).
  * @param tol Tolerance for convergence (default: 3.2e-3f).
  * @param suppress_log If true, suppresses logging output (default: true).
+ * @param check_every The loss and the convergence test are only evaluated every check_every iterations,
+ *                    the iterations in between only compute the gradient (default: 1).
+ * @return The denoised image.
+ */
+Image tv_denoise_gradient_descent(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const Image& input, float strength, float step_size = 1e-2f, float tol = 3.2e-3f, bool suppress_log = true, int check_every = 1
+);
+
+/**
+ * @brief Performs total variation denoising using gradient descent on the GPU, starting from a given image.
+ *
+ * Same as tv_denoise_gradient_descent, but the iteration is warm-started from initial instead of the noisy input.
+ * The L2 loss is still measured against input.
+ *
+ * @param context OpenCL context.
+ * @param queue OpenCL command queue.
+ * @param program Compiled OpenCL program.
+ * @param input Noisy input image.
+ * @param strength Weight for the TV loss term.
+ * @param step_size Step size (learning rate) for gradient descent.
+ * @param tol Tolerance for convergence.
+ * @param suppress_log If true, suppresses logging output.
+ * @param initial Starting point of the iteration, has to be the same size as input.
+ * @param check_every The loss and the convergence test are only evaluated every check_every iterations (default: 1).
  * @return The denoised image.
  */
 Image tv_denoise_gradient_descent(
 	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
-	const Image& input, float strength, float step_size = 1e-2f, float tol = 3.2e-3f, bool suppress_log = true
+	const Image& input, float strength, float step_size, float tol, bool suppress_log, const Image& initial, int check_every = 1
+);
+
+/**
+ * @brief Performs total variation denoising using gradient descent with every buffer kept on the GPU.
+ *
+ * The iterations are enqueued in chunks of chunk_size without synchronizing with the host.
+ * The smoothed loss and the convergence test are evaluated on the device every check_every iterations,
+ * and the host only reads back the convergence flag after each chunk. Once converged, the remaining
+ * updates of the chunk leave the image unchanged, so the result matches tv_denoise_gradient_descent
+ * up to rounding.
+ *
+ * @param context OpenCL context.
+ * @param queue OpenCL command queue.
+ * @param program Compiled OpenCL program.
+ * @param input Noisy input image.
+ * @param strength Weight for the TV loss term.
+ * @param step_size Step size (learning rate) for gradient descent (default: 1e-2f).
+ * @param tol Tolerance for convergence (default: 3.2e-3f).
+ * @param suppress_log If true, suppresses logging output (default: true).
+ * @param check_every The loss and the convergence test are only evaluated every check_every iterations (default: 1).
+ * @param chunk_size Number of iterations enqueued between two reads of the convergence flag (default: 32).
+ * @return The denoised image.
+ */
+Image tv_denoise_gradient_descent_chunked(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const Image& input, float strength, float step_size = 1e-2f, float tol = 3.2e-3f, bool suppress_log = true,
+	int check_every = 1, int chunk_size = 32
+);
+
+/**
+ * @brief Performs total variation denoising with every buffer kept on the GPU, reporting its progress and allowing it to be cancelled.
+ *
+ * Same as tv_denoise_gradient_descent_chunked. The progress and the cancellation token are checked after each chunk.
+ * Instead of the whole iterate, the callback receives a preview averaging blocks of progress.preview_factor pixels,
+ * which is computed on the device and read back asynchronously while the next chunk runs. The callback therefore
+ * sees the state one chunk behind the device, and does not delay the solve unless it takes longer than a chunk.
+ *
+ * @param context OpenCL context.
+ * @param queue OpenCL command queue.
+ * @param program Compiled OpenCL program.
+ * @param input Noisy input image.
+ * @param strength Weight for the TV loss term.
+ * @param step_size Step size (learning rate) for gradient descent.
+ * @param tol Tolerance for convergence.
+ * @param suppress_log If true, suppresses logging output.
+ * @param progress Progress callback, its intervals, the preview factor and the cancellation token.
+ * @param check_every The loss and the convergence test are only evaluated every check_every iterations (default: 1).
+ * @param chunk_size Number of iterations enqueued between two reads of the convergence flag (default: 32).
+ * @return The denoised image, or the current iterate if the solve was cancelled.
+ */
+Image tv_denoise_gradient_descent_chunked(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const Image& input, float strength, float step_size, float tol, bool suppress_log, const ProgressOptions& progress,
+	int check_every = 1, int chunk_size = 32
+);
+
+/**
+ * @brief Performs total variation denoising with every buffer kept on the GPU, saving its state to a checkpoint file.
+ *
+ * Same as tv_denoise_gradient_descent_chunked. Every checkpoint.interval_iterations iterations, the iterate, the
+ * momentum, the smoothed loss and the counters are read back and written to checkpoint.path on a background thread.
+ * A chunk ends early at a checkpoint, so the checkpoints are taken at the same iterations as on the CPU whatever
+ * the chunk size, and an interval below chunk_size shortens every chunk to it. With checkpoint.resume the solve continues from an
+ * existing checkpoint and computes exactly the same iterates as the interrupted solve. The format is shared with
+ * the CPU solver (see the CPU tv_denoise_gradient_descent).
+ *
+ * @param context OpenCL context.
+ * @param queue OpenCL command queue.
+ * @param program Compiled OpenCL program.
+ * @param input Noisy input image.
+ * @param strength Weight for the TV loss term.
+ * @param step_size Step size (learning rate) for gradient descent.
+ * @param tol Tolerance for convergence.
+ * @param suppress_log If true, suppresses logging output.
+ * @param checkpoint Checkpoint file, interval and whether to resume from it.
+ * @param check_every The loss and the convergence test are only evaluated every check_every iterations (default: 1).
+ * @param chunk_size Number of iterations enqueued between two reads of the convergence flag (default: 32).
+ * @return The denoised image.
+ * @throws std::invalid_argument if the checkpoint to resume from was written for different parameters.
+ */
+Image tv_denoise_gradient_descent_chunked(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const Image& input, float strength, float step_size, float tol, bool suppress_log, const CheckpointOptions& checkpoint,
+	int check_every = 1, int chunk_size = 32
+);
+
+/**
+ * @brief Performs total variation denoising with every buffer kept on the GPU within an iteration and time budget.
+ *
+ * Same as tv_denoise_gradient_descent_chunked from an initial image, but the solve also stops after
+ * budget.max_iterations iterations or after the last chunk before budget.deadline (judged by the longest chunk so
+ * far), and then returns the checked iterate with the lowest loss, which a kernel keeps a device copy of.
+ * The deadline is only checked between chunks, so the default chunk is short. Used by RealTimeDenoiser.
+ *
+ * @param context OpenCL context.
+ * @param queue OpenCL command queue.
+ * @param program Compiled OpenCL program.
+ * @param input Noisy input image.
+ * @param strength Weight for the TV loss term.
+ * @param step_size Step size (learning rate) for gradient descent.
+ * @param tol Tolerance for convergence.
+ * @param suppress_log If true, suppresses logging output.
+ * @param initial Starting point of the iterations, e.g. the result of the previous frame.
+ * @param budget Limits of the solve, its iterations, loss and outcome are filled in.
+ * @param check_every The loss and the convergence test are only evaluated every check_every iterations (default: 1).
+ * @param chunk_size Number of iterations enqueued between two reads of the convergence flag (default: 4).
+ * @return The denoised image.
+ * @throws std::invalid_argument if the initial image does not have the size of the input image.
+ */
+Image tv_denoise_gradient_descent_chunked(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const Image& input, float strength, float step_size, float tol, bool suppress_log, const Image& initial, SolveBudget& budget,
+	int check_every = 1, int chunk_size = 4
+);
+
+/**
+ * @brief Performs total variation denoising using gradient descent with reduced precision storage on the GPU.
+ *
+ * Same as tv_denoise_gradient_descent_chunked, but the original image and the momentum (and optionally the
+ * iterate) are stored as 16-bit values (vload_half/vstore_half for Float16) and every iteration is a single
+ * fused kernel, so no intermediate matrix is written. Every value is converted to float before use and the
+ * loss is reduced in float. See the CPU tv_denoise_gradient_descent_mixed for the accuracy of the formats.
+ *
+ * @param context OpenCL context.
+ * @param queue OpenCL command queue.
+ * @param program Compiled OpenCL program.
+ * @param input Noisy input image.
+ * @param strength Weight for the TV loss term.
+ * @param step_size Step size (learning rate) for gradient descent (default: 1e-2f).
+ * @param tol Tolerance for convergence (default: 3.2e-3f).
+ * @param suppress_log If true, suppresses logging output (default: true).
+ * @param precision Storage format of the original image and the momentum (default: Float16).
+ * @param compact_image If true, the iterate is stored in the same format, otherwise as float (default: false).
+ * @param check_every The loss and the convergence test are only evaluated every check_every iterations (default: 1).
+ * @param chunk_size Number of iterations enqueued between two reads of the convergence flag (default: 32).
+ * @return The denoised image.
+ */
+Image tv_denoise_gradient_descent_mixed(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const Image& input, float strength, float step_size = 1e-2f, float tol = 3.2e-3f, bool suppress_log = true,
+	StoragePrecision precision = StoragePrecision::Float16, bool compact_image = false, int check_every = 1, int chunk_size = 32
+);
+
+/**
+ * @brief Returns the program build options selecting a TV model, e.g. "-D TV_VARIANT=2 -D TV_BOUNDARY=1".
+ *
+ * The model kernels are compiled for a single model, a program built with these options can only run
+ * tv_denoise_gradient_descent_model for that model (every other kernel is unaffected).
+ *
+ * @param model TV variant, boundary condition and scalar type.
+ * @return The options to pass to cl::Program::build.
+ */
+std::string tv_model_build_options(const TvModel& model);
+
+/**
+ * @brief Performs total variation denoising using gradient descent with a selectable TV model on the GPU.
+ *
+ * Same chunked iteration as tv_denoise_gradient_descent_mixed, with the TV variant, boundary condition and scalar
+ * type compiled into the kernel (see tv_model_build_options and the CPU tv_denoise_gradient_descent_model).
+ * The loss is reduced in float for every scalar type, so with ScalarType::Double only the iteration is in double
+ * precision and the convergence test is no finer than with float.
+ *
+ * @param context OpenCL context.
+ * @param queue OpenCL command queue.
+ * @param program OpenCL program built with tv_model_build_options(model).
+ * @param input Noisy input image.
+ * @param strength Weight for the TV loss term.
+ * @param step_size Step size (learning rate) for gradient descent.
+ * @param tol Tolerance for convergence.
+ * @param suppress_log If true, suppresses logging output.
+ * @param model TV variant, boundary condition and scalar type.
+ * @param check_every The loss and the convergence test are only evaluated every check_every iterations (default: 1).
+ * @param chunk_size Number of iterations enqueued between two reads of the convergence flag (default: 32).
+ * @return The denoised image.
+ * @throws std::invalid_argument if the program was built for a different model or the Huber threshold is not positive.
+ */
+Image tv_denoise_gradient_descent_model(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const Image& input, float strength, float step_size, float tol, bool suppress_log, const TvModel& model,
+	int check_every = 1, int chunk_size = 32
+);
+
+/**
+ * @brief Performs total variation denoising using gradient descent on the GPU, skipping the tiles that have already converged.
+ *
+ * Same algorithm as the CPU tv_denoise_gradient_descent_active_set. Every buffer stays on the device, the kernels
+ * only run on the work-groups of the active tile list, which the host rebuilds every active_set_interval (10)
+ * iterations from the drift of the tiles, reactivated tiles start with zero momentum. The host reads back one loss value per tile in every iteration. The losses are summed in fixed
+ * point (see ReproducibleSum), so the solve stops at the same iteration for every tile size.
+ *
+ * @param context OpenCL context.
+ * @param queue OpenCL command queue.
+ * @param program Compiled OpenCL program.
+ * @param input Noisy input image.
+ * @param strength Weight for the TV loss term.
+ * @param step_size Step size (learning rate) for gradient descent (default: 1e-2f).
+ * @param tol Tolerance for convergence (default: 3.2e-3f).
+ * @param suppress_log If true, suppresses logging output (default: true).
+ * @param tile_size Side of the tiles, a work-group processes a tile so tile_size^2 has to be a power of two
+ *                  and at most the maximum work-group size of the device (default: active_set_tile_size, 16).
+ * @param freeze_threshold Largest change of a pixel over 10 iterations below which its tile is frozen (default: 1e-3f).
+ * @return The denoised image.
+ */
+Image tv_denoise_gradient_descent_active_set(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const Image& input, float strength, float step_size = 1e-2f, float tol = 3.2e-3f, bool suppress_log = true,
+	int tile_size = active_set_tile_size, float freeze_threshold = 1e-3f
+);
+
+/**
+ * @brief Performs total variation denoising using gradient descent on the GPU, restricted to the masked region.
+ *
+ * Same as the CPU tv_denoise_gradient_descent_masked: only the tiles containing a masked pixel are launched,
+ * one work-group per tile, and the mask, the momentum and the gradient are only stored for them.
+ * The loss of the tiles is read back every iteration, as in tv_denoise_gradient_descent_active_set.
+ *
+ * @param context OpenCL context.
+ * @param queue OpenCL command queue.
+ * @param program Compiled OpenCL program.
+ * @param input Noisy input image.
+ * @param mask Weight of every pixel, 0 outside the region and 1 inside it (same size as the input).
+ * @param strength Weight for the TV loss term.
+ * @param step_size Step size (learning rate) for gradient descent (default: 1e-2f).
+ * @param tol Tolerance for convergence (default: 3.2e-3f).
+ * @param suppress_log If true, suppresses logging output (default: true).
+ * @param tile_size Side of the tiles, a power of two (default: 16).
+ * @return The image with the masked region denoised, the input if the mask is empty.
+ * @throws std::invalid_argument if the mask has a different size than the input or the tile size is not a power of two.
+ */
+Image tv_denoise_gradient_descent_masked(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const Image& input, const Image& mask, float strength, float step_size = 1e-2f, float tol = 3.2e-3f, bool suppress_log = true,
+	int tile_size = 16
+);
+
+/**
+ * @brief Denoises many images at once using gradient descent on the GPU, e.g. thousands of small crops.
+ *
+ * The images are packed into one atlas buffer (with per image offsets and sizes) and split into blocks of
+ * block_size pixels, so every kernel launch covers all images and the per image overhead of buffer creation
+ * and kernel launches is paid once for the whole batch. The loss is reduced per block and then per image, in
+ * fixed point (see ReproducibleSum) so the block size does not change the iteration an image stops at.
+ * Every image has its own smoothed loss and convergence flag on the device (the same test as
+ * tv_denoise_gradient_descent_chunked). After each chunk the host reads back the flags and drops the blocks
+ * of the converged images from the launches, so every image matches its own chunked solve up to rounding.
+ * A batch of more than INT_MAX pixels (each image padded to whole blocks) is solved in consecutive parts.
+ *
+ * @param context OpenCL context.
+ * @param queue OpenCL command queue.
+ * @param program Compiled OpenCL program.
+ * @param inputs Noisy input images, of any sizes.
+ * @param strength Weight for the TV loss term, shared by every image.
+ * @param step_size Step size (learning rate) for gradient descent (default: 1e-2f).
+ * @param tol Tolerance for convergence (default: 3.2e-3f).
+ * @param suppress_log If true, suppresses logging output (default: true).
+ * @param check_every The loss and the convergence test are only evaluated every check_every iterations (default: 1).
+ * @param chunk_size Number of iterations enqueued between two reads of the convergence flags (default: 32).
+ * @param block_size Pixels per work-group, a power of two of at most the maximum work-group size of the device (default: 256).
+ * @return The denoised images, in the order of inputs.
+ * @throws std::invalid_argument if block_size is not a power of two or exceeds the maximum work-group size of the device,
+ *         or if a single image does not fit a batch.
+ */
+std::vector<Image> tv_denoise_gradient_descent_batched(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const std::vector<Image>& inputs, float strength, float step_size = 1e-2f, float tol = 3.2e-3f, bool suppress_log = true,
+	int check_every = 1, int chunk_size = 32, int block_size = 256
+);
+
+/**
+ * @brief Performs total variation denoising with the lagged diffusivity (fixed-point) iteration on the GPU.
+ *
+ * Same algorithm as the CPU tv_denoise_lagged_diffusivity. Every buffer stays on the device, the matrix-free
+ * operator, the preconditioner (Jacobi, or the multigrid V-cycle with red-black Gauss-Seidel smoothing) and the
+ * vector updates are kernels, and the host only reads back the loss and the dot products of conjugate gradient.
+ *
+ * @param context OpenCL context.
+ * @param queue OpenCL command queue.
+ * @param program Compiled OpenCL program.
+ * @param input Noisy input image.
+ * @param strength Weight for the TV loss term.
+ * @param tol Relative decrease of the loss per outer iteration below which the iteration stops (default: 3.2e-3f).
+ * @param suppress_log If true, suppresses logging output (default: true).
+ * @param preconditioner Preconditioner of the conjugate gradient solves (default: Jacobi).
+ * @param max_cg_iterations Maximum number of conjugate gradient iterations per outer iteration (default: 100).
+ * @param cg_tol Reduction of the residual norm at which a conjugate gradient solve stops (default: 1e-2f).
+ * @return The denoised image.
+ */
+Image tv_denoise_lagged_diffusivity(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const Image& input, float strength, float tol = 3.2e-3f, bool suppress_log = true,
+	Preconditioner preconditioner = Preconditioner::Jacobi, int max_cg_iterations = 100, float cg_tol = 1e-2f
+);
+
+/**
+ * @brief Performs total variation denoising using gradient descent with Barzilai-Borwein step sizes on the GPU.
+ *
+ * The step size is chosen adaptively from the change of the iterate and the gradient (spectral step),
+ * safeguarded by a non-monotone backtracking line search. No step size has to be tuned.
+ * Uses the same convergence test as tv_denoise_gradient_descent, on the lowest loss so far. The line search
+ * accepts steps that increase the loss, so the iterate with the lowest loss is returned rather than the last one.
+ *
+ * @param context OpenCL context.
+ * @param queue OpenCL command queue.
+ * @param program Compiled OpenCL program.
+ * @param input Noisy input image.
+ * @param strength Weight for the TV loss term.
+ * @param tol Tolerance for convergence (default: 3.2e-3f).
+ * @param suppress_log If true, suppresses logging output (default: true).
+ * @return The denoised image.
+ */
+Image tv_denoise_barzilai_borwein(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const Image& input, float strength, float tol = 3.2e-3f, bool suppress_log = true
+);
+
+/**
+ * @brief Performs total variation denoising using Barzilai-Borwein step sizes on the GPU, starting from a given image.
+ *
+ * Same as tv_denoise_barzilai_borwein, but the iteration is warm-started from initial instead of the noisy input.
+ *
+ * @param context OpenCL context.
+ * @param queue OpenCL command queue.
+ * @param program Compiled OpenCL program.
+ * @param input Noisy input image.
+ * @param strength Weight for the TV loss term.
+ * @param tol Tolerance for convergence.
+ * @param suppress_log If true, suppresses logging output.
+ * @param initial Starting point of the iteration, has to be the same size as input.
+ * @return The denoised image.
+ */
+Image tv_denoise_barzilai_borwein(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const Image& input, float strength, float tol, bool suppress_log, const Image& initial
+);
+
+/**
+ * @brief Performs total variation denoising using Barzilai-Borwein step sizes on the GPU, reporting its progress.
+ *
+ * Same as tv_denoise_barzilai_borwein, but progress.callback is called with the current iterate and its loss
+ * at the intervals of progress. The solver keeps the iterate on the host, so the full image is reported
+ * and progress.preview_factor is not used. If the cancellation token of progress is set, the solve stops
+ * and returns the iterate with the lowest loss so far.
+ *
+ * @param context OpenCL context.
+ * @param queue OpenCL command queue.
+ * @param program Compiled OpenCL program.
+ * @param input Noisy input image.
+ * @param strength Weight for the TV loss term.
+ * @param tol Tolerance for convergence.
+ * @param suppress_log If true, suppresses logging output.
+ * @param progress Progress callback, its intervals and the cancellation token.
+ * @return The denoised image, or the best iterate so far if the solve was cancelled.
+ */
+Image tv_denoise_barzilai_borwein(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const Image& input, float strength, float tol, bool suppress_log, const ProgressOptions& progress
+);
+
+/**
+ * @brief Denoises an image with several strengths in one run on the GPU (regularization path).
+ *
+ * The strengths are solved from the strongest to the weakest. The strongest is a plain solve from the noisy input
+ * (so a single strength gives the same result as a plain run), every further one is warm-started from the previous
+ * solution, which is much cheaper than solving every strength from the noisy input.
+ *
+ * @param context OpenCL context.
+ * @param queue OpenCL command queue.
+ * @param program Compiled OpenCL program.
+ * @param input Noisy input image, shared by every solve.
+ * @param strengths Weights for the TV loss term, in any order.
+ * @param step_size Step size (learning rate) for gradient descent, ignored by Barzilai-Borwein (default: 1e-2f).
+ * @param tol Tolerance for convergence (default: 3.2e-3f).
+ * @param suppress_log If true, suppresses logging output (default: true).
+ * @param barzilai_borwein If true, uses tv_denoise_barzilai_borwein instead of tv_denoise_gradient_descent (default: false).
+ * @return The results ordered from the strongest to the weakest strength.
+ */
+std::vector<RegularizationPathResult> tv_denoise_regularization_path(
+	cl::Context& context, cl::CommandQueue& queue, cl::Program& program,
+	const Image& input, std::vector<float> strengths, float step_size = 1e-2f, float tol = 3.2e-3f,
+	bool suppress_log = true, bool barzilai_borwein = false
 );
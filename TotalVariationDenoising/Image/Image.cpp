@@ -2,7 +2,7 @@
 
 #include "Image.h"
 
-Image::Image(int rows, int cols) : rows(rows), cols(cols), image(nullptr) {
+Image::Image(int rows, int cols) : rows(rows), cols(cols), image(nullptr), owns_data(true) {
 	if (rows < 0 || cols < 0) {
 		throw std::invalid_argument("Rows and columns must be non-negative.");
 	}
@@ -17,8 +17,56 @@ Image::Image(int rows, int cols) : rows(rows), cols(cols), image(nullptr) {
 	}
 }
 
-Image::Image(const std::string& path) {
-	cv::Mat img = cv::imread(path, cv::IMREAD_GRAYSCALE);
+Image::Image(int rows, int cols, ImageAllocation allocation) : rows(rows), cols(cols), image(nullptr), owns_data(true) {
+	if (rows < 0 || cols < 0) {
+		throw std::invalid_argument("Rows and columns must be non-negative.");
+	}
+	if (rows == 0 || cols == 0) {
+		return;
+	}
+	// new float[] does not touch the pages of a large buffer, they are placed when they are first written
+	image = new float[rows * cols];
+	if (allocation == ImageAllocation::ZeroFilled) {
+		std::fill(image, image + rows * cols, 0.0f);
+	}
+}
+
+/**
+ * @brief Returns the factor mapping the values of a pixel depth to [0, 1]: 1/255 and 1/65535 for 8- and 16-bit
+ * integers, 1 for 32-bit floats, which are taken as they are.
+ * @throws std::runtime_error for any other depth.
+ */
+static double normalization_scale(int depth) {
+	switch (depth) {
+	case CV_8U:
+		return 1.0 / 255.0;
+	case CV_16U:
+		return 1.0 / 65535.0;
+	case CV_32F:
+		return 1.0;
+	default:
+		throw std::runtime_error("Unsupported pixel depth, expected 8-bit, 16-bit or 32-bit float pixels.");
+	}
+}
+
+/**
+ * @brief Converts a single-channel matrix into the float pixels of an image, normalized to [0, 1].
+ *
+ * Bands of rows are converted in parallel, every band with the vectorized cv::Mat::convertTo,
+ * which scales while converting so there is no separate normalization pass.
+ */
+static void convert_to_float(const cv::Mat& mat, float* data) {
+	const double scale = normalization_scale(mat.depth());
+	cv::Mat target(mat.rows, mat.cols, CV_32F, data);
+	cv::parallel_for_(cv::Range(0, mat.rows), [&](const cv::Range& range) {
+		cv::Mat band = target.rowRange(range.start, range.end);
+		mat.rowRange(range.start, range.end).convertTo(band, CV_32F, scale);
+	});
+}
+
+Image::Image(const std::string& path) : owns_data(true) {
+	// 16-bit images keep their depth, anything else is loaded as 8-bit
+	cv::Mat img = cv::imread(path, cv::IMREAD_GRAYSCALE | cv::IMREAD_ANYDEPTH);
 	if (img.empty()) {
 		throw std::runtime_error("Failed to load image from path: " + path);
 	}
@@ -27,15 +75,17 @@ Image::Image(const std::string& path) {
 	cols = img.cols;
 
 	image = new float[rows * cols];
-	for (int i = 0; i < rows; ++i) {
-		for (int j = 0; j < cols; ++j) {
-			this->operator()(i, j) = static_cast<float>(img.at<unsigned char>(i, j)) / 255.0f;
-		}
+	try {
+		convert_to_float(img, image);
+	}
+	catch (...) {
+		delete[] image;
+		throw;
 	}
 }
 
-Image::Image(const cv::Mat& mat) {
-	if (mat.empty() || mat.type() != CV_8U) {
+Image::Image(const cv::Mat& mat) : owns_data(true) {
+	if (mat.empty() || mat.channels() != 1 || (mat.depth() != CV_8U && mat.depth() != CV_16U && mat.depth() != CV_32F)) {
 		throw std::runtime_error("Invalid image matrix provided.");
 	}
 
@@ -43,14 +93,19 @@ Image::Image(const cv::Mat& mat) {
 	cols = mat.cols;
 
 	image = new float[rows * cols];
-	for (int i = 0; i < rows; ++i) {
-		for (int j = 0; j < cols; ++j) {
-			this->operator()(i, j) = static_cast<float>(mat.at<unsigned char>(i, j));
-		}
+	convert_to_float(mat, image);
+}
+
+Image::Image(float* data, int rows, int cols) : rows(rows), cols(cols), image(data), owns_data(false) {
+	if (rows < 0 || cols < 0) {
+		throw std::invalid_argument("Rows and columns must be non-negative.");
+	}
+	if (!data && rows * cols != 0) {
+		throw std::invalid_argument("Cannot create an image view over a null buffer.");
 	}
 }
 
-Image::Image(const Image& other) : rows(0), cols(0), image(nullptr) {
+Image::Image(const Image& other) : rows(0), cols(0), image(nullptr), owns_data(true) {
 	if (!other.image) {
 		return;
 	}
@@ -66,7 +121,7 @@ Image::Image(const Image& other) : rows(0), cols(0), image(nullptr) {
 }
 
 Image::~Image() {
-	if (image) {
+	if (image && owns_data) {
 		delete[] image;
 		image = nullptr;
 	}
@@ -77,10 +132,11 @@ Image Image::operator=(const Image& other) {
 		return *this;
 	}
 
-	if (image) {
+	if (image && owns_data) {
 		delete[] image;
-		image = nullptr;
 	}
+	image = nullptr;
+	owns_data = true;
 
 	rows = other.rows;
 	cols = other.cols;
@@ -94,6 +150,13 @@ Image Image::operator=(const Image& other) {
 	return *this;
 }
 
+void Image::swap(Image& other) {
+	std::swap(rows, other.rows);
+	std::swap(cols, other.cols);
+	std::swap(image, other.image);
+	std::swap(owns_data, other.owns_data);
+}
+
 float& Image::operator()(int row, int col) {
 	return image[row * cols + col];
 }
@@ -102,12 +165,31 @@ const float& Image::operator()(int row, int col) const {
 	return image[row * cols + col];
 }
 
-cv::Mat Image::toMat() const {
-	cv::Mat mat(rows, cols, CV_8U);
-	for (int i = 0; i < rows; ++i) {
-		for (int j = 0; j < cols; ++j) {
-			mat.at<unsigned char>(i, j) = static_cast<unsigned char>(std::max(std::min(this->operator()(i, j) * 255.0f, 255.0f), 0.0f));
-		}
+cv::Mat Image::toMat(int depth) const {
+	if (depth != CV_8U && depth != CV_16U && depth != CV_32F) {
+		throw std::invalid_argument("Unsupported pixel depth, expected CV_8U, CV_16U or CV_32F.");
 	}
+
+	cv::Mat mat(rows, cols, CV_MAKETYPE(depth, 1));
+	const cv::Mat source(rows, cols, CV_32F, const_cast<float*>(image));
+	const double scale = 1.0 / normalization_scale(depth);
+
+	// Integer depths are scaled, rounded and clamped (saturated) in one vectorized pass per band of rows,
+	// floats are only clamped to [0, 1]. NaN becomes 0 in both cases.
+	cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range& range) {
+		if (depth != CV_32F) {
+			cv::Mat band = mat.rowRange(range.start, range.end);
+			source.rowRange(range.start, range.end).convertTo(band, depth, scale);
+			return;
+		}
+		for (int i = range.start; i < range.end; ++i) {
+			const float* src = &image[i * cols];
+			float* dst = mat.ptr<float>(i);
+			for (int j = 0; j < cols; ++j) {
+				const float value = src[j];
+				dst[j] = value > 0.0f ? (value < 1.0f ? value : 1.0f) : 0.0f;
+			}
+		}
+	});
 	return mat;
 }
@@ -9,6 +9,19 @@
 #include <opencv2/opencv.hpp>
 #include <string>
 
+/**
+ * @brief How a new image places its pixel buffer in memory (see Image(int, int, ImageAllocation)).
+ */
+enum class ImageAllocation {
+	/** The pixels are set to zero by the constructing thread, so the pages end up on its NUMA node. */
+	ZeroFilled,
+	/**
+	 * The pixels are left uninitialized. The operating system places every page on the NUMA node of the thread
+	 * that writes it first, so the threads that will process the rows should initialize them (parallel first-touch).
+	 */
+	FirstTouch
+};
+
 /**
  * @class Image
  * @brief A simple image class for handling 2D, single-channel (grayscale) images with float precision.
@@ -25,18 +38,46 @@ public:
 	 */
 	Image(int rows = 0, int cols = 0);
 
+	/**
+	 * @brief Constructs an image with the given dimensions and allocation.
+	 * @param rows Number of rows.
+	 * @param cols Number of columns.
+	 * @param allocation ZeroFilled to set every pixel to zero, FirstTouch to leave the pixels uninitialized.
+	 */
+	Image(int rows, int cols, ImageAllocation allocation);
+
 	/**
 	 * @brief Constructs an image by loading from a file.
+	 *
+	 * The image is converted to grayscale, 8-bit and 16-bit images are normalized to [0, 1].
+	 *
 	 * @param path Path to the image file.
 	 */
 	Image(const std::string& path);
 
 	/**
 	 * @brief Constructs an image from an OpenCV matrix.
-	 * @param mat OpenCV cv::Mat object.
+	 *
+	 * Same conversion as loading from a file: 8-bit (CV_8U) and 16-bit (CV_16U) pixels are normalized
+	 * to [0, 1], 32-bit float (CV_32F) pixels are copied as they are.
+	 *
+	 * @param mat Single-channel OpenCV cv::Mat object.
 	 */
 	Image(const cv::Mat& mat);
 
+	/**
+	 * @brief Constructs an image view over an existing buffer without copying it.
+	 *
+	 * The buffer must hold rows * cols floats in row-major order and must outlive the view.
+	 * The view does not take ownership, so the destructor leaves the buffer untouched.
+	 * Copying a view produces a regular image that owns its own memory.
+	 *
+	 * @param data Pointer to the first element of the external buffer.
+	 * @param rows Number of rows.
+	 * @param cols Number of columns.
+	 */
+	Image(float* data, int rows, int cols);
+
 	/**
 	 * @brief Copy constructor.
 	 * @param other Image to copy from.
@@ -67,6 +108,12 @@ public:
 	 */
 	Image operator=(const Image& other);
 
+	/**
+	 * @brief Exchanges the contents of two images without copying the pixels.
+	 * @param other Image to swap with.
+	 */
+	void swap(Image& other);
+
 	/**
 	 * @brief Accesses a pixel value (modifiable).
 	 * @param row Row index.
@@ -86,11 +133,13 @@ public:
 	/**
 	 * @brief Converts the image to an OpenCV cv::Mat object. 
 	 *
-	 * Can be used to display or save the image, using OpenCV functions.
+	 * Can be used to display or save the image, using OpenCV functions. The pixels are clamped to [0, 1],
+	 * for the integer depths scaled to the full range and rounded to the nearest value.
 	 *
-	 * @return cv::Mat representation of the image.
+	 * @param depth Pixel depth of the matrix: CV_8U, CV_16U or CV_32F (default: CV_8U).
+	 * @return Single-channel cv::Mat representation of the image.
 	 */
-	cv::Mat toMat() const;
+	cv::Mat toMat(int depth = CV_8U) const;
 
 	/**
 	 * @brief Returns a pointer to the underlying memory of the flattened image. 
@@ -112,8 +161,15 @@ public:
 	 */
 	inline const float* data() const { return image; }
 
+	/**
+	 * @brief Returns whether the image owns (and releases) its pixel buffer.
+	 * @return False for views created over external memory, true otherwise.
+	 */
+	inline bool ownsData() const { return owns_data; }
+
 private:
 	int rows;
 	int cols;
 	float* image;
+	bool owns_data;
 };
@@ -0,0 +1,600 @@
+#ifndef __CL_ENABLE_EXCEPTIONS
+#define __CL_ENABLE_EXCEPTIONS
+#endif
+#define PY_SSIZE_T_CLEAN
+
+#include <Python.h>
+#include <CL/cl.hpp>
+#include <oclutils.hpp>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "../Image/Image.h"
+#include "../CPU_Denoising/Denoising.h"
+#include "../GPU_Denoising/Denoising.h"
+
+/**
+ * @brief Python object owning a denoised Image and exposing it through the buffer protocol.
+ *
+ * The result of a solve is never copied: NumPy arrays created from this object share its memory
+ * and keep it alive through their base reference.
+ */
+struct DenoisedImageObject {
+	PyObject_HEAD
+	Image* image;
+	Py_ssize_t shape[2];
+	Py_ssize_t strides[2];
+};
+
+static void DenoisedImage_dealloc(DenoisedImageObject* self) {
+	delete self->image;
+	Py_TYPE(self)->tp_free(reinterpret_cast<PyObject*>(self));
+}
+
+static int DenoisedImage_getbuffer(DenoisedImageObject* self, Py_buffer* view, int flags) {
+	view->obj = reinterpret_cast<PyObject*>(self);
+	view->buf = self->image->data();
+	view->len = self->shape[0] * self->shape[1] * static_cast<Py_ssize_t>(sizeof(float));
+	view->readonly = 0;
+	view->itemsize = sizeof(float);
+	view->format = (flags & PyBUF_FORMAT) ? const_cast<char*>("f") : nullptr;
+	view->ndim = 2;
+	view->shape = (flags & PyBUF_ND) ? self->shape : nullptr;
+	view->strides = (flags & PyBUF_STRIDES) ? self->strides : nullptr;
+	view->suboffsets = nullptr;
+	view->internal = nullptr;
+	Py_INCREF(self);
+	return 0;
+}
+
+static PyBufferProcs DenoisedImage_as_buffer = {
+	reinterpret_cast<getbufferproc>(DenoisedImage_getbuffer),
+	nullptr
+};
+
+static PyTypeObject DenoisedImageType = {
+	PyVarObject_HEAD_INIT(nullptr, 0)
+	"tv_denoising.DenoisedImage"
+};
+
+/**
+ * @brief Wraps a solver result into a NumPy array without copying the pixels.
+ *
+ * Falls back to returning the raw buffer object if NumPy is not available.
+ *
+ * @param image Heap allocated result, ownership is transferred to the returned object.
+ * @return New reference to the array, or nullptr with a Python error set.
+ */
+static PyObject* wrap_result(Image* image) {
+	DenoisedImageObject* result = PyObject_New(DenoisedImageObject, &DenoisedImageType);
+	if (!result) {
+		delete image;
+		return nullptr;
+	}
+	result->image = image;
+	result->shape[0] = image->getRows();
+	result->shape[1] = image->getCols();
+	result->strides[0] = image->getCols() * static_cast<Py_ssize_t>(sizeof(float));
+	result->strides[1] = sizeof(float);
+
+	PyObject* numpy = PyImport_ImportModule("numpy");
+	if (!numpy) {
+		PyErr_Clear();
+		return reinterpret_cast<PyObject*>(result);
+	}
+	PyObject* array = PyObject_CallMethod(numpy, "asarray", "O", result);
+	Py_DECREF(numpy);
+	Py_DECREF(result);
+	return array;
+}
+
+/**
+ * @brief Acquires a C-contiguous, two dimensional float32 buffer from a Python object.
+ * @param obj Any object implementing the buffer protocol (e.g. a NumPy array).
+ * @param view Output buffer view, has to be released with PyBuffer_Release on success.
+ * @return True on success, false with a Python error set otherwise.
+ */
+static bool get_image_buffer(PyObject* obj, Py_buffer* view) {
+	if (PyObject_GetBuffer(obj, view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) != 0) {
+		return false;
+	}
+
+	const char* format = view->format ? view->format : "B";
+	const bool is_float32 = view->itemsize == sizeof(float) &&
+		(std::strcmp(format, "f") == 0 || std::strcmp(format, "<f") == 0 || std::strcmp(format, "=f") == 0);
+
+	if (view->ndim != 2 || !is_float32) {
+		PyBuffer_Release(view);
+		PyErr_SetString(PyExc_TypeError, "Expected a C-contiguous, two dimensional float32 array.");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Runs a solver on the given buffer with the GIL released.
+ * @tparam Solve Callable taking a const Image& and returning the denoised Image.
+ * @param input Python object exposing the noisy image.
+ * @param solve Solver invocation.
+ * @return New reference to the denoised NumPy array, or nullptr with a Python error set.
+ */
+template <typename Solve>
+static PyObject* run_solver(PyObject* input, Solve solve) {
+	Py_buffer view;
+	if (!get_image_buffer(input, &view)) {
+		return nullptr;
+	}
+
+	const int rows = static_cast<int>(view.shape[0]);
+	const int cols = static_cast<int>(view.shape[1]);
+
+	Image* result = nullptr;
+	std::string error;
+
+	Py_BEGIN_ALLOW_THREADS
+	try {
+		const Image image(static_cast<float*>(view.buf), rows, cols);
+		// Take over the pixels of the solution instead of copying them, Image has no move constructor
+		Image solution = solve(image);
+		result = new Image();
+		result->swap(solution);
+	}
+	catch (const cl::Error& e) {
+		error = std::string("OpenCL error in ") + e.what() + " (" + std::to_string(e.err()) + ")";
+	}
+	catch (const std::exception& e) {
+		error = e.what();
+	}
+	catch (...) {
+		error = "Unknown error during denoising.";
+	}
+	Py_END_ALLOW_THREADS
+
+	PyBuffer_Release(&view);
+
+	if (!result) {
+		PyErr_SetString(PyExc_RuntimeError, error.c_str());
+		return nullptr;
+	}
+	return wrap_result(result);
+}
+
+/**
+ * @brief Forwards the progress of a solve running without the GIL to a Python callable.
+ *
+ * The callable is called as progress(iteration, loss, image) with the GIL held, image is a copy of the
+ * iterate (the downsampled preview on the GPU). Returning True cancels the solve. An exception raised by
+ * the callable cancels the solve as well and is raised again once the solve returned (see finish).
+ */
+struct PythonProgress {
+	ProgressOptions options;
+	CancellationToken cancellation;
+	PyObject* callable;
+	PyObject* error_type = nullptr;
+	PyObject* error_value = nullptr;
+	PyObject* error_traceback = nullptr;
+
+	PythonProgress(PyObject* callable, int interval_milliseconds) : callable(callable) {
+		options.interval_milliseconds = interval_milliseconds;
+		options.cancellation = &cancellation;
+		options.callback = [this](const DenoisingProgress& progress) {
+			PyGILState_STATE gil = PyGILState_Ensure();
+			PyObject* image = wrap_result(new Image(progress.image));
+			PyObject* result = image ? PyObject_CallFunction(this->callable, "ifO", progress.iteration, progress.loss, image) : nullptr;
+			Py_XDECREF(image);
+
+			if (!result) {
+				if (!error_type) {
+					PyErr_Fetch(&error_type, &error_value, &error_traceback);
+				}
+				PyErr_Clear();
+				cancellation.cancel();
+			}
+			else {
+				if (PyObject_IsTrue(result) == 1) {
+					cancellation.cancel();
+				}
+				PyErr_Clear();
+				Py_DECREF(result);
+			}
+			PyGILState_Release(gil);
+		};
+	}
+
+	/**
+	 * @brief Raises the exception of the callable, if any. Has to be called with the GIL held.
+	 * @param result Result of run_solver, released if the callable failed.
+	 * @return result, or nullptr with the Python error set.
+	 */
+	PyObject* finish(PyObject* result) {
+		if (!error_type) {
+			return result;
+		}
+		Py_XDECREF(result);
+		PyErr_Restore(error_type, error_value, error_traceback);
+		error_type = error_value = error_traceback = nullptr;
+		return nullptr;
+	}
+};
+
+/**
+ * @brief Checks that the progress argument is None or callable.
+ * @return True if it is valid, false with a Python error set otherwise.
+ */
+static bool check_progress(PyObject* progress) {
+	if (progress && progress != Py_None && !PyCallable_Check(progress)) {
+		PyErr_SetString(PyExc_TypeError, "progress has to be callable or None.");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief OpenCL objects shared by every GPU solve of the module.
+ *
+ * Building the program is expensive, so it is done once per kernel path and platform.
+ * The mutex serializes solves because they share the command queue. Every solve holds a shared_ptr to its
+ * environment, so switching to another configuration while a solve runs (without the GIL) does not destroy it.
+ */
+struct OpenCLEnvironment {
+	std::string kernel_path;
+	std::string platform;
+	cl::Context context;
+	cl::CommandQueue queue;
+	cl::Program program;
+	std::mutex mutex;
+};
+
+static std::shared_ptr<OpenCLEnvironment> opencl_environment;
+
+/**
+ * @brief Returns the cached OpenCL environment, (re)building it if the configuration changed.
+ *
+ * Has to be called with the GIL held.
+ *
+ * @param kernel_path Path to Denoising.cl, or nullptr to use the DENOISING_KERNEL_PATH variable.
+ * @param platform Substring of the OpenCL platform name to create the context on.
+ * @return The environment, or nullptr with a Python error set. The caller keeps it alive for the whole solve.
+ */
+static std::shared_ptr<OpenCLEnvironment> get_opencl_environment(const char* kernel_path, const char* platform) {
+	std::string path;
+	if (kernel_path) {
+		path = kernel_path;
+	}
+	else if (const char* value = std::getenv("DENOISING_KERNEL_PATH")) {
+		path = value;
+	}
+	else {
+		PyErr_SetString(PyExc_RuntimeError, "No kernel_path given and DENOISING_KERNEL_PATH is not set.");
+		return nullptr;
+	}
+
+	if (opencl_environment && opencl_environment->kernel_path == path && opencl_environment->platform == platform) {
+		return opencl_environment;
+	}
+
+	std::shared_ptr<OpenCLEnvironment> environment = std::make_shared<OpenCLEnvironment>();
+	environment->kernel_path = path;
+	environment->platform = platform;
+
+	std::vector<cl::Device> devices;
+	try {
+		if (!oclCreateContextBy(environment->context, platform)) {
+			throw cl::Error(CL_INVALID_CONTEXT, "Failed to create a valid context!");
+		}
+		devices = environment->context.getInfo<CL_CONTEXT_DEVICES>();
+		environment->queue = cl::CommandQueue(environment->context, devices[0], CL_QUEUE_PROFILING_ENABLE);
+
+		std::string source_code = oclReadSourcesFromFile(path.c_str());
+		cl::Program::Sources sources(1, std::make_pair(source_code.c_str(), source_code.length() + 1));
+		environment->program = cl::Program(environment->context, sources);
+		environment->program.build(devices);
+	}
+	catch (const cl::Error& e) {
+		std::string message = std::string("OpenCL error in ") + e.what() + " (" + std::to_string(e.err()) + ")";
+		if (!devices.empty()) {
+			message += "\nBuild Log:\t " + environment->program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(devices[0]);
+		}
+		PyErr_SetString(PyExc_RuntimeError, message.c_str());
+		return nullptr;
+	}
+
+	opencl_environment = environment;
+	return environment;
+}
+
+static PyObject* denoise_cpu(PyObject* self, PyObject* args, PyObject* kwargs) {
+	static const char* keywords[] = { "image", "strength", "step_size", "tol", "verbose", "solver", "progress", "progress_interval_ms", nullptr };
+	PyObject* input = nullptr;
+	float strength = 0.0f;
+	float step_size = 1e-2f;
+	float tol = 3.2e-3f;
+	int verbose = 0;
+	const char* solver = "gd";
+	PyObject* progress = nullptr;
+	int progress_interval_ms = 200;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Of|ffpsOi", const_cast<char**>(keywords),
+		&input, &strength, &step_size, &tol, &verbose, &solver, &progress, &progress_interval_ms)) {
+		return nullptr;
+	}
+	const bool barzilai_borwein = std::strcmp(solver, "bb") == 0;
+	const bool lagged_diffusivity = std::strcmp(solver, "ld") == 0;
+	if (!barzilai_borwein && !lagged_diffusivity && std::strcmp(solver, "gd") != 0) {
+		PyErr_SetString(PyExc_ValueError, "solver has to be 'gd', 'bb' or 'ld'.");
+		return nullptr;
+	}
+	if (!check_progress(progress)) {
+		return nullptr;
+	}
+	// Lagged diffusivity has no per-iteration iterate to report or cancel, a progress callable would be silently ignored
+	if (progress && progress != Py_None && lagged_diffusivity) {
+		PyErr_SetString(PyExc_ValueError, "progress is not supported by solver 'ld'.");
+		return nullptr;
+	}
+
+	if (progress && progress != Py_None) {
+		PythonProgress python_progress(progress, progress_interval_ms);
+		return python_progress.finish(run_solver(input, [&](const Image& image) {
+			if (barzilai_borwein) {
+				return tv_denoise_barzilai_borwein(image, strength, tol, !verbose, python_progress.options);
+			}
+			return tv_denoise_gradient_descent(image, strength, step_size, tol, !verbose, python_progress.options);
+		}));
+	}
+
+	return run_solver(input, [=](const Image& image) {
+		if (barzilai_borwein) {
+			return tv_denoise_barzilai_borwein(image, strength, tol, !verbose);
+		}
+		if (lagged_diffusivity) {
+			return tv_denoise_lagged_diffusivity(image, strength, tol, !verbose);
+		}
+		return tv_denoise_gradient_descent(image, strength, step_size, tol, !verbose);
+	});
+}
+
+static PyObject* denoise_gpu(PyObject* self, PyObject* args, PyObject* kwargs) {
+	static const char* keywords[] = {
+		"image", "strength", "step_size", "tol", "verbose", "solver", "kernel_path", "platform", "progress", "progress_interval_ms", nullptr
+	};
+	PyObject* input = nullptr;
+	float strength = 0.0f;
+	float step_size = 1e-2f;
+	float tol = 3.2e-3f;
+	int verbose = 0;
+	const char* solver = "gd";
+	const char* kernel_path = nullptr;
+	const char* platform = "intel";
+	PyObject* progress = nullptr;
+	int progress_interval_ms = 200;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Of|ffpszsOi", const_cast<char**>(keywords),
+		&input, &strength, &step_size, &tol, &verbose, &solver, &kernel_path, &platform, &progress, &progress_interval_ms)) {
+		return nullptr;
+	}
+	const bool barzilai_borwein = std::strcmp(solver, "bb") == 0;
+	const bool lagged_diffusivity = std::strcmp(solver, "ld") == 0;
+	if (!barzilai_borwein && !lagged_diffusivity && std::strcmp(solver, "gd") != 0) {
+		PyErr_SetString(PyExc_ValueError, "solver has to be 'gd', 'bb' or 'ld'.");
+		return nullptr;
+	}
+	if (!check_progress(progress)) {
+		return nullptr;
+	}
+	// Lagged diffusivity has no per-iteration iterate to report or cancel, a progress callable would be silently ignored
+	if (progress && progress != Py_None && lagged_diffusivity) {
+		PyErr_SetString(PyExc_ValueError, "progress is not supported by solver 'ld'.");
+		return nullptr;
+	}
+
+	std::shared_ptr<OpenCLEnvironment> environment = get_opencl_environment(kernel_path, platform);
+	if (!environment) {
+		return nullptr;
+	}
+
+	// Progress reporting of gradient descent uses the device-resident solver, which reads back a downsampled preview
+	if (progress && progress != Py_None) {
+		PythonProgress python_progress(progress, progress_interval_ms);
+		return python_progress.finish(run_solver(input, [&](const Image& image) {
+			std::lock_guard<std::mutex> lock(environment->mutex);
+			if (barzilai_borwein) {
+				return tv_denoise_barzilai_borwein(
+					environment->context, environment->queue, environment->program,
+					image, strength, tol, !verbose, python_progress.options
+				);
+			}
+			return tv_denoise_gradient_descent_chunked(
+				environment->context, environment->queue, environment->program,
+				image, strength, step_size, tol, !verbose, python_progress.options
+			);
+		}));
+	}
+
+	return run_solver(input, [=](const Image& image) {
+		std::lock_guard<std::mutex> lock(environment->mutex);
+		if (barzilai_borwein) {
+			return tv_denoise_barzilai_borwein(
+				environment->context, environment->queue, environment->program,
+				image, strength, tol, !verbose
+			);
+		}
+		if (lagged_diffusivity) {
+			return tv_denoise_lagged_diffusivity(
+				environment->context, environment->queue, environment->program,
+				image, strength, tol, !verbose
+			);
+		}
+		return tv_denoise_gradient_descent(
+			environment->context, environment->queue, environment->program,
+			image, strength, step_size, tol, !verbose
+		);
+	});
+}
+
+static PyObject* denoise_gpu_batch(PyObject* self, PyObject* args, PyObject* kwargs) {
+	static const char* keywords[] = { "images", "strength", "step_size", "tol", "verbose", "kernel_path", "platform", nullptr };
+	PyObject* inputs = nullptr;
+	float strength = 0.0f;
+	float step_size = 1e-2f;
+	float tol = 3.2e-3f;
+	int verbose = 0;
+	const char* kernel_path = nullptr;
+	const char* platform = "intel";
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Of|ffpzs", const_cast<char**>(keywords),
+		&inputs, &strength, &step_size, &tol, &verbose, &kernel_path, &platform)) {
+		return nullptr;
+	}
+
+	PyObject* sequence = PySequence_Fast(inputs, "images has to be a sequence of arrays.");
+	if (!sequence) {
+		return nullptr;
+	}
+	const Py_ssize_t count = PySequence_Fast_GET_SIZE(sequence);
+
+	// The views stay acquired during the solve, the images wrap their memory without copying
+	std::vector<Py_buffer> views(count);
+	Py_ssize_t acquired = 0;
+	for (; acquired < count; ++acquired) {
+		if (!get_image_buffer(PySequence_Fast_GET_ITEM(sequence, acquired), &views[acquired])) {
+			break;
+		}
+	}
+	auto release = [&]() {
+		for (Py_ssize_t i = 0; i < acquired; ++i) {
+			PyBuffer_Release(&views[i]);
+		}
+		Py_DECREF(sequence);
+	};
+	if (acquired < count) {
+		release();
+		return nullptr;
+	}
+
+	std::shared_ptr<OpenCLEnvironment> environment = get_opencl_environment(kernel_path, platform);
+	if (!environment) {
+		release();
+		return nullptr;
+	}
+
+	std::vector<Image> results;
+	std::string error;
+	bool solved = false;
+
+	Py_BEGIN_ALLOW_THREADS
+	try {
+		std::vector<Image> images;
+		images.reserve(count);
+		for (const Py_buffer& view : views) {
+			images.emplace_back(static_cast<float*>(view.buf), static_cast<int>(view.shape[0]), static_cast<int>(view.shape[1]));
+		}
+		std::lock_guard<std::mutex> lock(environment->mutex);
+		results = tv_denoise_gradient_descent_batched(
+			environment->context, environment->queue, environment->program,
+			images, strength, step_size, tol, !verbose
+		);
+		solved = true;
+	}
+	catch (const cl::Error& e) {
+		error = std::string("OpenCL error in ") + e.what() + " (" + std::to_string(e.err()) + ")";
+	}
+	catch (const std::exception& e) {
+		error = e.what();
+	}
+	catch (...) {
+		error = "Unknown error during denoising.";
+	}
+	Py_END_ALLOW_THREADS
+
+	release();
+
+	if (!solved) {
+		PyErr_SetString(PyExc_RuntimeError, error.c_str());
+		return nullptr;
+	}
+
+	PyObject* list = PyList_New(count);
+	if (!list) {
+		return nullptr;
+	}
+	for (Py_ssize_t i = 0; i < count; ++i) {
+		// Hand the pixels of the result over instead of copying them, Image has no move constructor
+		Image* result = new Image();
+		result->swap(results[i]);
+		PyObject* array = wrap_result(result);
+		if (!array) {
+			Py_DECREF(list);
+			return nullptr;
+		}
+		PyList_SET_ITEM(list, i, array);
+	}
+	return list;
+}
+
+static PyMethodDef tv_denoising_methods[] = {
+	{
+		"denoise_cpu", reinterpret_cast<PyCFunction>(reinterpret_cast<void(*)(void)>(denoise_cpu)), METH_VARARGS | METH_KEYWORDS,
+		"denoise_cpu(image, strength, step_size=1e-2, tol=3.2e-3, verbose=False, solver='gd', progress=None, progress_interval_ms=200)\n\n"
+		"Total variation denoising of a 2D float32 array on the CPU. The GIL is released during the solve.\n"
+		"solver is 'gd' (momentum gradient descent), 'bb' (Barzilai-Borwein steps) or 'ld' (lagged diffusivity\n"
+		"with conjugate gradient), step_size is only used by 'gd'.\n"
+		"progress(iteration, loss, image) is called every progress_interval_ms milliseconds with a copy of the\n"
+		"current image (gd and bb only), returning True stops the solve and returns the current image (bb: the one with the lowest loss)."
+	},
+	{
+		"denoise_gpu", reinterpret_cast<PyCFunction>(reinterpret_cast<void(*)(void)>(denoise_gpu)), METH_VARARGS | METH_KEYWORDS,
+		"denoise_gpu(image, strength, step_size=1e-2, tol=3.2e-3, verbose=False, solver='gd', kernel_path=None, platform='intel',\n"
+		"            progress=None, progress_interval_ms=200)\n\n"
+		"Total variation denoising of a 2D float32 array with OpenCL. The GIL is released during the solve.\n"
+		"solver is 'gd' (momentum gradient descent), 'bb' (Barzilai-Borwein steps) or 'ld' (lagged diffusivity\n"
+		"with conjugate gradient), step_size is only used by 'gd'.\n"
+		"progress(iteration, loss, image) is called every progress_interval_ms milliseconds with a preview downsampled\n"
+		"by 4 in each direction (gd) or the full image (bb), returning True stops the solve and returns the current image (bb: the one with the lowest loss).\n"
+		"kernel_path defaults to the DENOISING_KERNEL_PATH environment variable."
+	},
+	{
+		"denoise_gpu_batch", reinterpret_cast<PyCFunction>(reinterpret_cast<void(*)(void)>(denoise_gpu_batch)), METH_VARARGS | METH_KEYWORDS,
+		"denoise_gpu_batch(images, strength, step_size=1e-2, tol=3.2e-3, verbose=False, kernel_path=None, platform='intel')\n\n"
+		"Total variation denoising of a list of 2D float32 arrays (of any sizes) with OpenCL in one batched gradient descent.\n"
+		"The images are packed into one device buffer and every kernel launch covers all of them, each image stops at its\n"
+		"own convergence. Much faster than calling denoise_gpu for every image when the images are small.\n"
+		"Returns the list of denoised arrays. The GIL is released during the solve."
+	},
+	{ nullptr, nullptr, 0, nullptr }
+};
+
+static PyModuleDef tv_denoising_module = {
+	PyModuleDef_HEAD_INIT,
+	"tv_denoising",
+	"Zero-copy bindings of the CPU and OpenCL total variation denoising solvers.",
+	-1,
+	tv_denoising_methods
+};
+
+PyMODINIT_FUNC PyInit_tv_denoising(void) {
+	DenoisedImageType.tp_basicsize = sizeof(DenoisedImageObject);
+	DenoisedImageType.tp_flags = Py_TPFLAGS_DEFAULT;
+	DenoisedImageType.tp_doc = "Denoised image buffer owned by the solver.";
+	DenoisedImageType.tp_dealloc = reinterpret_cast<destructor>(DenoisedImage_dealloc);
+	DenoisedImageType.tp_as_buffer = &DenoisedImage_as_buffer;
+	if (PyType_Ready(&DenoisedImageType) < 0) {
+		return nullptr;
+	}
+
+	PyObject* module = PyModule_Create(&tv_denoising_module);
+	if (!module) {
+		return nullptr;
+	}
+
+	Py_INCREF(&DenoisedImageType);
+	if (PyModule_AddObject(module, "DenoisedImage", reinterpret_cast<PyObject*>(&DenoisedImageType)) < 0) {
+		Py_DECREF(&DenoisedImageType);
+		Py_DECREF(module);
+		return nullptr;
+	}
+	return module;
+}
@@ -0,0 +1,44 @@
+import os
+import sys
+from setuptools import setup, Extension
+
+# Same default locations as the Visual Studio projects, override them with environment variables if needed
+opencv_dir = os.environ.get("OPENCV_DIR", r"C:\OpenCV\opencv\build")
+oclpack_dir = os.environ.get("OCLPACK_DIR", r"T:\OCLPack")
+opencv_lib = os.environ.get("OPENCV_LIB", "opencv_world4110")
+
+# Image exports its class with __declspec and includes the Windows precompiled header, the library paths are the MSVC ones
+if sys.platform != "win32":
+    sys.exit("tv_denoising can only be built on Windows with MSVC (the Image library and the library paths are Windows-specific).")
+
+compile_args = ["/std:c++17", "/O2", "/EHsc"]
+
+tv_denoising = Extension(
+    "tv_denoising",
+    sources = [
+        "PyDenoising.cpp",
+        os.path.join("..", "Image", "Image.cpp"),
+        os.path.join("..", "CPU_Denoising", "Denoising.cpp"),
+        os.path.join("..", "GPU_Denoising", "Denoising.cpp"),
+    ],
+    include_dirs = [
+        os.path.join("..", "Image"),
+        os.path.join(opencv_dir, "include"),
+        os.path.join(oclpack_dir, "include"),
+    ],
+    library_dirs = [
+        os.path.join(opencv_dir, "x64", "vc16", "lib"),
+        os.path.join(oclpack_dir, "lib", "x64"),
+    ],
+    libraries = [opencv_lib, "OpenCL"],
+    define_macros = [("IMAGE_EXPORTS", None), ("__CL_ENABLE_EXCEPTIONS", None)],
+    extra_compile_args = compile_args,
+    language = "c++",
+)
+
+setup(
+    name = "tv_denoising",
+    version = "1.0",
+    description = "Python bindings of the CPU and OpenCL total variation denoising solvers",
+    ext_modules = [tv_denoising],
+)
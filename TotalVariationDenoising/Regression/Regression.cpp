@@ -0,0 +1,491 @@
+#define __NO_STD_VECTOR
+#define __CL_ENABLE_EXCEPTIONS
+
+#include <CL/cl.hpp>
+#include <oclutils.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../Image/Image.h"
+#include "../Common/CommandLine.h"
+#include "../Common/SyntheticImages.h"
+#include "../CPU_Denoising/Denoising.h"
+#include "../GPU_Denoising/Denoising.h"
+
+/**
+ * @brief Image size and noise of a regression case, the clean image is the synthetic test pattern.
+ */
+struct RegressionCase {
+	int rows;
+	int cols;
+	NoiseType noise;
+	float level;
+
+	/** @return Name of the case in the report and the baseline file, e.g. "512x512-gaussian-0.1". */
+	std::string name() const {
+		std::ostringstream stream;
+		stream << rows << "x" << cols << "-" << (noise == NoiseType::Gaussian ? "gaussian" : "poisson") << "-" << level;
+		return stream.str();
+	}
+};
+
+/**
+ * @brief Result and cost of one solver on one case.
+ */
+struct SolverRun {
+	Image result;
+	/** Iteration the solver converged at, -1 if it did not report one. */
+	int iterations;
+	/** Fastest wall-clock time of the timed repetitions. */
+	double seconds;
+};
+
+/** @brief Iterations and time of a solver on a case, keyed by "case solver". */
+typedef std::map<std::string, std::pair<int, double>> Baseline;
+
+/**
+ * @brief Parses the iteration count from the log of a solver ("Converged after N iterations").
+ */
+static int converged_iterations(const std::string& log) {
+	const std::string marker = "Converged after ";
+	const size_t position = log.rfind(marker);
+	if (position == std::string::npos) {
+		return -1;
+	}
+	return std::atoi(log.c_str() + position + marker.size());
+}
+
+/**
+ * @brief Runs a solver once with its log captured to get the result and the iteration count,
+ * then repeats it without logging and keeps the fastest time.
+ */
+static SolverRun run_solver(const std::function<Image(bool suppress_log)>& solve, int repeats) {
+	SolverRun run{ Image(), -1, std::numeric_limits<double>::infinity() };
+
+	std::ostringstream log;
+	std::streambuf* console = std::cout.rdbuf(log.rdbuf());
+	try {
+		run.result = solve(false);
+	}
+	catch (...) {
+		std::cout.rdbuf(console);
+		throw;
+	}
+	std::cout.rdbuf(console);
+	run.iterations = converged_iterations(log.str());
+
+	for (int repeat = 0; repeat < repeats; ++repeat) {
+		auto start = std::chrono::high_resolution_clock::now();
+		solve(true);
+		std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+		run.seconds = std::min(run.seconds, elapsed.count());
+	}
+	return run;
+}
+
+/**
+ * @brief Peak signal-to-noise ratio in dB of an image against a reference, both in [0, 1].
+ */
+static double psnr(const Image& image, const Image& reference) {
+	const size_t size = static_cast<size_t>(image.getRows()) * image.getCols();
+	double squared_error = 0.0;
+	for (size_t k = 0; k < size; ++k) {
+		const double diff = static_cast<double>(image.data()[k]) - reference.data()[k];
+		squared_error += diff * diff;
+	}
+	const double mse = squared_error / static_cast<double>(size);
+	return mse > 0.0 ? 10.0 * std::log10(1.0 / mse) : std::numeric_limits<double>::infinity();
+}
+
+/**
+ * @brief Blurs an image with the 11 x 11 Gaussian window (sigma 1.5) of SSIM, repeating the border pixels.
+ */
+static std::vector<double> ssim_window(const std::vector<double>& values, int rows, int cols) {
+	const int radius = 5;
+	double weights[2 * radius + 1];
+	double total = 0.0;
+	for (int k = -radius; k <= radius; ++k) {
+		weights[k + radius] = std::exp(-(k * k) / (2.0 * 1.5 * 1.5));
+		total += weights[k + radius];
+	}
+	for (double& weight : weights) {
+		weight /= total;
+	}
+
+	// Separable: rows first, then columns
+	std::vector<double> horizontal(values.size());
+	std::vector<double> blurred(values.size());
+	for (int i = 0; i < rows; ++i) {
+		for (int j = 0; j < cols; ++j) {
+			double sum = 0.0;
+			for (int k = -radius; k <= radius; ++k) {
+				sum += weights[k + radius] * values[i * cols + std::min(std::max(j + k, 0), cols - 1)];
+			}
+			horizontal[i * cols + j] = sum;
+		}
+	}
+	for (int i = 0; i < rows; ++i) {
+		for (int j = 0; j < cols; ++j) {
+			double sum = 0.0;
+			for (int k = -radius; k <= radius; ++k) {
+				sum += weights[k + radius] * horizontal[std::min(std::max(i + k, 0), rows - 1) * cols + j];
+			}
+			blurred[i * cols + j] = sum;
+		}
+	}
+	return blurred;
+}
+
+/**
+ * @brief Mean structural similarity (SSIM) of an image against a reference, both in [0, 1].
+ *
+ * Uses the Gaussian window and the constants of Wang et al. (K1 = 0.01, K2 = 0.03, dynamic range 1).
+ */
+static double ssim(const Image& image, const Image& reference) {
+	const int rows = image.getRows();
+	const int cols = image.getCols();
+	const size_t size = static_cast<size_t>(rows) * cols;
+
+	std::vector<double> x(size), y(size), xx(size), yy(size), xy(size);
+	for (size_t k = 0; k < size; ++k) {
+		x[k] = image.data()[k];
+		y[k] = reference.data()[k];
+		xx[k] = x[k] * x[k];
+		yy[k] = y[k] * y[k];
+		xy[k] = x[k] * y[k];
+	}
+	const std::vector<double> mean_x = ssim_window(x, rows, cols);
+	const std::vector<double> mean_y = ssim_window(y, rows, cols);
+	const std::vector<double> mean_xx = ssim_window(xx, rows, cols);
+	const std::vector<double> mean_yy = ssim_window(yy, rows, cols);
+	const std::vector<double> mean_xy = ssim_window(xy, rows, cols);
+
+	const double c1 = 0.01 * 0.01;
+	const double c2 = 0.03 * 0.03;
+	double total = 0.0;
+	for (size_t k = 0; k < size; ++k) {
+		const double variance_x = mean_xx[k] - mean_x[k] * mean_x[k];
+		const double variance_y = mean_yy[k] - mean_y[k] * mean_y[k];
+		const double covariance = mean_xy[k] - mean_x[k] * mean_y[k];
+		total += ((2.0 * mean_x[k] * mean_y[k] + c1) * (2.0 * covariance + c2))
+			/ ((mean_x[k] * mean_x[k] + mean_y[k] * mean_y[k] + c1) * (variance_x + variance_y + c2));
+	}
+	return total / static_cast<double>(size);
+}
+
+/**
+ * @brief Largest absolute difference of two images of the same size.
+ */
+static double max_difference(const Image& a, const Image& b) {
+	const size_t size = static_cast<size_t>(a.getRows()) * a.getCols();
+	double difference = 0.0;
+	for (size_t k = 0; k < size; ++k) {
+		difference = std::max(difference, static_cast<double>(std::abs(a.data()[k] - b.data()[k])));
+	}
+	return difference;
+}
+
+/**
+ * @brief Parses a list of sizes such as "256x256,1024x768" (rows x columns).
+ */
+static std::vector<std::pair<int, int>> parse_size_list(const std::string& list) {
+	std::vector<std::pair<int, int>> sizes;
+	std::stringstream stream(list);
+	std::string item;
+	while (std::getline(stream, item, ',')) {
+		const size_t separator = item.find('x');
+		if (separator == std::string::npos) {
+			throw std::invalid_argument("Invalid size: " + item + " (expected rows x columns, e.g. 512x512)");
+		}
+		sizes.emplace_back(std::stoi(item.substr(0, separator)), std::stoi(item.substr(separator + 1)));
+	}
+	return sizes;
+}
+
+/**
+ * @brief Parses a list of noise models with their levels such as "gaussian:0.1,poisson:30".
+ */
+static std::vector<std::pair<NoiseType, float>> parse_noise_list(const std::string& list) {
+	std::vector<std::pair<NoiseType, float>> noises;
+	std::stringstream stream(list);
+	std::string item;
+	while (std::getline(stream, item, ',')) {
+		const size_t separator = item.find(':');
+		if (separator == std::string::npos) {
+			throw std::invalid_argument("Invalid noise: " + item + " (expected type:level, e.g. gaussian:0.1)");
+		}
+		noises.emplace_back(parse_noise_type(item.substr(0, separator)), std::stof(item.substr(separator + 1)));
+	}
+	return noises;
+}
+
+/**
+ * @brief Reads a baseline written by write_baseline, one "case solver iterations seconds" line per run.
+ */
+static Baseline read_baseline(const std::string& path) {
+	std::ifstream file(path);
+	if (!file) {
+		throw std::runtime_error("Failed to open baseline file: " + path);
+	}
+	Baseline baseline;
+	std::string case_name, solver;
+	int iterations;
+	double seconds;
+	while (file >> case_name >> solver >> iterations >> seconds) {
+		baseline[case_name + " " + solver] = std::make_pair(iterations, seconds);
+	}
+	return baseline;
+}
+
+static void write_baseline(const std::string& path, const Baseline& baseline) {
+	std::ofstream file(path);
+	if (!file) {
+		throw std::runtime_error("Failed to open baseline file for writing: " + path);
+	}
+	for (const auto& entry : baseline) {
+		file << entry.first << " " << entry.second.first << " " << std::setprecision(6) << entry.second.second << std::endl;
+	}
+}
+
+int main(int argc, char** argv) {
+	if ((argc - 1) % 2 != 0) {
+		std::cerr << "Usage: " << argv[0]
+			<< " [--sizes 256x256,512x512] [--noise gaussian:0.1,poisson:30] [--strength s] [--seed n] [--repeats n]"
+			<< " [--parity max_difference] [--iteration-tolerance n] [--min-psnr-gain dB] [--min-ssim-gain g] [--gpu true|false] [--platform name]"
+			<< " [--baseline path] [--write-baseline path] [--margin fraction]"
+			<< std::endl;
+		return -1;
+	}
+
+	// Every argument is an optional "--name value" pair
+	std::string sizes = "256x256,512x512";
+	std::string noises = "gaussian:0.1,poisson:30";
+	std::string strength_str = "0.15";
+	std::string seed_str = "1";
+	std::string repeats_str = "3";
+	std::string parity_str = "1e-4";
+	std::string iteration_tolerance_str = "1";
+	std::string psnr_gain_str = "3";
+	std::string ssim_gain_str = "0.05";
+	bool use_gpu = true;
+	std::string platform = "intel";
+	std::string baseline_path;
+	std::string write_baseline_path;
+	std::string margin_str = "0.15";
+	for (int i = 1; i < argc; i += 2) {
+		std::string option = argv[i];
+		if (option == "--sizes") {
+			sizes = argv[i + 1];
+		}
+		else if (option == "--noise") {
+			noises = argv[i + 1];
+		}
+		else if (option == "--strength") {
+			strength_str = argv[i + 1];
+		}
+		else if (option == "--seed") {
+			seed_str = argv[i + 1];
+		}
+		else if (option == "--repeats") {
+			repeats_str = argv[i + 1];
+		}
+		else if (option == "--parity") {
+			parity_str = argv[i + 1];
+		}
+		else if (option == "--iteration-tolerance") {
+			iteration_tolerance_str = argv[i + 1];
+		}
+		else if (option == "--min-psnr-gain") {
+			psnr_gain_str = argv[i + 1];
+		}
+		else if (option == "--min-ssim-gain") {
+			ssim_gain_str = argv[i + 1];
+		}
+		else if (option == "--gpu") {
+			std::string value = argv[i + 1];
+			use_gpu = value == "true" || value == "1";
+		}
+		else if (option == "--platform") {
+			platform = argv[i + 1];
+		}
+		else if (option == "--baseline") {
+			baseline_path = argv[i + 1];
+		}
+		else if (option == "--write-baseline") {
+			write_baseline_path = argv[i + 1];
+		}
+		else if (option == "--margin") {
+			margin_str = argv[i + 1];
+		}
+		else {
+			std::cerr << "Unknown option: " << option << std::endl;
+			return -1;
+		}
+	}
+
+	try {
+		const float strength = std::stof(strength_str);
+		const uint32_t seed = static_cast<uint32_t>(std::stoul(seed_str));
+		const int repeats = std::stoi(repeats_str);
+		const double parity = std::stod(parity_str);
+		const int iteration_tolerance = std::stoi(iteration_tolerance_str);
+		const double psnr_gain = std::stod(psnr_gain_str);
+		const double ssim_gain = std::stod(ssim_gain_str);
+		const double margin = std::stod(margin_str);
+
+		std::vector<RegressionCase> cases;
+		for (const std::pair<int, int>& size : parse_size_list(sizes)) {
+			for (const std::pair<NoiseType, float>& noise : parse_noise_list(noises)) {
+				cases.push_back(RegressionCase{ size.first, size.second, noise.first, noise.second });
+			}
+		}
+
+		const Baseline baseline = baseline_path.empty() ? Baseline() : read_baseline(baseline_path);
+		Baseline measured;
+
+		// The OpenCL solver runs on the platform given (by default Intel's CPU runtime), built as in GPU_Denoising
+		cl::Context context;
+		cl::CommandQueue queue;
+		cl::Program program;
+		if (use_gpu) {
+			if (!oclCreateContextBy(context, platform)) {
+				throw cl::Error(CL_INVALID_CONTEXT, "Failed to create a valid context!");
+			}
+			cl::vector<cl::Device> devices = context.getInfo<CL_CONTEXT_DEVICES>();
+			queue = cl::CommandQueue(context, devices[0], CL_QUEUE_PROFILING_ENABLE);
+
+			std::string kernel_path;
+			char* value = nullptr;
+			size_t len = 0;
+			if (_dupenv_s(&value, &len, "DENOISING_KERNEL_PATH") == 0 && value != nullptr) {
+				kernel_path = value;
+				free(value);
+			}
+			else {
+				std::cerr << "Environment variable not set." << std::endl;
+				return -1;
+			}
+			std::string source_code = oclReadSourcesFromFile(kernel_path.c_str());
+			cl::Program::Sources sources(1, std::make_pair(source_code.c_str(), source_code.length() + 1));
+			program = cl::Program(context, sources);
+			try {
+				program.build(devices);
+			}
+			catch (cl::Error error) {
+				oclPrintError(error);
+				std::cerr << "Build Log:\t " << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(devices[0]) << std::endl;
+				return -1;
+			}
+		}
+
+		std::vector<std::string> failures;
+		auto check = [&](bool passed, const std::string& what) {
+			if (!passed) {
+				failures.push_back(what);
+				std::cout << "  FAILED: " << what << std::endl;
+			}
+		};
+
+		std::cout << std::fixed;
+		for (const RegressionCase& test_case : cases) {
+			const std::string case_name = test_case.name();
+			const Image clean = make_test_pattern(test_case.rows, test_case.cols);
+			const Image noisy = add_noise(clean, test_case.noise, test_case.level, seed);
+			const double noisy_psnr = psnr(noisy, clean);
+			const double noisy_ssim = ssim(noisy, clean);
+			std::cout << case_name << ": noisy PSNR " << std::setprecision(2) << noisy_psnr << " dB, SSIM " << std::setprecision(4) << noisy_ssim << std::endl;
+
+			std::vector<std::pair<std::string, SolverRun>> runs;
+			runs.emplace_back("cpu", run_solver([&](bool suppress_log) {
+				return tv_denoise_gradient_descent(noisy, strength, 1e-2f, 3.2e-3f, suppress_log);
+			}, repeats));
+			if (use_gpu) {
+				runs.emplace_back("opencl", run_solver([&](bool suppress_log) {
+					return tv_denoise_gradient_descent(context, queue, program, noisy, strength, 1e-2f, 3.2e-3f, suppress_log);
+				}, repeats));
+			}
+
+			for (const std::pair<std::string, SolverRun>& entry : runs) {
+				const std::string& solver = entry.first;
+				const SolverRun& run = entry.second;
+				const double run_psnr = psnr(run.result, clean);
+				const double run_ssim = ssim(run.result, clean);
+				std::cout << "  " << std::setw(6) << solver << ": " << std::setw(5) << run.iterations << " iterations, "
+					<< std::setprecision(4) << run.seconds << " s, PSNR " << std::setprecision(2) << run_psnr
+					<< " dB, SSIM " << std::setprecision(4) << run_ssim << std::endl;
+
+				check(run.iterations > 0, case_name + " " + solver + " did not report convergence");
+				check(run_psnr >= noisy_psnr + psnr_gain, case_name + " " + solver + " PSNR gain below " + psnr_gain_str + " dB");
+				check(run_ssim >= noisy_ssim + ssim_gain, case_name + " " + solver + " SSIM gain below " + ssim_gain_str);
+
+				// Only slowdowns and extra iterations beyond the margin fail, improvements are reported by the next baseline
+				const std::string key = case_name + " " + solver;
+				measured[key] = std::make_pair(run.iterations, run.seconds);
+				const Baseline::const_iterator reference = baseline.find(key);
+				if (reference != baseline.end()) {
+					std::cout << "          baseline: " << std::setw(5) << reference->second.first << " iterations, "
+						<< std::setprecision(4) << reference->second.second << " s" << std::endl;
+					check(run.seconds <= reference->second.second * (1.0 + margin), key + " slower than the baseline by more than the margin");
+					check(run.iterations <= reference->second.first * (1.0 + margin), key + " needs more iterations than the baseline by more than the margin");
+				}
+			}
+
+			// Both solvers round the gradient and the update the same way, but the CPU sums the loss in fixed point
+			// and the OpenCL solver in a float tree, so a convergence test that lands right at the tolerance can
+			// stop an iteration apart. The iteration counts may differ by iteration_tolerance, the results only
+			// differ by the rounding of the device math functions and by those iterations.
+			if (runs.size() == 2) {
+				const int iteration_difference = std::abs(runs[0].second.iterations - runs[1].second.iterations);
+				check(
+					iteration_difference <= iteration_tolerance,
+					case_name + " CPU and OpenCL iteration counts differ by more than " + iteration_tolerance_str
+				);
+				const double difference = max_difference(runs[0].second.result, runs[1].second.result);
+				std::cout << "  parity: max difference " << std::scientific << std::setprecision(2) << difference << std::fixed << std::endl;
+				check(difference <= parity, case_name + " CPU and OpenCL results differ by more than " + parity_str);
+			}
+
+			// The tiled solver computes the iterates of gradient descent checked once per sweep, for any tiles and threads
+			const int sweep_iterations = 4;
+			const Image checked = tv_denoise_gradient_descent(noisy, strength, 1e-2f, 3.2e-3f, true, sweep_iterations);
+			for (const std::pair<int, int>& tiling : { std::make_pair(32, 1), std::make_pair(48, 4) }) {
+				const Image tiled = tv_denoise_gradient_descent_tiled(
+					noisy, strength, 1e-2f, 3.2e-3f, true, sweep_iterations, tiling.first, tiling.second
+				);
+				const size_t bytes = static_cast<size_t>(tiled.getRows()) * tiled.getCols() * sizeof(float);
+				check(std::memcmp(tiled.data(), checked.data(), bytes) == 0, case_name + " tiled solver (tile " + std::to_string(tiling.first)
+					+ ", " + std::to_string(tiling.second) + " threads) differs from gradient descent with check_every " + std::to_string(sweep_iterations));
+			}
+		}
+
+		if (!write_baseline_path.empty()) {
+			write_baseline(write_baseline_path, measured);
+		}
+
+		if (failures.empty()) {
+			std::cout << "All checks passed" << std::endl;
+			return 0;
+		}
+		std::cout << failures.size() << " checks failed" << std::endl;
+		return 1;
+	}
+	catch (const std::exception& e) {
+		std::cerr << "Exception: " << e.what() << std::endl;
+		return -1;
+	}
+	catch (...) {
+		std::cout << "Other exception" << std::endl;
+		return -1;
+	}
+}
@@ -1,9 +1,23 @@
 import tkinter as tk
 from tkinter import filedialog, messagebox
 from PIL import Image, ImageTk
+import numpy as np
 import subprocess
+import threading
+import queue
 import os
 
+try:
+    import tv_denoising
+except ImportError:
+    tv_denoising = None
+
+BACKEND_EXECUTABLE = "Executable"
+BACKEND_CPU = "In-process CPU"
+BACKEND_GPU = "In-process GPU"
+
+SOLVERS = {"Gradient descent": "gd", "Barzilai-Borwein": "bb", "Lagged diffusivity": "ld"}
+
 class DenoiseGUI(tk.Tk):
     def __init__(self):
         super().__init__()
@@ -31,7 +45,7 @@ class DenoiseGUI(tk.Tk):
 
         self.ctrl_frame = tk.Frame(self)
         self.ctrl_frame.grid(row = 0, column = 1, sticky = "nsew", padx = 30, pady = 30)
-        for i in range(8):
+        for i in range(9):
             self.ctrl_frame.grid_rowconfigure(i, weight = 1)
         self.ctrl_frame.grid_columnconfigure(0, weight = 1)
 
@@ -51,15 +65,30 @@ class DenoiseGUI(tk.Tk):
         self.tol_entry = tk.Entry(self.ctrl_frame, textvariable = self.tol_var)
         self.tol_entry.grid(row = 2, column = 1, sticky = "ew", padx = 5, pady = 2)
 
+        backends = [BACKEND_EXECUTABLE]
+        if tv_denoising is not None:
+            backends += [BACKEND_CPU, BACKEND_GPU]
+        self.backend_var = tk.StringVar(value = BACKEND_CPU if tv_denoising is not None else BACKEND_EXECUTABLE)
+
+        tk.Label(self.ctrl_frame, text = "Backend:").grid(row = 3, column = 0, sticky = "w", padx = 5, pady = 2)
+        self.backend_menu = tk.OptionMenu(self.ctrl_frame, self.backend_var, *backends)
+        self.backend_menu.grid(row = 3, column = 1, sticky = "ew", padx = 5, pady = 2)
+
+        self.solver_var = tk.StringVar(value = next(iter(SOLVERS)))
+
+        tk.Label(self.ctrl_frame, text = "Solver:").grid(row = 4, column = 0, sticky = "w", padx = 5, pady = 2)
+        self.solver_menu = tk.OptionMenu(self.ctrl_frame, self.solver_var, *SOLVERS)
+        self.solver_menu.grid(row = 4, column = 1, sticky = "ew", padx = 5, pady = 2)
+
         self.ctrl_frame.grid_columnconfigure(1, weight = 1)
 
         self.load_btn = tk.Button(self.ctrl_frame, text = "Load Image", command = self.load_image)
-        self.load_btn.grid(row = 4, column = 0, columnspan = 2, pady = (30, 10), sticky = "ew")
+        self.load_btn.grid(row = 5, column = 0, columnspan = 2, pady = (30, 10), sticky = "ew")
         
         self.output_img_path_var = tk.StringVar()
         
         self.output_img_entry = tk.Entry(self.ctrl_frame, textvariable = self.output_img_path_var)
-        self.output_img_entry.grid(row = 5, column = 0, columnspan = 2, sticky = "ew", padx = 1, pady = (10, 0))
+        self.output_img_entry.grid(row = 6, column = 0, columnspan = 2, sticky = "ew", padx = 1, pady = (10, 0))
         placeholder = "Output image path"
         self.output_img_entry.insert(0, placeholder)
         self.output_img_entry.config(fg = 'grey')
@@ -85,7 +114,10 @@ class DenoiseGUI(tk.Tk):
         self.denoise_btn = tk.Button(
             self.ctrl_frame, text = "Denoise", command = self.on_denoise, font = ("Arial", 12, "bold")
         )
-        self.denoise_btn.grid(row = 6, column = 0, columnspan = 2, pady = (10, 30), sticky = "ew")
+        self.denoise_btn.grid(row = 7, column = 0, columnspan = 2, pady = (10, 30), sticky = "ew")
+
+        self.status_label = tk.Label(self.ctrl_frame, text = "")
+        self.status_label.grid(row = 8, column = 0, columnspan = 2, sticky = "w", padx = 5)
 
         self.image = None
         self.image_path = None
@@ -113,14 +145,85 @@ class DenoiseGUI(tk.Tk):
             self.image = ImageTk.PhotoImage(orig_img)
             self.img_label.config(image = self.image)
 
+    def show_image(self, img):
+        frame_width = self.img_frame.winfo_width()
+        frame_height = self.img_frame.winfo_height()
+
+        if img.width > frame_width or img.height > frame_height:
+            img.thumbnail((frame_width, frame_height), Image.LANCZOS)
+
+        self.image = ImageTk.PhotoImage(img)
+        self.img_label.config(image = self.image)
+
+    def denoise_in_process(self, output_img, strength, step, tol):
+        noisy = np.asarray(Image.open(self.image_path).convert('L'), dtype = np.float32) / 255.0
+        denoise = tv_denoising.denoise_gpu if self.backend_var.get() == BACKEND_GPU else tv_denoising.denoise_cpu
+        solver = SOLVERS[self.solver_var.get()]
+
+        # The solve runs in a worker thread, its progress is passed to the Tk thread through a queue
+        self.stop_requested = False
+        self.solve_queue = queue.Queue()
+
+        def progress(iteration, loss, image):
+            self.solve_queue.put(("progress", iteration, loss, np.asarray(image)))
+            return self.stop_requested
+
+        # Lagged diffusivity reports no progress and cannot be stopped, its button is disabled until it is done
+        solve_progress = None if solver == "ld" else progress
+
+        # Whatever the solve raises, the worker always posts a final message, poll_solve stops polling on it
+        def run():
+            result = ("error", RuntimeError("The solve ended without a result"))
+            try:
+                result = ("done", denoise(noisy, float(strength), float(step), float(tol), solver = solver, progress = solve_progress))
+            except Exception as e:
+                result = ("error", e)
+            finally:
+                self.solve_queue.put(result)
+
+        self.denoise_btn.config(text = "Stop", command = self.on_stop, state = tk.DISABLED if solve_progress is None else tk.NORMAL)
+        threading.Thread(target = run, daemon = True).start()
+        self.after(50, self.poll_solve, output_img, noisy.shape)
+
+    def on_stop(self):
+        self.stop_requested = True
+
+    def poll_solve(self, output_img, shape):
+        while not self.solve_queue.empty():
+            message = self.solve_queue.get()
+
+            if message[0] == "progress":
+                _, iteration, loss, preview = message
+                self.status_label.config(text = f"Iteration {iteration}, loss {loss:.4f}")
+                # The GPU preview is downsampled, it is shown at the size of the image
+                preview_img = Image.fromarray(np.rint(np.clip(preview, 0.0, 1.0) * 255.0).astype(np.uint8), mode = 'L')
+                self.show_image(preview_img.resize((shape[1], shape[0])))
+                continue
+
+            self.denoise_btn.config(text = "Denoise", command = self.on_denoise, state = tk.NORMAL)
+            if message[0] == "error":
+                print("Error:", message[1])
+                self.status_label.config(text = "")
+                messagebox.showerror("Error", f"Failed to denoise the image:\n{message[1]}")
+                return
+
+            self.status_label.config(text = "Stopped" if self.stop_requested else "Done")
+            out_img = Image.fromarray(np.rint(np.clip(message[1], 0.0, 1.0) * 255.0).astype(np.uint8), mode = 'L')
+            out_img.save(output_img)
+            self.show_image(out_img)
+            return
+
+        self.after(50, self.poll_solve, output_img, shape)
+
     def on_denoise(self):
         exe_path = self.exe_path_var.get()
         output_img = self.output_img_path_var.get()
         strength = self.strength_var.get()
         step = self.step_var.get()
         tol = self.tol_var.get()
+        in_process = self.backend_var.get() != BACKEND_EXECUTABLE
         
-        if not exe_path or not os.path.isfile(exe_path):
+        if not in_process and (not exe_path or not os.path.isfile(exe_path)):
             messagebox.showerror("Error", "Please provide a valid path to the denoising executable.")
             return
         
@@ -135,22 +238,18 @@ class DenoiseGUI(tk.Tk):
         if not strength or not step or not tol:
             messagebox.showerror("Error", "Please fill in all parameters (strength, step size, tolerance).")
             return
+
+        if in_process:
+            self.denoise_in_process(output_img, strength, step, tol)
+            return
         
         try:
             result = subprocess.run(
-                [exe_path, self.image_path, output_img, strength, step, tol, "true"],
+                [exe_path, self.image_path, output_img, strength, step, tol, "true", "--solver", SOLVERS[self.solver_var.get()]],
                 capture_output = True, text = True, check = True
             )
             print("Denoising output:\n", result.stdout)
-            out_img = Image.open(output_img)
-            frame_width = self.img_frame.winfo_width()
-            frame_height = self.img_frame.winfo_height()
-
-            if out_img.width > frame_width or out_img.height > frame_height:
-                out_img.thumbnail((frame_width, frame_height), Image.LANCZOS)
-
-            self.image = ImageTk.PhotoImage(out_img)
-            self.img_label.config(image = self.image)
+            self.show_image(Image.open(output_img))
         except subprocess.CalledProcessError as e:
             print("Error:", e.stderr)
             messagebox.showerror("Error", f"Failed to run denoising executable:\n{e.stderr}")